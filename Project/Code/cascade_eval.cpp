@@ -0,0 +1,418 @@
+/**
+ * @file cascade_eval.cpp
+ * @brief This file consists of the multi-scale search of the Haar cascades specialized at build time by cascade_gen.
+ *
+ * The search follows CascadeClassifier::detectMultiScale() for cascades of stumps: the image is resized to every
+ * scale, windows are visited every 2 pixels below scale 2 and every pixel above, a window is normalized by the
+ * standard deviation of its inner area, and the candidates are grouped with groupRectangles(). The windows of a row
+ * are evaluated 4 at a time by the generated code, with universal intrinsics (OpenCV's C++ implementation of them
+ * when the platform has no SIMD). Unlike detectMultiScale(), every window is evaluated: the next one is not skipped
+ * when a window fails the first stage, so that the 4 windows of a group stay evenly spaced.
+ * Several cascades can share a sweep, each over its own region of the image: a pyramid level is then resized and
+ * integrated once for all the cascades searching it, over the band of rows their regions cover.
+ * Cascades mapped from a binary cache at run time are attached after the compiled ones, and are evaluated by a loop
+ * over the cache with the same arithmetic.
+ *
+ */
+
+
+#include <math.h>
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+
+#include "cascade_eval.h"
+#include "model_cache.h"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * @brief This function loads an integral image value of 4 windows, STEP pixels apart.
+ */
+template<int STEP> static inline v_int32x4 cascade_load(const int* p)
+{
+	if(STEP == 1)
+		return v_load(p);
+	return v_int32x4(p[0], p[STEP], p[2*STEP], p[3*STEP]);
+}
+
+
+/**
+ * @brief This function returns the sum of an upright rectangle of 4 windows.
+ */
+template<int STEP, int X, int Y, int W, int H> static inline v_float32x4 cascade_rect(const int* sum)
+{
+	return v_cvt_f32(cascade_load<STEP>(sum + Y*CASCADE_STRIDE + X) - cascade_load<STEP>(sum + Y*CASCADE_STRIDE + X + W) -
+		cascade_load<STEP>(sum + (Y + H)*CASCADE_STRIDE + X) + cascade_load<STEP>(sum + (Y + H)*CASCADE_STRIDE + X + W));
+}
+
+
+/**
+ * @brief This function returns the sum of a rectangle rotated by 45 degrees of 4 windows.
+ */
+template<int STEP, int X, int Y, int W, int H> static inline v_float32x4 cascade_tilted(const int* tilted)
+{
+	return v_cvt_f32(cascade_load<STEP>(tilted + Y*CASCADE_STRIDE + X) - cascade_load<STEP>(tilted + (Y + H)*CASCADE_STRIDE + X - H) -
+		cascade_load<STEP>(tilted + (Y + W)*CASCADE_STRIDE + X + W) + cascade_load<STEP>(tilted + (Y + W + H)*CASCADE_STRIDE + X + W - H));
+}
+
+
+/**
+ * @brief This function returns the sum of an upright rectangle of 4 windows, the rectangle being known at run time only.
+ */
+template<int STEP> static inline v_float32x4 cascade_rect(const int* sum, const model_cache_rect_t* r)
+{
+	const int* p = sum + r->y*CASCADE_STRIDE + r->x;
+	int down = r->h*CASCADE_STRIDE;
+
+	return v_cvt_f32(cascade_load<STEP>(p) - cascade_load<STEP>(p + r->w) - cascade_load<STEP>(p + down) + cascade_load<STEP>(p + down + r->w));
+}
+
+
+/**
+ * @brief This function returns the sum of a rectangle rotated by 45 degrees of 4 windows, the rectangle being known at
+ * run time only.
+ */
+template<int STEP> static inline v_float32x4 cascade_tilted(const int* tilted, const model_cache_rect_t* r)
+{
+	const int* p = tilted + r->y*CASCADE_STRIDE + r->x;
+
+	return v_cvt_f32(cascade_load<STEP>(p) - cascade_load<STEP>(p + r->h*CASCADE_STRIDE - r->h) -
+		cascade_load<STEP>(p + r->w*CASCADE_STRIDE + r->w) + cascade_load<STEP>(p + (r->w + r->h)*CASCADE_STRIDE + r->w - r->h));
+}
+
+
+/**
+ * @brief This function weights a rectangle sum of a feature.
+ */
+static inline v_float32x4 cascade_weight(const v_float32x4& rect, float weight)
+{
+	return rect*v_setall_f32(weight);
+}
+
+
+/**
+ * @brief This function returns the leaf value of a stump. The threshold applies to the feature divided by the
+ * normalization of the window.
+ */
+static inline v_float32x4 cascade_stump(const v_float32x4& feature, const v_float32x4& norm, float threshold, float left, float right)
+{
+	return v_select(feature < norm*v_setall_f32(threshold), v_setall_f32(left), v_setall_f32(right));
+}
+
+
+//Generated from the cascade files, using the functions above
+#include "cascade_cars.h"
+#include "cascade_traffic.h"
+#include "cascade_stop.h"
+
+
+/**
+ * @brief This function runs a cascade mapped from a binary cache on 4 windows, STEP pixels apart, as the generated
+ * evaluators do.
+ */
+template<int STEP> static v_float32x4 cascade_cache_group(const model_cache_t* mc, const int* sum, const int* tilted, v_float32x4 norm)
+{
+	v_float32x4 pass = norm > v_setzero_f32();
+	v_float32x4 s, f;
+
+	for(uint32_t i=0; i<mc->hdr->n_stages; i++)
+	{
+		const model_cache_stage_t* stage = &mc->stages[i];
+
+		if(!v_check_any(pass))
+			return pass;
+		s = v_setzero_f32();
+		for(uint32_t j=stage->first; j<stage->first+stage->count; j++)
+		{
+			const model_cache_stump_t* st = &mc->stumps[j];
+			const model_cache_rect_t* r = &mc->rects[st->first];
+
+			f = cascade_weight(st->tilted ? cascade_tilted<STEP>(tilted, r) : cascade_rect<STEP>(sum, r), r->weight);
+			for(uint32_t k=1; k<st->count; k++)
+			{
+				f = f + cascade_weight(st->tilted ? cascade_tilted<STEP>(tilted, r + k) : cascade_rect<STEP>(sum, r + k), r[k].weight);
+			}
+			s = s + cascade_stump(f, norm, st->threshold, st->left, st->right);
+		}
+		pass = pass & (s >= v_setall_f32(stage->threshold));
+	}
+	return pass;
+}
+
+
+//Evaluator of 4 windows
+typedef v_float32x4 (*cascade_group_t)(const int* sum, const int* tilted, v_float32x4 norm);
+
+typedef struct
+{
+	const char* name;
+	int width, height;
+	bool tilted;
+	cascade_group_t group[2];				//For windows 1 and 2 pixels apart
+	const model_cache_t* cache;				//Evaluated by cascade_cache_group() instead when set
+} cascade_model_t;
+
+//The compiled cascades, by index, then those attached at run time
+static cascade_model_t models[CASCADE_MODELS + CASCADE_MAX_ATTACHED] =
+{
+	{"cars.xml", CARS_WIN_W, CARS_WIN_H, CARS_TILTED != 0, {cascade_cars_group<1>, cascade_cars_group<2>}, NULL},
+	{"traffic_light.xml", TRAFFIC_WIN_W, TRAFFIC_WIN_H, TRAFFIC_TILTED != 0, {cascade_traffic_group<1>, cascade_traffic_group<2>}, NULL},
+	{"stop_sign.xml", STOP_WIN_W, STOP_WIN_H, STOP_TILTED != 0, {cascade_stop_group<1>, cascade_stop_group<2>}, NULL}
+};
+static int n_models = CASCADE_MODELS;
+
+
+/**
+ * @brief This function makes a cascade mapped from a binary cache searchable by the functions below. Not thread safe:
+ * called before the services start.
+ * @param name The file the cascade was made from, for the reports.
+ * @param mc The mapped cache, kept mapped while the cascade is used.
+ * @return The index of the cascade, -1 if CASCADE_MAX_ATTACHED cascades are attached already.
+ */
+int cascade_attach(const char* name, const model_cache_t* mc)
+{
+	cascade_model_t* m;
+
+	if(n_models == CASCADE_MODELS + CASCADE_MAX_ATTACHED)
+		return -1;
+	m = &models[n_models];
+	m->name = name;
+	m->width = mc->hdr->width;
+	m->height = mc->hdr->height;
+	m->tilted = mc->hdr->tilted != 0;
+	m->group[0] = NULL;
+	m->group[1] = NULL;
+	m->cache = mc;
+	return n_models++;
+}
+
+
+/**
+ * @brief This function returns the size of the detection window of a cascade.
+ * @param model The index of the cascade.
+ * @return The size of the window, in pixels of the image searched at scale 1.
+ */
+Size cascade_window(int model)
+{
+	return Size(models[model].width, models[model].height);
+}
+
+
+/**
+ * @brief This function returns the file a cascade was generated from.
+ * @param model The index of the cascade.
+ * @return The name of the file.
+ */
+const char* cascade_name(int model)
+{
+	return models[model].name;
+}
+
+
+/**
+ * @brief This function tells whether the evaluators can search an image.
+ * @param img The image.
+ * @return false if the image is too wide or is not an 8 bit gray or BGR image, in which case CascadeClassifier must
+ * be used.
+ */
+bool cascade_supports(const Mat& img)
+{
+	return !img.empty() && (img.depth() == CV_8U) && ((img.channels() == 1) || (img.channels() == 3)) && (img.cols <= CASCADE_MAX_WIDTH);
+}
+
+
+/**
+ * @brief This function normalizes the windows of a row, and rejects those of too low a contrast.
+ */
+static void cascade_norm(const cascade_model_t* m, const int* sum, const double* sqsum, int sqstep, int step, int count, float* norm)
+{
+	int w = m->width - 2, h = m->height - 2;
+	double area = w*h;
+
+	//Inner area of the window, 1 pixel from its border
+	sum += CASCADE_STRIDE + 1;
+	sqsum += sqstep + 1;
+	for(int i=0; i<count; i++, sum+=step, sqsum+=step)
+	{
+		int s = sum[0] - sum[w] - sum[h*CASCADE_STRIDE] + sum[h*CASCADE_STRIDE + w];
+		double sq = sqsum[0] - sqsum[w] - sqsum[h*sqstep] + sqsum[h*sqstep + w];
+		double nf = area*sq - (double)s*s;
+
+		nf = (nf > 0) ? sqrt(nf) : 0;
+		norm[i] = (nf > CASCADE_MIN_NORM*area) ? (float)nf : 0.f;
+	}
+}
+
+
+/**
+ * @brief This function searches the windows of a scan that lie in its region of a pyramid level.
+ * @param band0 The first row of the level the integral images start at.
+ */
+static void cascade_scan_level(const cascade_model_t* m, cascade_work_t* work, const cascade_scan_t* scan, Rect r, int band0, double factor)
+{
+	int step = (factor >= 2) ? 1 : 2;
+	int count = (r.width - m->width)/step + 1;
+	int groups = (count + 3)/4;
+	Size size(cvRound(m->width*factor), cvRound(m->height*factor));
+
+	work->norm.assign(groups*4, 0.f);
+	for(int y=r.y; y<=r.y+r.height-m->height; y+=step)
+	{
+		const int* sum_row = &work->sum[(y - band0)*CASCADE_STRIDE + r.x];
+		const int* tilted_row = &work->tilted[(y - band0)*CASCADE_STRIDE + r.x];
+
+		cascade_norm(m, sum_row, work->sqsum.ptr<double>(y - band0) + r.x, (int)(work->sqsum.step/sizeof(double)), step, count, &work->norm[0]);
+		for(int g=0; g<groups; g++)
+		{
+			v_float32x4 norm = v_load(&work->norm[4*g]);
+			int hits;
+
+			if(m->cache)
+				hits = v_signmask((step == 1) ? cascade_cache_group<1>(m->cache, sum_row + 4*g, tilted_row + 4*g, norm) :
+					cascade_cache_group<2>(m->cache, sum_row + 8*g, tilted_row + 8*g, norm));
+			else
+				hits = v_signmask(m->group[step - 1](sum_row + 4*g*step, tilted_row + 4*g*step, norm));
+
+			for(int k=0; hits; k++, hits>>=1)
+			{
+				if(hits & 1)
+					scan->found->push_back(Rect(cvRound((r.x + (4*g + k)*step)*factor), cvRound(y*factor), size.width, size.height));
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief This function searches several cascades, each in its own region of an image, in one sweep: every level of
+ * the image pyramid is resized and integrated once, over the rows of the regions searched at that level, and every
+ * cascade due at the level is then run over it. A scan whose scale factor is a power of the sweep's uses every
+ * n-th level only.
+ * @param work The buffers of the caller.
+ * @param img The 8 bit gray or BGR image, as accepted by cascade_supports().
+ * @param scale_factor The scale step of the pyramid.
+ * @param scans The cascades and their regions. A cascade may be scanned in several regions.
+ * @param count The number of scans.
+ * @return void
+ */
+void cascade_scan(cascade_work_t* work, const Mat& img, double scale_factor, cascade_scan_t* scans, int count)
+{
+	vector<int> every(count);
+	vector<bool> done(count, false);
+	vector<Rect> level_roi(count);
+
+	if(img.channels() == 3)
+		cvtColor(img, work->gray, CV_BGR2GRAY);
+	else
+		work->gray = img;
+
+	for(int i=0; i<count; i++)
+	{
+		scans[i].found->clear();
+		every[i] = max(1, cvRound(log(scans[i].scale_factor)/log(scale_factor)));
+		if((scans[i].max_size.width == 0) || (scans[i].max_size.height == 0))
+			scans[i].max_size = scans[i].roi.size();
+	}
+
+	for(int level=0; ; level++)
+	{
+		double factor = pow(scale_factor, level);
+		Size sz(cvRound(img.cols/factor), cvRound(img.rows/factor));
+		int band0 = sz.height, band1 = 0;
+		bool searched = false, tilted = false, more = false;
+		Mat sum, sqsum, tilt;
+
+		//Regions of the scans due at this level, scaled to it
+		for(int i=0; i<count; i++)
+		{
+			const cascade_model_t* m = &models[scans[i].model];
+			Size size(cvRound(m->width*factor), cvRound(m->height*factor));
+			const Rect& roi = scans[i].roi;
+			Rect r;
+
+			level_roi[i] = Rect();
+			if(done[i])
+				continue;
+			r.x = cvRound(roi.x/factor);
+			r.y = cvRound(roi.y/factor);
+			r.width = min(cvRound((roi.x + roi.width)/factor), sz.width) - r.x;
+			r.height = min(cvRound((roi.y + roi.height)/factor), sz.height) - r.y;
+			if((size.width > scans[i].max_size.width) || (size.height > scans[i].max_size.height) || (r.width < m->width) || (r.height < m->height))
+			{
+				done[i] = true;
+				continue;
+			}
+			more = true;
+			if(((level % every[i]) != 0) || (size.width < scans[i].min_size.width) || (size.height < scans[i].min_size.height))
+				continue;
+
+			level_roi[i] = r;
+			band0 = min(band0, r.y);
+			band1 = max(band1, r.y + r.height);
+			tilted |= m->tilted;
+			searched = true;
+		}
+		if(!more)
+			break;
+		if(!searched)
+			continue;
+
+		if(sz == work->gray.size())
+			work->scaled = work->gray;
+		else
+			resize(work->gray, work->scaled, sz, 0, 0, INTER_LINEAR);
+
+		//Integral images of the rows searched, with the fixed row stride of the generated code, and rows to spare for
+		//the last window group
+		if(work->sum.size() < (size_t)(band1 - band0 + 2)*CASCADE_STRIDE)
+		{
+			work->sum.assign((size_t)(band1 - band0 + 2)*CASCADE_STRIDE, 0);
+			work->tilted.assign(work->sum.size(), 0);
+		}
+		sum = Mat(band1 - band0 + 1, sz.width + 1, CV_32S, &work->sum[0], CASCADE_STRIDE*sizeof(int));
+		if(tilted)
+		{
+			tilt = Mat(band1 - band0 + 1, sz.width + 1, CV_32S, &work->tilted[0], CASCADE_STRIDE*sizeof(int));
+			integral(work->scaled.rowRange(band0, band1), sum, work->sqsum, tilt, CV_32S, CV_64F);
+		}
+		else
+			integral(work->scaled.rowRange(band0, band1), sum, work->sqsum, CV_32S, CV_64F);
+
+		for(int i=0; i<count; i++)
+		{
+			if(level_roi[i].area() > 0)
+				cascade_scan_level(&models[scans[i].model], work, &scans[i], level_roi[i], band0, factor);
+		}
+	}
+
+	for(int i=0; i<count; i++)
+	{
+		if(scans[i].min_neighbors > 0)
+			groupRectangles(*scans[i].found, scans[i].min_neighbors, CASCADE_GROUP_EPS);
+	}
+}
+
+
+/**
+ * @brief This function detects the objects of a cascade in an image, as CascadeClassifier::detectMultiScale() does.
+ * @param model The index of the cascade.
+ * @param work The buffers of the caller.
+ * @param img The 8 bit gray or BGR image, as accepted by cascade_supports().
+ * @param objects Returns the grouped detections.
+ * @param scale_factor The scale step of the search.
+ * @param min_neighbors The candidates a detection must group, 0 to return the candidates ungrouped.
+ * @param min_size The smallest detection.
+ * @param max_size The largest detection, the image size if empty.
+ * @return void
+ */
+void cascade_detect(int model, cascade_work_t* work, const Mat& img, vector<Rect>& objects, double scale_factor,
+	int min_neighbors, Size min_size, Size max_size)
+{
+	cascade_scan_t scan = {model, Rect(0, 0, img.cols, img.rows), scale_factor, min_neighbors, min_size, max_size, &objects};
+
+	cascade_scan(work, img, scale_factor, &scan, 1);
+}
@@ -0,0 +1,72 @@
+/**
+ * @file cascade_eval.h
+ * @brief Haar cascades of the vehicle and sign services evaluated by code specialized at build time by cascade_gen,
+ * several of them in one sweep over a shared image pyramid, and of those mapped from binary caches at run time.
+ *
+ */
+
+#ifndef CASCADE_EVAL_H
+#define CASCADE_EVAL_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "model_cache.h"
+
+//Cascades compiled in, by index
+#define CASCADE_CARS						(0)
+#define CASCADE_TRAFFIC						(1)
+#define CASCADE_STOP						(2)
+#define CASCADE_MODELS						(3)
+
+//Cascades mapped from binary caches at run time, indexed after the compiled ones
+#define CASCADE_MAX_ATTACHED					(8)
+
+//Widest image the evaluators can search. Integral images are laid out with a fixed row stride, so that the offsets
+//of the feature rectangles are compile-time constants.
+#define CASCADE_MAX_WIDTH					(1024)
+#define CASCADE_STRIDE						(CASCADE_MAX_WIDTH + 16)
+
+//Windows whose inner area has a standard deviation of this many gray levels or less are rejected, as
+//CascadeClassifier does
+#define CASCADE_MIN_NORM					(10.0)
+
+//Overlap of the detections grouped together
+#define CASCADE_GROUP_EPS					(0.2)
+
+
+//Buffers of one caller of cascade_detect(), kept between calls to avoid reallocating them
+typedef struct
+{
+	cv::Mat gray;
+	cv::Mat scaled;
+	cv::Mat sqsum;
+	std::vector<int> sum;					//CASCADE_STRIDE ints per row
+	std::vector<int> tilted;
+	std::vector<float> norm;				//Of every window of a row
+} cascade_work_t;
+
+
+//One cascade searched in a region of the image of a sweep
+typedef struct
+{
+	int model;
+	cv::Rect roi;
+	double scale_factor;					//Rounded to a whole number of levels of the sweep's pyramid
+	int min_neighbors;					//0 to return the candidates ungrouped
+	cv::Size min_size;
+	cv::Size max_size;					//The region's size if empty
+	std::vector<cv::Rect>* found;				//Returns the detections, in image coordinates
+} cascade_scan_t;
+
+
+cv::Size cascade_window(int model);
+const char* cascade_name(int model);
+int cascade_attach(const char* name, const model_cache_t* mc);
+bool cascade_supports(const cv::Mat& img);
+void cascade_scan(cascade_work_t* work, const cv::Mat& img, double scale_factor, cascade_scan_t* scans, int count);
+void cascade_detect(int model, cascade_work_t* work, const cv::Mat& img, std::vector<cv::Rect>& objects, double scale_factor,
+	int min_neighbors, cv::Size min_size, cv::Size max_size);
+
+#endif
@@ -0,0 +1,507 @@
+/**
+ * @file cascade_gen.cpp
+ * @brief Build time generator of the specialized cascade evaluators used by cascade_eval.cpp.
+ *
+ * Reads a Haar cascade of stumps, in the old (opencv-haar-classifier) or the new (opencv-cascade-classifier) XML
+ * format, and writes a header with the cascade as straight-line code: every weak classifier becomes one statement
+ * whose feature rectangles are template arguments, so that their integral image offsets are compile-time constants,
+ * and whose thresholds and leaf values are literals. The evaluator works on 4 neighbouring windows at once with
+ * OpenCV's universal intrinsics, and returns as soon as every window of the group has been rejected by a stage.
+ * The generator only reads the two XML layouts written by OpenCV and does not link to it, so that it can run before
+ * anything else is built.
+ * With -b it writes the binary cache of the cascade read by model_cache.cpp instead, which the services map at
+ * startup in place of parsing the XML.
+ *
+ * Usage: cascade_gen cascade.xml name output.h
+ *        cascade_gen -b cascade.xml output.scm
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+
+#include "model_cache.h"
+
+using namespace std;
+
+//Stage thresholds are lowered by this much when OpenCV reads a cascade, to absorb float rounding
+#define GEN_THRESHOLD_EPS					(1e-5)
+
+//Most rectangles of a Haar feature
+#define GEN_MAX_RECTS						(3)
+
+
+//Element of the XML file
+typedef struct xml_node
+{
+	string name;
+	string text;
+	vector<xml_node> child;
+} xml_node_t;
+
+
+typedef struct
+{
+	int x, y, w, h;
+	double weight;
+} gen_rect_t;
+
+
+typedef struct
+{
+	int count;
+	gen_rect_t rect[GEN_MAX_RECTS];
+	bool tilted;
+} gen_feature_t;
+
+
+//Weak classifier of depth one: value < threshold ? left : right, the value being normalized by the window
+typedef struct
+{
+	gen_feature_t feature;
+	double threshold;
+	double left, right;
+} gen_stump_t;
+
+
+typedef struct
+{
+	double threshold;
+	vector<gen_stump_t> stumps;
+} gen_stage_t;
+
+
+typedef struct
+{
+	int width, height;
+	vector<gen_stage_t> stages;
+} gen_cascade_t;
+
+
+/**
+ * @brief This function prints an error and exits.
+ */
+static void gen_fail(const char* msg, const char* arg)
+{
+	fprintf(stderr, "cascade_gen: %s%s\n", msg, arg);
+	exit(EXIT_FAILURE);
+}
+
+
+/**
+ * @brief This function parses the elements of an XML file from a position until the end of the enclosing element.
+ * Declarations and comments are skipped, attributes are ignored.
+ */
+static void xml_parse(const string& s, size_t* pos, xml_node_t* parent)
+{
+	while(*pos < s.size())
+	{
+		size_t lt = s.find('<', *pos), gt;
+
+		if(lt == string::npos)
+			lt = s.size();
+		parent->text.append(s, *pos, lt - *pos);
+		*pos = lt;
+		if(lt == s.size())
+			return;
+
+		if(!s.compare(lt, 4, "<!--"))
+		{
+			gt = s.find("-->", lt);
+			if(gt == string::npos)
+				gen_fail("unterminated comment", "");
+			*pos = gt + 3;
+		}
+		else if(!s.compare(lt, 2, "<?"))
+		{
+			gt = s.find("?>", lt);
+			if(gt == string::npos)
+				gen_fail("unterminated declaration", "");
+			*pos = gt + 2;
+		}
+		else if(!s.compare(lt, 2, "</"))
+		{
+			gt = s.find('>', lt);
+			if(gt == string::npos)
+				gen_fail("unterminated tag", "");
+			*pos = gt + 1;
+			return;
+		}
+		else
+		{
+			xml_node_t node;
+			size_t end;
+
+			gt = s.find('>', lt);
+			if(gt == string::npos)
+				gen_fail("unterminated tag", "");
+			end = lt + 1;
+			while((end < gt) && !isspace((unsigned char)s[end]) && (s[end] != '/'))
+				end++;
+			node.name = s.substr(lt + 1, end - lt - 1);
+			*pos = gt + 1;
+			if(s[gt - 1] != '/')
+				xml_parse(s, pos, &node);
+			parent->child.push_back(node);
+		}
+	}
+}
+
+
+/**
+ * @brief This function returns the first child element of a name, NULL if there is none.
+ */
+static const xml_node_t* xml_child(const xml_node_t* node, const char* name)
+{
+	for(size_t i=0; node && (i<node->child.size()); i++)
+	{
+		if(node->child[i].name == name)
+			return &node->child[i];
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief This function returns the first child element of a name, and fails if there is none.
+ */
+static const xml_node_t* xml_need(const xml_node_t* node, const char* name)
+{
+	const xml_node_t* c = xml_child(node, name);
+
+	if(!c)
+		gen_fail("missing element ", name);
+	return c;
+}
+
+
+/**
+ * @brief This function returns the numbers of the text of an element.
+ */
+static vector<double> xml_numbers(const xml_node_t* node)
+{
+	vector<double> v;
+	const char* p = node->text.c_str();
+	char* end;
+
+	while(true)
+	{
+		double d = strtod(p, &end);
+
+		if(end == p)
+			break;
+		v.push_back(d);
+		p = end;
+	}
+	return v;
+}
+
+
+/**
+ * @brief This function reads the rectangles and the orientation of a Haar feature.
+ */
+static void gen_read_feature(const xml_node_t* node, gen_feature_t* f)
+{
+	const xml_node_t* rects = xml_need(node, "rects");
+	const xml_node_t* tilted = xml_child(node, "tilted");
+
+	f->count = 0;
+	for(size_t i=0; i<rects->child.size(); i++)
+	{
+		vector<double> r = xml_numbers(&rects->child[i]);
+
+		if(r.size() != 5)
+			gen_fail("bad feature rectangle", "");
+		if(r[4] == 0)
+			continue;
+		if(f->count == GEN_MAX_RECTS)
+			gen_fail("too many feature rectangles", "");
+		f->rect[f->count].x = (int)r[0];
+		f->rect[f->count].y = (int)r[1];
+		f->rect[f->count].w = (int)r[2];
+		f->rect[f->count].h = (int)r[3];
+		f->rect[f->count].weight = r[4];
+		f->count++;
+	}
+	f->tilted = tilted && (atoi(tilted->text.c_str()) != 0);
+}
+
+
+/**
+ * @brief This function reads a cascade in the old format: window size, and stages of trees with inline features.
+ */
+static void gen_read_old(const xml_node_t* root, gen_cascade_t* c)
+{
+	vector<double> size = xml_numbers(xml_need(root, "size"));
+	const xml_node_t* stages = xml_need(root, "stages");
+
+	if(size.size() != 2)
+		gen_fail("bad window size", "");
+	c->width = (int)size[0];
+	c->height = (int)size[1];
+
+	for(size_t i=0; i<stages->child.size(); i++)
+	{
+		const xml_node_t* trees = xml_need(&stages->child[i], "trees");
+		gen_stage_t stage;
+
+		stage.threshold = atof(xml_need(&stages->child[i], "stage_threshold")->text.c_str());
+		for(size_t j=0; j<trees->child.size(); j++)
+		{
+			const xml_node_t* node;
+			gen_stump_t stump;
+
+			if(trees->child[j].child.size() != 1)
+				gen_fail("only stumps are supported", "");
+			node = &trees->child[j].child[0];
+			if(!xml_child(node, "left_val") || !xml_child(node, "right_val"))
+				gen_fail("only stumps are supported", "");
+			gen_read_feature(xml_need(node, "feature"), &stump.feature);
+			stump.threshold = atof(xml_need(node, "threshold")->text.c_str());
+			stump.left = atof(xml_need(node, "left_val")->text.c_str());
+			stump.right = atof(xml_need(node, "right_val")->text.c_str());
+			stage.stumps.push_back(stump);
+		}
+		c->stages.push_back(stage);
+	}
+}
+
+
+/**
+ * @brief This function reads a cascade in the new format: window size, stages of weak classifiers referring to a
+ * shared list of features.
+ */
+static void gen_read_new(const xml_node_t* root, gen_cascade_t* c)
+{
+	const xml_node_t* stages = xml_need(root, "stages");
+	const xml_node_t* features = xml_need(root, "features");
+	const xml_node_t* type = xml_child(root, "featureType");
+
+	if(type && (type->text.find("HAAR") == string::npos))
+		gen_fail("only Haar features are supported", "");
+	c->width = atoi(xml_need(root, "width")->text.c_str());
+	c->height = atoi(xml_need(root, "height")->text.c_str());
+
+	for(size_t i=0; i<stages->child.size(); i++)
+	{
+		const xml_node_t* weak = xml_need(&stages->child[i], "weakClassifiers");
+		gen_stage_t stage;
+
+		stage.threshold = atof(xml_need(&stages->child[i], "stageThreshold")->text.c_str());
+		for(size_t j=0; j<weak->child.size(); j++)
+		{
+			vector<double> nodes = xml_numbers(xml_need(&weak->child[j], "internalNodes"));
+			vector<double> leaves = xml_numbers(xml_need(&weak->child[j], "leafValues"));
+			gen_stump_t stump;
+			size_t fi;
+
+			//A stump is a single node whose both children are the leaves 0 and 1
+			if((nodes.size() != 4) || (leaves.size() != 2) || (nodes[0] != 0) || (nodes[1] != -1))
+				gen_fail("only stumps are supported", "");
+			fi = (size_t)nodes[2];
+			if(fi >= features->child.size())
+				gen_fail("bad feature index", "");
+			gen_read_feature(&features->child[fi], &stump.feature);
+			stump.threshold = nodes[3];
+			stump.left = leaves[0];
+			stump.right = leaves[1];
+			stage.stumps.push_back(stump);
+		}
+		c->stages.push_back(stage);
+	}
+}
+
+
+/**
+ * @brief This function reads a cascade file, in either XML layout.
+ */
+static void gen_read(const char* path, gen_cascade_t* c)
+{
+	FILE* in;
+	string text;
+	char buf[4096];
+	size_t n, pos = 0;
+	xml_node_t doc;
+	const xml_node_t* storage;
+	const xml_node_t* root;
+
+	in = fopen(path, "r");
+	if(!in)
+		gen_fail("cannot open ", path);
+	while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+	{
+		text.append(buf, n);
+	}
+	fclose(in);
+
+	xml_parse(text, &pos, &doc);
+	storage = xml_need(&doc, "opencv_storage");
+	if(storage->child.size() != 1)
+		gen_fail("expected a single cascade in ", path);
+	root = &storage->child[0];
+	if(xml_child(root, "size"))
+		gen_read_old(root, c);
+	else
+		gen_read_new(root, c);
+	if(c->stages.empty() || (c->width < 3) || (c->height < 3))
+		gen_fail("empty cascade in ", path);
+}
+
+
+/**
+ * @brief This function writes the binary cache of a cascade, laid out as described in model_cache.h.
+ */
+static void gen_write_cache(FILE* out, const gen_cascade_t* c)
+{
+	model_cache_header_t hdr;
+	vector<model_cache_stage_t> stages;
+	vector<model_cache_stump_t> stumps;
+	vector<model_cache_rect_t> rects;
+
+	memset(&hdr, 0, sizeof(hdr));
+	for(size_t i=0; i<c->stages.size(); i++)
+	{
+		const gen_stage_t* stage = &c->stages[i];
+		model_cache_stage_t cs = {(uint32_t)stumps.size(), (uint32_t)stage->stumps.size(), (float)(stage->threshold - GEN_THRESHOLD_EPS)};
+
+		stages.push_back(cs);
+		for(size_t j=0; j<stage->stumps.size(); j++)
+		{
+			const gen_stump_t* st = &stage->stumps[j];
+			model_cache_stump_t cst = {(uint32_t)rects.size(), (uint32_t)st->feature.count, st->feature.tilted ? 1u : 0u,
+				(float)st->threshold, (float)st->left, (float)st->right};
+
+			stumps.push_back(cst);
+			hdr.tilted |= cst.tilted;
+			for(int k=0; k<st->feature.count; k++)
+			{
+				const gen_rect_t* r = &st->feature.rect[k];
+				model_cache_rect_t cr = {r->x, r->y, r->w, r->h, (float)r->weight};
+
+				rects.push_back(cr);
+			}
+		}
+	}
+	hdr.magic = MODEL_CACHE_MAGIC;
+	hdr.version = MODEL_CACHE_VERSION;
+	hdr.width = c->width;
+	hdr.height = c->height;
+	hdr.n_stages = stages.size();
+	hdr.n_stumps = stumps.size();
+	hdr.n_rects = rects.size();
+
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fwrite(&stages[0], sizeof(stages[0]), stages.size(), out);
+	fwrite(&stumps[0], sizeof(stumps[0]), stumps.size(), out);
+	fwrite(&rects[0], sizeof(rects[0]), rects.size(), out);
+}
+
+
+/**
+ * @brief This function writes the specialized evaluator of a cascade.
+ */
+static void gen_write(FILE* out, const gen_cascade_t* c, const char* xml, const char* name)
+{
+	string upper(name);
+	bool tilted = false;
+	size_t weak = 0;
+
+	for(size_t i=0; i<upper.size(); i++)
+	{
+		upper[i] = toupper((unsigned char)upper[i]);
+	}
+	for(size_t i=0; i<c->stages.size(); i++)
+	{
+		weak += c->stages[i].stumps.size();
+		for(size_t j=0; j<c->stages[i].stumps.size(); j++)
+		{
+			tilted |= c->stages[i].stumps[j].feature.tilted;
+		}
+	}
+
+	fprintf(out, "/**\n * @file cascade_%s.h\n", name);
+	fprintf(out, " * @brief Specialized evaluator of %s, %zu stages and %zu weak classifiers.\n", xml, c->stages.size(), weak);
+	fprintf(out, " *\n * Generated by cascade_gen, do not edit. Included by cascade_eval.cpp only.\n *\n */\n\n");
+	fprintf(out, "#ifndef CASCADE_%s_H\n#define CASCADE_%s_H\n\n", upper.c_str(), upper.c_str());
+	fprintf(out, "#define %s_WIN_W\t\t\t\t\t\t(%d)\n", upper.c_str(), c->width);
+	fprintf(out, "#define %s_WIN_H\t\t\t\t\t\t(%d)\n", upper.c_str(), c->height);
+	fprintf(out, "#define %s_STAGES\t\t\t\t\t\t(%zu)\n", upper.c_str(), c->stages.size());
+	fprintf(out, "#define %s_TILTED\t\t\t\t\t\t(%d)\n\n\n", upper.c_str(), tilted ? 1 : 0);
+
+	fprintf(out, "/**\n * @brief This function runs %s on 4 windows, STEP pixels apart.\n", xml);
+	fprintf(out, " * @param sum The integral image at the first window, CASCADE_STRIDE ints per row.\n");
+	fprintf(out, " * @param tilted The tilted integral image at the first window, unused without tilted features.\n");
+	fprintf(out, " * @param norm The variance normalization of every window, 0 for a rejected window.\n");
+	fprintf(out, " * @return The mask of the windows accepted by every stage.\n */\n");
+	fprintf(out, "template<int STEP> static v_float32x4 cascade_%s_group(const int* sum, const int* tilted, v_float32x4 norm)\n{\n", name);
+	fprintf(out, "\tv_float32x4 pass = norm > v_setzero_f32();\n\tv_float32x4 s;\n\n");
+	if(!tilted)
+		fprintf(out, "\t(void)tilted;\n\n");
+
+	for(size_t i=0; i<c->stages.size(); i++)
+	{
+		const gen_stage_t* stage = &c->stages[i];
+
+		fprintf(out, "\t//Stage %zu\n\tif(!v_check_any(pass))\n\t\treturn pass;\n\ts = v_setzero_f32();\n", i);
+		for(size_t j=0; j<stage->stumps.size(); j++)
+		{
+			const gen_stump_t* st = &stage->stumps[j];
+
+			fprintf(out, "\ts = s + cascade_stump(");
+			for(int k=0; k<st->feature.count; k++)
+			{
+				const gen_rect_t* r = &st->feature.rect[k];
+
+				fprintf(out, "%scascade_weight(cascade_%s<STEP, %d, %d, %d, %d>(%s), %.9ef)", k ? " + " : "",
+					st->feature.tilted ? "tilted" : "rect", r->x, r->y, r->w, r->h, st->feature.tilted ? "tilted" : "sum", r->weight);
+			}
+			fprintf(out, ", norm, %.9ef, %.9ef, %.9ef);\n", st->threshold, st->left, st->right);
+		}
+		fprintf(out, "\tpass = pass & (s >= v_setall_f32(%.9ef));\n\n", stage->threshold - GEN_THRESHOLD_EPS);
+	}
+	fprintf(out, "\treturn pass;\n}\n\n#endif\n");
+}
+
+
+/**
+ * @brief Reads the cascade given as first argument, and writes its evaluator named after the second argument to the
+ * file given as third argument.
+ */
+int main(int argc, char** argv)
+{
+	FILE* out;
+	gen_cascade_t cascade;
+	bool binary;
+	const char* xml;
+	const char* output;
+
+	binary = (argc == 4) && !strcmp(argv[1], "-b");
+	if((argc != 4) || (!binary && (argv[1][0] == '-')))
+	{
+		fprintf(stderr, "Usage: %s cascade.xml name output.h\n       %s -b cascade.xml output.scm\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	xml = binary ? argv[2] : argv[1];
+	output = argv[3];
+
+	gen_read(xml, &cascade);
+
+	out = fopen(output, binary ? "wb" : "w");
+	if(!out)
+		gen_fail("cannot write ", output);
+	if(binary)
+		gen_write_cache(out, &cascade);
+	else
+		gen_write(out, &cascade, xml, argv[2]);
+	if(ferror(out) || (fclose(out) != 0))
+	{
+		remove(output);
+		gen_fail("cannot write ", output);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+/**
+ * @file decoder.cpp
+ * @brief This file consists of the functions of the asynchronous decode stage.
+ *
+ * The decoder thread decodes into free slots of the frame ring and queues them, unpublished, in a bounded prefetch
+ * queue. The sequencer takes the next decoded slot, publishes it and releases the services, so decode jitter no
+ * longer shifts the releases as long as the decoder keeps ahead. The decoder records its decode times, and the
+ * sequencer records the queue depth it finds and how often it had to wait for a frame (starvation).
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+
+#include "decoder.h"
+
+using namespace cv;
+
+#define USEC_PER_SEC						(1000000)
+#define NSEC_PER_USEC						(1000)
+
+
+/**
+ * @brief Thread function of the decoder.
+ * @param arg The decoder_t.
+ * @return NULL
+ */
+static void* decoder_thread(void* arg)
+{
+	decoder_t* dec = (decoder_t*)arg;
+	frame_slot_t* slot;
+	struct timespec start, stop;
+	long us;
+
+	while(1)
+	{
+		//Waiting for room in the prefetch queue
+		pthread_mutex_lock(&dec->lock);
+		while((dec->count == dec->depth) && !dec->stop)
+		{
+			pthread_cond_wait(&dec->not_full, &dec->lock);
+		}
+		if(dec->stop)
+		{
+			pthread_mutex_unlock(&dec->lock);
+			break;
+		}
+		pthread_mutex_unlock(&dec->lock);
+
+		slot = frame_ring_acquire(dec->ring);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		*dec->capture >> slot->frame;
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		if(slot->frame.empty())
+		{
+			frame_ring_cancel(slot);
+			pthread_mutex_lock(&dec->lock);
+			dec->eos = true;
+			pthread_cond_broadcast(&dec->not_empty);
+			pthread_mutex_unlock(&dec->lock);
+			break;
+		}
+
+		us = (stop.tv_sec - start.tv_sec)*USEC_PER_SEC + (stop.tv_nsec - start.tv_nsec)/NSEC_PER_USEC;
+
+		pthread_mutex_lock(&dec->lock);
+		dec->frames++;
+		dec->decode_sum_us += us;
+		if(us > dec->decode_max_us)
+			dec->decode_max_us = us;
+		dec->item[(dec->head + dec->count) % DECODER_MAX_PREFETCH] = slot;
+		dec->count++;
+		pthread_cond_signal(&dec->not_empty);
+		pthread_mutex_unlock(&dec->lock);
+	}
+
+	pthread_exit(NULL);
+}
+
+
+/**
+ * @brief This function starts the decoder thread.
+ * @param dec The decoder.
+ * @param capture The opened video to decode. Only the decoder thread reads from it afterwards.
+ * @param ring The ring to decode into. The decoder becomes the ring's writer.
+ * @param depth The number of frames the decoder may run ahead, from 1 to DECODER_MAX_PREFETCH.
+ * @param cpu The core the decoder is pinned to.
+ * @param prio The SCHED_FIFO priority of the decoder.
+ * @return void
+ */
+void decoder_start(decoder_t* dec, VideoCapture* capture, frame_ring_t* ring, int depth, int cpu, int prio)
+{
+	pthread_attr_t attr;
+	pthread_mutexattr_t mattr;
+	struct sched_param param;
+	cpu_set_t cpuset;
+
+	if(depth < 1)
+		depth = 1;
+	if(depth > DECODER_MAX_PREFETCH)
+		depth = DECODER_MAX_PREFETCH;
+
+	dec->capture = capture;
+	dec->ring = ring;
+	dec->head = 0;
+	dec->count = 0;
+	dec->depth = depth;
+	dec->eos = false;
+	dec->stop = false;
+	dec->frames = 0;
+	dec->decode_sum_us = 0;
+	dec->decode_max_us = 0;
+	dec->takes = 0;
+	dec->depth_sum = 0;
+	dec->depth_max = 0;
+	dec->starved = 0;
+	//The sequencer and the decoder run at different priorities
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+	if(pthread_mutex_init(&dec->lock, &mattr) != 0)
+	{
+		perror("ERROR: pthread_mutex_init for decoder");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutexattr_destroy(&mattr);
+	pthread_cond_init(&dec->not_empty, NULL);
+	pthread_cond_init(&dec->not_full, NULL);
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	param.sched_priority = prio;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+
+	if(pthread_create(&dec->thread, &attr, decoder_thread, (void*)dec) != 0)
+	{
+		perror("ERROR: pthread_create for decoder");
+		exit(EXIT_FAILURE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+
+/**
+ * @brief This function takes the next decoded frame, waiting for the decoder if the prefetch queue is empty.
+ * @param dec The decoder.
+ * @return The slot, owned by the caller until published or cancelled. NULL at end of stream.
+ */
+frame_slot_t* decoder_next(decoder_t* dec)
+{
+	frame_slot_t* slot;
+
+	pthread_mutex_lock(&dec->lock);
+
+	dec->takes++;
+	dec->depth_sum += dec->count;
+	if(dec->count > dec->depth_max)
+		dec->depth_max = dec->count;
+	if((dec->count == 0) && !dec->eos)
+		dec->starved++;
+
+	while((dec->count == 0) && !dec->eos)
+	{
+		pthread_cond_wait(&dec->not_empty, &dec->lock);
+	}
+	if(dec->count == 0)
+	{
+		pthread_mutex_unlock(&dec->lock);
+		return NULL;
+	}
+
+	slot = dec->item[dec->head];
+	dec->head = (dec->head + 1) % DECODER_MAX_PREFETCH;
+	dec->count--;
+	pthread_cond_signal(&dec->not_full);
+	pthread_mutex_unlock(&dec->lock);
+
+	return slot;
+}
+
+
+/**
+ * @brief This function stops the decoder thread and returns the frames it prefetched to the ring.
+ * @param dec The decoder.
+ * @return void
+ */
+void decoder_stop(decoder_t* dec)
+{
+	pthread_mutex_lock(&dec->lock);
+	dec->stop = true;
+	pthread_cond_broadcast(&dec->not_full);
+	pthread_mutex_unlock(&dec->lock);
+
+	pthread_join(dec->thread, NULL);
+
+	while(dec->count > 0)
+	{
+		frame_ring_cancel(dec->item[dec->head]);
+		dec->head = (dec->head + 1) % DECODER_MAX_PREFETCH;
+		dec->count--;
+	}
+	pthread_mutex_destroy(&dec->lock);
+	pthread_cond_destroy(&dec->not_empty);
+	pthread_cond_destroy(&dec->not_full);
+}
+
+
+/**
+ * @brief This function prints the decode time, prefetch queue depth and starvation counters.
+ * @param dec The decoder.
+ * @return void
+ */
+void decoder_report(decoder_t* dec)
+{
+	printf("\nDECODER:\n");
+	printf("DECODER Frames decoded: %lu\n", dec->frames);
+	printf("DECODER Decode time avg/max: %.0f/%ld us\n", dec->frames ? dec->decode_sum_us/dec->frames : 0.0, dec->decode_max_us);
+	printf("DECODER Prefetch depth avg/max: %.2f/%d of %d\n", dec->takes ? (double)dec->depth_sum/dec->takes : 0.0, dec->depth_max, dec->depth);
+	printf("DECODER Starved: %lu of %lu frames\n", dec->starved, dec->takes);
+}
@@ -0,0 +1,53 @@
+/**
+ * @file decoder.h
+ * @brief Asynchronous decode stage feeding the sequencer through a bounded prefetch queue of decoded frames.
+ *
+ */
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <pthread.h>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "frame_ring.h"
+
+//Largest number of decoded frames the decoder may run ahead of the sequencer
+#define DECODER_MAX_PREFETCH					(4)
+
+
+typedef struct
+{
+	cv::VideoCapture* capture;
+	frame_ring_t* ring;
+	pthread_t thread;
+
+	//Prefetch queue of decoded, not yet published slots
+	frame_slot_t* item[DECODER_MAX_PREFETCH];
+	int head;
+	int count;
+	int depth;
+	bool eos;						//End of stream reached, no more frames will be queued
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+
+	//Statistics
+	unsigned long frames;					//Frames decoded
+	double decode_sum_us;
+	long decode_max_us;
+	unsigned long takes;					//Frames taken by the sequencer
+	unsigned long depth_sum;				//Queue depth seen by the sequencer, summed over takes
+	int depth_max;
+	unsigned long starved;					//Takes that found the queue empty and had to wait
+} decoder_t;
+
+
+void decoder_start(decoder_t* dec, cv::VideoCapture* capture, frame_ring_t* ring, int depth, int cpu, int prio);
+frame_slot_t* decoder_next(decoder_t* dec);
+void decoder_stop(decoder_t* dec);
+void decoder_report(decoder_t* dec);
+
+#endif
@@ -0,0 +1,244 @@
+/**
+ * @file dispatch.cpp
+ * @brief This file consists of the functions of the bounded dispatch queue.
+ *
+ * A counting semaphore remembers every release, so a service that overruns its period keeps running back to back on
+ * stale frames and never catches up. The dispatch queue holds at most depth frames and applies a policy when it is
+ * full, so the backlog, and with it the latency of the service, stays bounded. Dropped releases are counted.
+ * The mutex uses priority inheritance, since the sequencer and the services run under SCHED_FIFO.
+ * With several streams the depth is accounted per stream, so a fast stream cannot starve a slow one of releases.
+ * A release on the frame the stream queued last only adds its flags to that item, so a frame is searched once.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dispatch.h"
+
+
+/**
+ * @brief This function initializes an empty dispatch queue.
+ * @param q The queue.
+ * @param depth The maximum number of pending frames per stream, from 1 to DISPATCH_MAX_DEPTH.
+ * @param policy The policy applied when a release finds the queue full.
+ * @return void
+ */
+void dispatch_init(dispatch_q_t* q, int depth, dispatch_policy_t policy)
+{
+	pthread_mutexattr_t attr;
+
+	if(depth < 1)
+		depth = 1;
+	if(depth > DISPATCH_MAX_DEPTH)
+		depth = DISPATCH_MAX_DEPTH;
+
+	q->head = 0;
+	q->count = 0;
+	q->depth = depth;
+	q->policy = policy;
+	q->closed = false;
+	q->skipped = 0;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	if(pthread_mutex_init(&q->lock, &attr) != 0)
+	{
+		perror("ERROR: pthread_mutex_init for dispatch queue");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutexattr_destroy(&attr);
+	pthread_cond_init(&q->not_full, NULL);
+}
+
+
+/**
+ * @brief This function counts the pending frames of one stream. Must be called with the lock held.
+ * @param q The queue.
+ * @param ctx The stream.
+ * @return The number of frames of the stream in the queue.
+ */
+static int dispatch_pending(dispatch_q_t* q, void* ctx)
+{
+	int n = 0;
+
+	for(int i=0; i<q->count; i++)
+	{
+		if(q->item[(q->head + i) % DISPATCH_MAX_ITEMS].ctx == ctx)
+			n++;
+	}
+	return n;
+}
+
+
+/**
+ * @brief This function releases a service on a frame. The queue takes its own reference on the frame.
+ * @param q The queue of the service.
+ * @param slot The published frame.
+ * @param ctx The stream the frame belongs to. The depth and the policy apply to the frames of this stream only.
+ * @param flags The work the release asks of the job beyond its own, 0 for none.
+ * @return true if the frame was queued, false if the release was skipped or added to the item of the same frame.
+ */
+bool dispatch_release(dispatch_q_t* q, frame_slot_t* slot, void* ctx, unsigned flags)
+{
+	frame_slot_t* dropped = NULL;
+	int i, k;
+
+	pthread_mutex_lock(&q->lock);
+
+	//The same frame queued last by the stream carries the flags of both releases
+	for(k=q->count-1; (k >= 0) && (q->item[(q->head + k) % DISPATCH_MAX_ITEMS].ctx != ctx); k--);
+	if((k >= 0) && (q->item[(q->head + k) % DISPATCH_MAX_ITEMS].frame == slot))
+	{
+		q->item[(q->head + k) % DISPATCH_MAX_ITEMS].flags |= flags;
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+
+	if(q->policy == DISPATCH_BLOCK)
+	{
+		while((dispatch_pending(q, ctx) == q->depth) && !q->closed)
+		{
+			pthread_cond_wait(&q->not_full, &q->lock);
+		}
+	}
+
+	if(q->closed)
+	{
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+
+	if((dispatch_pending(q, ctx) == q->depth) || (q->count == DISPATCH_MAX_ITEMS))
+	{
+		q->skipped++;
+		if(q->policy == DISPATCH_DROP_NEWEST)
+		{
+			pthread_mutex_unlock(&q->lock);
+			return false;
+		}
+
+		//Latest wins: the oldest frame of the stream makes room for the new one, which takes over its flags. The frames
+		//queued before it move up one place.
+		for(k=0; (k < q->count - 1) && (q->item[(q->head + k) % DISPATCH_MAX_ITEMS].ctx != ctx); k++);
+		dropped = q->item[(q->head + k) % DISPATCH_MAX_ITEMS].frame;
+		flags |= q->item[(q->head + k) % DISPATCH_MAX_ITEMS].flags;
+		for(i=k; i>0; i--)
+		{
+			q->item[(q->head + i) % DISPATCH_MAX_ITEMS] = q->item[(q->head + i - 1) % DISPATCH_MAX_ITEMS];
+		}
+		q->head = (q->head + 1) % DISPATCH_MAX_ITEMS;
+		q->count--;
+	}
+
+	q->item[(q->head + q->count) % DISPATCH_MAX_ITEMS].frame = frame_ref(slot);
+	q->item[(q->head + q->count) % DISPATCH_MAX_ITEMS].ctx = ctx;
+	q->item[(q->head + q->count) % DISPATCH_MAX_ITEMS].flags = flags;
+	q->count++;
+	pthread_mutex_unlock(&q->lock);
+
+	if(dropped != NULL)
+	{
+		frame_release(dropped);
+	}
+	return true;
+}
+
+
+/**
+ * @brief This function takes the next frame of a service without waiting, in release order over all streams.
+ * @param q The queue of the service.
+ * @param ctx Returns the stream the frame belongs to.
+ * @param flags Returns the flags of the release.
+ * @return The frame handle, to be given back with frame_release(). NULL if the queue is empty.
+ */
+frame_slot_t* dispatch_try_take(dispatch_q_t* q, void** ctx, unsigned* flags)
+{
+	frame_slot_t* slot = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if(q->count > 0)
+	{
+		slot = q->item[q->head].frame;
+		*ctx = q->item[q->head].ctx;
+		*flags = q->item[q->head].flags;
+		q->head = (q->head + 1) % DISPATCH_MAX_ITEMS;
+		q->count--;
+		//Every stream may be waiting for room, wake them all
+		pthread_cond_broadcast(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return slot;
+}
+
+
+/**
+ * @brief This function returns the number of frames pending in a queue, over all streams.
+ * @param q The queue.
+ * @return The number of pending frames.
+ */
+int dispatch_count(dispatch_q_t* q)
+{
+	int count;
+
+	pthread_mutex_lock(&q->lock);
+	count = q->count;
+	pthread_mutex_unlock(&q->lock);
+
+	return count;
+}
+
+
+/**
+ * @brief This function closes a queue. Releases waiting for room return and later ones are skipped. The frames
+ * already queued can still be taken.
+ * @param q The queue.
+ * @return void
+ */
+void dispatch_close(dispatch_q_t* q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = true;
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+
+/**
+ * @brief This function releases the frames left in a queue and destroys it.
+ * @param q The queue.
+ * @return void
+ */
+void dispatch_destroy(dispatch_q_t* q)
+{
+	while(q->count > 0)
+	{
+		frame_release(q->item[q->head].frame);
+		q->head = (q->head + 1) % DISPATCH_MAX_ITEMS;
+		q->count--;
+	}
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_full);
+}
+
+
+/**
+ * @brief This function returns the printable name of a dispatch policy.
+ * @param policy The policy.
+ * @return The name.
+ */
+const char* dispatch_policy_name(dispatch_policy_t policy)
+{
+	switch(policy)
+	{
+		case DISPATCH_LATEST_WINS:
+			return "latest-wins";
+		case DISPATCH_DROP_NEWEST:
+			return "drop-newest";
+		case DISPATCH_BLOCK:
+			return "block";
+	}
+	return "unknown";
+}
@@ -0,0 +1,62 @@
+/**
+ * @file dispatch.h
+ * @brief Bounded per-service dispatch queue of frame handles, replacing the counting semaphores.
+ *
+ * A queue is shared by every stream releasing the service. Each item carries the context of the stream it belongs
+ * to, and the depth and policy apply per stream, so one stream's releases never displace another's.
+ *
+ */
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <pthread.h>
+
+#include "frame_ring.h"
+
+//Largest queue depth (per stream) a service can be configured with, and the most streams sharing a queue
+#define DISPATCH_MAX_DEPTH					(4)
+#define DISPATCH_MAX_STREAMS					(8)
+#define DISPATCH_MAX_ITEMS					(DISPATCH_MAX_DEPTH*DISPATCH_MAX_STREAMS)
+
+
+//What happens when a service is released while its queue is full
+typedef enum
+{
+	DISPATCH_LATEST_WINS,					//Drop the oldest queued frame and queue the new one
+	DISPATCH_DROP_NEWEST,					//Keep the queued frames and skip the new release
+	DISPATCH_BLOCK						//Make the sequencer wait until the service takes a frame
+} dispatch_policy_t;
+
+
+typedef struct
+{
+	frame_slot_t* frame;
+	void* ctx;						//Stream the frame belongs to
+	unsigned flags;						//Work the release asks of the job beyond its own, given to the job
+} dispatch_item_t;
+
+
+typedef struct
+{
+	dispatch_item_t item[DISPATCH_MAX_ITEMS];
+	int head;
+	int count;
+	int depth;						//Maximum number of pending frames per stream
+	dispatch_policy_t policy;
+	bool closed;
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	unsigned long skipped;					//Releases dropped because the service was behind
+} dispatch_q_t;
+
+
+void dispatch_init(dispatch_q_t* q, int depth, dispatch_policy_t policy);
+bool dispatch_release(dispatch_q_t* q, frame_slot_t* slot, void* ctx, unsigned flags);
+frame_slot_t* dispatch_try_take(dispatch_q_t* q, void** ctx, unsigned* flags);
+int dispatch_count(dispatch_q_t* q);
+void dispatch_close(dispatch_q_t* q);
+void dispatch_destroy(dispatch_q_t* q);
+const char* dispatch_policy_name(dispatch_policy_t policy);
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * @file frame_ring.cpp
+ * @brief This file consists of the functions implementing the reference counted frame ring.
+ *
+ * There is a single writer (the thread decoding frames) and any number of readers. Slot ownership is decided
+ * entirely by the reference count, so neither side takes a lock to claim or reference a slot:
+ * - The writer only claims slots whose count is 0 (free) and marks them FRAME_SLOT_WRITING.
+ * - Readers only add a reference to a slot whose count is already above 0, i.e. a slot that is published.
+ * When every slot is in use the writer sleeps on a condition variable that the reader dropping a slot's last reference
+ * signals, rather than yielding, which under SCHED_FIFO would starve the lower priority readers of its core.
+ *
+ * The images the services derive from a frame are made once per frame, by the first service asking for them, and
+ * kept in the slot with a lock per image, so the other services wait for it instead of making it again. The writer
+ * invalidates them before publishing, while it owns the slot alone. An image is only valid while a handle to the
+ * frame is held, since the next frame in the slot overwrites it.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "frame_ring.h"
+
+using namespace cv;
+
+
+/**
+ * @brief This function preallocates every slot of the ring.
+ * @param ring The ring to be initialized.
+ * @param size The size of the frames that will be decoded into the ring.
+ * @param type The OpenCV type of the frames, e.g. CV_8UC3.
+ * @return void
+ */
+void frame_ring_init(frame_ring_t* ring, Size size, int type)
+{
+	pthread_mutexattr_t attr;
+
+	//The decoder, the sequencer and the service jobs take these locks at different priorities
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	for(int i=0; i<FRAME_RING_SLOTS; i++)
+	{
+		ring->slot[i].frame.create(size, type);
+		ring->slot[i].seq = 0;
+		ring->slot[i].refcnt.store(0);
+		ring->slot[i].wait = &ring->wait;
+		for(int k=0; k<FRAME_DERIVED_KINDS; k++)
+		{
+			if(pthread_mutex_init(&ring->slot[i].derived[k].lock, &attr) != 0)
+			{
+				perror("ERROR: pthread_mutex_init for frame ring");
+				exit(EXIT_FAILURE);
+			}
+			ring->slot[i].derived[k].valid = false;
+			ring->slot[i].derived[k].hits = 0;
+			ring->slot[i].derived[k].misses = 0;
+		}
+	}
+	ring->latest.store(NULL);
+	ring->next = 0;
+	if(pthread_mutex_init(&ring->wait.lock, &attr) != 0)
+	{
+		perror("ERROR: pthread_mutex_init for frame ring");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutexattr_destroy(&attr);
+	pthread_cond_init(&ring->wait.freed, NULL);
+}
+
+
+/**
+ * @brief This function claims the first free slot from the writer's index.
+ * @return The claimed slot, NULL if all slots are in use.
+ */
+static frame_slot_t* frame_ring_try_claim(frame_ring_t* ring)
+{
+	int expected;
+
+	for(int i=0; i<FRAME_RING_SLOTS; i++)
+	{
+		frame_slot_t* slot = &ring->slot[(ring->next + i) % FRAME_RING_SLOTS];
+
+		expected = 0;
+		if(slot->refcnt.compare_exchange_strong(expected, FRAME_SLOT_WRITING, std::memory_order_acquire))
+		{
+			ring->next = (ring->next + i + 1) % FRAME_RING_SLOTS;
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief This function claims a free slot for the writer. Sleeps until one is released if all slots are in use.
+ * @param ring The ring to claim the slot from.
+ * @return The claimed slot, owned by the writer until it is published or cancelled.
+ */
+frame_slot_t* frame_ring_acquire(frame_ring_t* ring)
+{
+	frame_slot_t* slot;
+
+	slot = frame_ring_try_claim(ring);
+	if(slot != NULL)
+		return slot;
+
+	//A slot freed after the scan under the lock signals once the writer waits, so no wakeup is lost
+	pthread_mutex_lock(&ring->wait.lock);
+	while((slot = frame_ring_try_claim(ring)) == NULL)
+	{
+		pthread_cond_wait(&ring->wait.freed, &ring->wait.lock);
+	}
+	pthread_mutex_unlock(&ring->wait.lock);
+	return slot;
+}
+
+
+/**
+ * @brief This function returns a claimed slot to the ring without publishing it, e.g. when decoding failed.
+ * @param slot The slot obtained from frame_ring_acquire().
+ * @return void
+ */
+void frame_ring_cancel(frame_slot_t* slot)
+{
+	slot->refcnt.store(0, std::memory_order_release);
+}
+
+
+/**
+ * @brief This function stamps and publishes a written slot as the latest frame and drops the ring's reference on the previous one.
+ * The writer may keep reading the slot until it publishes the next one, since the ring's reference keeps it alive.
+ * @param ring The ring the slot belongs to.
+ * @param slot The slot obtained from frame_ring_acquire().
+ * @param seq The sequence number of the frame.
+ * @return void
+ */
+void frame_ring_publish(frame_ring_t* ring, frame_slot_t* slot, uint64_t seq)
+{
+	frame_slot_t* prev;
+
+	slot->seq = seq;
+	clock_gettime(CLOCK_MONOTONIC, &slot->stamp);
+	for(int k=0; k<FRAME_DERIVED_KINDS; k++)
+	{
+		slot->derived[k].valid = false;
+	}
+	slot->refcnt.store(1, std::memory_order_release);
+
+	prev = ring->latest.exchange(slot, std::memory_order_acq_rel);
+	if(prev != NULL)
+	{
+		frame_release(prev);
+	}
+}
+
+
+/**
+ * @brief This function adds a reference to a handle the caller already holds.
+ * @param slot A valid handle.
+ * @return The same handle.
+ */
+frame_slot_t* frame_ref(frame_slot_t* slot)
+{
+	slot->refcnt.fetch_add(1, std::memory_order_relaxed);
+	return slot;
+}
+
+
+/**
+ * @brief This function releases a handle. The slot becomes free for the writer when the last reference is dropped,
+ * and the writer is woken if it waits for one.
+ * @param slot The handle to release.
+ * @return void
+ */
+void frame_release(frame_slot_t* slot)
+{
+	if(slot->refcnt.fetch_sub(1, std::memory_order_release) == 1)
+	{
+		pthread_mutex_lock(&slot->wait->lock);
+		pthread_cond_signal(&slot->wait->freed);
+		pthread_mutex_unlock(&slot->wait->lock);
+	}
+}
+
+
+/**
+ * @brief This function gives an image derived from the frame of a handle, made by the first call on the frame and
+ * shared by the later ones.
+ * @param slot A valid handle, held for as long as the image is used.
+ * @param kind One of the FRAME_DERIVED_* images.
+ * @return The image, read-only. Its data is overwritten once the slot holds another frame.
+ */
+Mat frame_derived(frame_slot_t* slot, int kind)
+{
+	frame_derived_t* d = &slot->derived[kind];
+	Mat img;
+
+	pthread_mutex_lock(&d->lock);
+	if(d->valid)
+		d->hits++;
+	else
+	{
+		switch(kind)
+		{
+			case FRAME_DERIVED_GRAY:
+				cvtColor(slot->frame, d->img, CV_BGR2GRAY);
+				break;
+			case FRAME_DERIVED_PYR:
+				pyrDown(slot->frame, d->img);
+				break;
+			case FRAME_DERIVED_HALF:
+				img = frame_derived(slot, FRAME_DERIVED_PYR);
+				d->img = img(Rect(0, img.rows/2, img.cols, img.rows/2));
+				break;
+			case FRAME_DERIVED_HALF_GRAY:
+				cvtColor(frame_derived(slot, FRAME_DERIVED_HALF), d->img, CV_RGB2GRAY);
+				break;
+			case FRAME_DERIVED_RESIZED:
+				resize(slot->frame, d->img, Size(slot->frame.cols/2, slot->frame.rows/2));
+				break;
+		}
+		d->valid = true;
+		d->misses++;
+	}
+	img = d->img;
+	pthread_mutex_unlock(&d->lock);
+	return img;
+}
+
+
+/**
+ * @brief This function prints how often the derived images of a stream were made (misses) and shared (hits).
+ * @param ring The ring of the stream.
+ * @param stream The index of the stream.
+ * @return void
+ */
+void frame_ring_report(const frame_ring_t* ring, int stream)
+{
+	static const char* name[FRAME_DERIVED_KINDS] = {"gray", "pyrDown", "half", "half gray", "resized"};
+
+	for(int k=0; k<FRAME_DERIVED_KINDS; k++)
+	{
+		unsigned long hits = 0, misses = 0;
+
+		for(int i=0; i<FRAME_RING_SLOTS; i++)
+		{
+			hits += ring->slot[i].derived[k].hits;
+			misses += ring->slot[i].derived[k].misses;
+		}
+		if(hits + misses)
+			printf("FRAME CACHE stream %d: %s %lu misses, %lu hits\n", stream, name[k], misses, hits);
+	}
+}
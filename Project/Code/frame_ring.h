@@ -0,0 +1,87 @@
+/**
+ * @file frame_ring.h
+ * @brief Fixed capacity ring of preallocated, reference counted frame slots shared between the sequencer and the services.
+ *
+ * The decoder (writer) decodes into a free slot and the sequencer publishes it. Services are handed a read-only handle
+ * to a published slot by their dispatch queue instead of cloning a global frame, and release the handle once they
+ * have derived their own images.
+ * Images several services derive from a frame are kept in its slot, made by the first service asking for them.
+ *
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+#include <opencv2/core/core.hpp>
+
+//Number of slots in the ring. Must cover the prefetched frames, the queued and in-use handles of every service,
+//the slot being decoded and the latest slot.
+#define FRAME_RING_SLOTS					(16)
+
+//Reference count value of a slot that is owned by the writer.
+#define FRAME_SLOT_WRITING					(-1)
+
+//Images derived from a frame, kept in its slot: the gray frame, the pyrDown() image, its bottom half as preprocess()
+//crops it, the gray of that half by CV_RGB2GRAY as the vehicle search has always taken it, and the frame at half size
+#define FRAME_DERIVED_GRAY					(0)
+#define FRAME_DERIVED_PYR					(1)
+#define FRAME_DERIVED_HALF					(2)
+#define FRAME_DERIVED_HALF_GRAY					(3)
+#define FRAME_DERIVED_RESIZED					(4)
+#define FRAME_DERIVED_KINDS					(5)
+
+
+//Wakes the writer waiting for a free slot
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t freed;					//Signalled when a slot's last reference is dropped
+} frame_ring_wait_t;
+
+
+//An image derived from the frame of a slot, made at most once per frame
+typedef struct
+{
+	pthread_mutex_t lock;
+	bool valid;						//Made from the frame in the slot
+	cv::Mat img;
+	unsigned long hits;					//Requests served by the image already made
+	unsigned long misses;					//Requests that made it
+} frame_derived_t;
+
+
+typedef struct
+{
+	cv::Mat frame;						//Preallocated frame buffer. Read-only while refcnt > 0.
+	uint64_t seq;						//Sequence number (frame count) of the frame in this slot.
+	struct timespec stamp;					//Time the frame was published (CLOCK_MONOTONIC).
+	std::atomic<int> refcnt;				//-1 = being written, 0 = free, >0 = number of handles (ring + readers).
+	frame_derived_t derived[FRAME_DERIVED_KINDS];		//Valid while a handle is held, invalidated on publish.
+	frame_ring_wait_t* wait;				//Of the ring the slot belongs to
+} frame_slot_t;
+
+
+typedef struct
+{
+	frame_slot_t slot[FRAME_RING_SLOTS];
+	std::atomic<frame_slot_t*> latest;			//Most recently published slot. The ring holds one reference on it.
+	int next;						//Writer side index to start searching for a free slot.
+	frame_ring_wait_t wait;
+} frame_ring_t;
+
+
+void frame_ring_init(frame_ring_t* ring, cv::Size size, int type);
+frame_slot_t* frame_ring_acquire(frame_ring_t* ring);
+void frame_ring_cancel(frame_slot_t* slot);
+void frame_ring_publish(frame_ring_t* ring, frame_slot_t* slot, uint64_t seq);
+frame_slot_t* frame_ref(frame_slot_t* slot);
+void frame_release(frame_slot_t* slot);
+cv::Mat frame_derived(frame_slot_t* slot, int kind);
+void frame_ring_report(const frame_ring_t* ring, int stream);
+
+#endif
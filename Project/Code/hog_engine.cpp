@@ -0,0 +1,713 @@
+/**
+ * @file hog_engine.cpp
+ * @brief This file consists of the functions of the in-project HOG feature engine and its linear SVM scorer.
+ *
+ * The engine follows HOGDescriptor's algorithm for gray images: square root gamma, centred gradients with reflected
+ * borders, the orientation split between the two nearest of 9 unsigned bins, Gaussian and bilinear weighting into
+ * the 4 cells of a 16x16 block, and L2-Hys block normalization. The angle uses the same polynomial as OpenCV's
+ * fastAtan2(), so the features only differ by float rounding.
+ * Unlike HOGDescriptor::detect(), every block of the image is histogrammed and normalized once and shared by all
+ * the windows containing it. The image is swept one block row at a time, keeping the gradients of the 16 pixel rows
+ * of the current block row in a small ring buffer that stays in cache, and the normalized blocks are then scored
+ * window by window. The gradient, orientation binning, normalization and SVM kernels use OpenCV's universal
+ * intrinsics when available, with a scalar fallback.
+ * For the approximated feature pyramid, the orientation histograms of 4x4 pixel sub-cells can also be computed on an
+ * image, resampled to the sub-cell grid of a nearby scale, and assembled into blocks with the mean block weights of
+ * each sub-cell, skipping the gradients of the approximated scales.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "hog_engine.h"
+
+using namespace cv;
+using namespace std;
+
+//fastAtan2() polynomial, in degrees
+static const float atan_p1 = 0.9997878412794807f*57.29577951308232f;
+static const float atan_p3 = -0.3258083974640975f*57.29577951308232f;
+static const float atan_p5 = 0.1555786518463281f*57.29577951308232f;
+static const float atan_p7 = -0.04432655554792128f*57.29577951308232f;
+static const float atan_eps = (float)DBL_EPSILON;
+
+//Bins per degree of an unsigned gradient
+static const float angle_scale = HOG_NBINS/180.f;
+
+
+/**
+ * @brief This function returns the bilinear weight of a pixel of a block for one of its two cells along an axis.
+ */
+static float hog_cell_weight(int p, int cell)
+{
+	float d = fabsf(p + 0.5f - (cell*HOG_CELL + HOG_CELL*0.5f))/HOG_CELL;
+
+	return (d < 1.f) ? 1.f - d : 0.f;
+}
+
+
+/**
+ * @brief This function prepares the engine from a HOG descriptor.
+ * @param eng The engine.
+ * @param hog The descriptor, with the SVM detector set.
+ * @return false if the descriptor does not use the layout of the engine, in which case HOGDescriptor must be used.
+ */
+bool hog_engine_init(hog_engine_t* eng, const HOGDescriptor* hog)
+{
+	float sigma, scale;
+
+	if((hog->winSize != Size(HOG_WIN_W, HOG_WIN_H)) || (hog->blockSize != Size(HOG_BLOCK, HOG_BLOCK)) ||
+		(hog->blockStride != Size(HOG_BLOCK_STRIDE, HOG_BLOCK_STRIDE)) || (hog->cellSize != Size(HOG_CELL, HOG_CELL)) ||
+		(hog->nbins != HOG_NBINS) || hog->signedGradient || (hog->svmDetector.size() < HOG_DESCRIPTOR_SIZE))
+	{
+		return false;
+	}
+
+	memcpy(eng->svm, &hog->svmDetector[0], sizeof(eng->svm));
+	eng->rho = (hog->svmDetector.size() > HOG_DESCRIPTOR_SIZE) ? hog->svmDetector[HOG_DESCRIPTOR_SIZE] : 0;
+	eng->l2hys = (float)hog->L2HysThreshold;
+
+	for(int i=0; i<256; i++)
+	{
+		eng->gamma_lut[i] = hog->gammaCorrection ? sqrtf((float)i) : (float)i;
+	}
+
+	//Cells are numbered column by column, as in the descriptor
+	sigma = (float)hog->getWinSigma();
+	scale = 1.f/(sigma*sigma*2);
+	for(int i=0; i<HOG_BLOCK; i++)
+	{
+		for(int j=0; j<HOG_BLOCK; j++)
+		{
+			float di = (i - HOG_BLOCK*0.5f)*(i - HOG_BLOCK*0.5f);
+			float dj = (j - HOG_BLOCK*0.5f)*(j - HOG_BLOCK*0.5f);
+			float g = expf(-(di + dj)*scale);
+
+			for(int cx=0; cx<2; cx++)
+			{
+				for(int cy=0; cy<2; cy++)
+				{
+					eng->weight[i][j][cx*2 + cy] = g*(hog_cell_weight(j, cx)*hog_cell_weight(i, cy));
+				}
+			}
+		}
+	}
+
+	memset(eng->sub_weight, 0, sizeof(eng->sub_weight));
+	for(int i=0; i<HOG_BLOCK; i++)
+	{
+		for(int j=0; j<HOG_BLOCK; j++)
+		{
+			for(int k=0; k<4; k++)
+			{
+				eng->sub_weight[i/HOG_SUBCELL][j/HOG_SUBCELL][k] += eng->weight[i][j][k]/(HOG_SUBCELL*HOG_SUBCELL);
+			}
+		}
+	}
+	return true;
+}
+
+
+/**
+ * @brief This function tells whether the engine can search an image with the given parameters.
+ * @param img The image.
+ * @param win_stride The window stride.
+ * @param padding The padding.
+ * @return true for 8-bit gray images, no padding and a window stride that is a multiple of the block stride.
+ */
+bool hog_engine_supports(const Mat& img, Size win_stride, Size padding)
+{
+	return (img.type() == CV_8UC1) && (padding == Size(0, 0)) && (win_stride.width > 0) && (win_stride.height > 0) &&
+		((win_stride.width % HOG_BLOCK_STRIDE) == 0) && ((win_stride.height % HOG_BLOCK_STRIDE) == 0);
+}
+
+
+/**
+ * @brief This function computes the gradient of one row, split between its two orientation bins.
+ * @param eng The engine.
+ * @param prev The row above, reflected at the top border.
+ * @param cur The row.
+ * @param next The row below, reflected at the bottom border.
+ * @param width The width of the rows.
+ * @param fbuf Scratch buffer of 2*width + 2 floats.
+ * @param mag0 Returns the magnitude given to the lower bin.
+ * @param mag1 Returns the magnitude given to the upper bin.
+ * @param bin0 Returns the lower bin.
+ * @param bin1 Returns the upper bin.
+ * @return void
+ */
+static void hog_gradient_row(const hog_engine_t* eng, const uchar* prev, const uchar* cur, const uchar* next, int width,
+	float* fbuf, float* mag0, float* mag1, int* bin0, int* bin1)
+{
+	const float* lut = eng->gamma_lut;
+	float* fc = fbuf;					//Gamma corrected row with one reflected pixel on each side
+	float* dy = fbuf + width + 2;
+	int x = 0;
+
+	fc[0] = lut[cur[1]];
+	fc[width + 1] = lut[cur[width - 2]];
+	for(int i=0; i<width; i++)
+	{
+		fc[i + 1] = lut[cur[i]];
+		dy[i] = lut[next[i]] - lut[prev[i]];
+	}
+
+#if CV_SIMD128
+	v_float32x4 p1 = v_setall_f32(atan_p1), p3 = v_setall_f32(atan_p3);
+	v_float32x4 p5 = v_setall_f32(atan_p5), p7 = v_setall_f32(atan_p7);
+	v_float32x4 eps = v_setall_f32(atan_eps), zero = v_setzero_f32(), one = v_setall_f32(1.f), half = v_setall_f32(0.5f);
+	v_float32x4 d90 = v_setall_f32(90.f), d180 = v_setall_f32(180.f), d360 = v_setall_f32(360.f);
+	v_float32x4 scale = v_setall_f32(angle_scale);
+	v_int32x4 izero = v_setzero_s32(), ione = v_setall_s32(1), nbins = v_setall_s32(HOG_NBINS);
+
+	for(; x<=width-4; x+=4)
+	{
+		v_float32x4 vdx = v_load(fc + x + 2) - v_load(fc + x);
+		v_float32x4 vdy = v_load(dy + x);
+		v_float32x4 ax = v_abs(vdx), ay = v_abs(vdy);
+		v_float32x4 c = v_min(ax, ay)/(v_max(ax, ay) + eps);
+		v_float32x4 c2 = c*c;
+		v_float32x4 a = v_muladd(v_muladd(v_muladd(p7, c2, p5), c2, p3), c2, p1)*c;
+		v_float32x4 mag, angle;
+		v_int32x4 h;
+
+		a = v_select(ax >= ay, a, d90 - a);
+		a = v_select(vdx < zero, d180 - a, a);
+		a = v_select(vdy < zero, d360 - a, a);
+
+		mag = v_sqrt(vdx*vdx + vdy*vdy);
+		angle = a*scale - half;
+		h = v_floor(angle);
+		angle = angle - v_cvt_f32(h);
+
+		v_store(mag0 + x, mag*(one - angle));
+		v_store(mag1 + x, mag*angle);
+
+		//Wrapping the two bins into [0, HOG_NBINS)
+		h = h + ((h < izero) & nbins);
+		h = h - ((h >= nbins) & nbins);
+		v_store(bin0 + x, h);
+		h = h + ione;
+		h = h - ((h >= nbins) & nbins);
+		v_store(bin1 + x, h);
+	}
+#endif
+
+	for(; x<width; x++)
+	{
+		float gx = fc[x + 2] - fc[x], gy = dy[x];
+		float ax = fabsf(gx), ay = fabsf(gy);
+		float c = min(ax, ay)/(max(ax, ay) + atan_eps), c2 = c*c;
+		float a = (((atan_p7*c2 + atan_p5)*c2 + atan_p3)*c2 + atan_p1)*c;
+		float mag, angle;
+		int h;
+
+		if(ax < ay)
+			a = 90.f - a;
+		if(gx < 0)
+			a = 180.f - a;
+		if(gy < 0)
+			a = 360.f - a;
+
+		mag = sqrtf(gx*gx + gy*gy);
+		angle = a*angle_scale - 0.5f;
+		h = cvFloor(angle);
+		angle -= h;
+
+		mag0[x] = mag*(1.f - angle);
+		mag1[x] = mag*angle;
+
+		if(h < 0)
+			h += HOG_NBINS;
+		else if(h >= HOG_NBINS)
+			h -= HOG_NBINS;
+		bin0[x] = h;
+		h++;
+		bin1[x] = (h < HOG_NBINS) ? h : 0;
+	}
+}
+
+
+/**
+ * @brief This function applies the L2-Hys normalization to a block histogram.
+ */
+static void hog_normalize(float* hist, float l2hys)
+{
+	float sum = 0, scale;
+	int i = 0;
+
+#if CV_SIMD128
+	v_float32x4 vsum = v_setzero_f32(), vscale, vthresh = v_setall_f32(l2hys);
+
+	for(i=0; i<=HOG_BLOCK_HIST-4; i+=4)
+	{
+		v_float32x4 h = v_load(hist + i);
+		vsum = v_muladd(h, h, vsum);
+	}
+	sum = v_reduce_sum(vsum);
+#endif
+	for(; i<HOG_BLOCK_HIST; i++)
+	{
+		sum += hist[i]*hist[i];
+	}
+
+	scale = 1.f/(sqrtf(sum) + HOG_BLOCK_HIST*0.1f);
+	sum = 0;
+	i = 0;
+#if CV_SIMD128
+	vsum = v_setzero_f32();
+	vscale = v_setall_f32(scale);
+	for(i=0; i<=HOG_BLOCK_HIST-4; i+=4)
+	{
+		v_float32x4 h = v_min(v_load(hist + i)*vscale, vthresh);
+		v_store(hist + i, h);
+		vsum = v_muladd(h, h, vsum);
+	}
+	sum = v_reduce_sum(vsum);
+#endif
+	for(; i<HOG_BLOCK_HIST; i++)
+	{
+		hist[i] = min(hist[i]*scale, l2hys);
+		sum += hist[i]*hist[i];
+	}
+
+	scale = 1.f/(sqrtf(sum) + 1e-3f);
+	i = 0;
+#if CV_SIMD128
+	vscale = v_setall_f32(scale);
+	for(i=0; i<=HOG_BLOCK_HIST-4; i+=4)
+	{
+		v_store(hist + i, v_load(hist + i)*vscale);
+	}
+#endif
+	for(; i<HOG_BLOCK_HIST; i++)
+	{
+		hist[i] *= scale;
+	}
+}
+
+
+/**
+ * @brief This function returns the dot product of a block histogram with its SVM weights.
+ */
+static float hog_dot(const float* a, const float* b)
+{
+	float s = 0;
+	int i = 0;
+
+#if CV_SIMD128
+	v_float32x4 vs = v_setzero_f32();
+
+	for(i=0; i<=HOG_BLOCK_HIST-4; i+=4)
+	{
+		vs = v_muladd(v_load(a + i), v_load(b + i), vs);
+	}
+	s = v_reduce_sum(vs);
+#endif
+	for(; i<HOG_BLOCK_HIST; i++)
+	{
+		s += a[i]*b[i];
+	}
+	return s;
+}
+
+
+/**
+ * @brief This function computes the normalized histograms of every block of consecutive block rows.
+ * @param eng The engine.
+ * @param img The 8-bit gray image. Rows outside the block rows are used for the gradients where they exist.
+ * @param y0 The first pixel row of the first block row.
+ * @param nby The number of block rows.
+ * @param blocks Returns the histograms, block row by block row.
+ * @return The number of blocks per block row.
+ */
+static int hog_blocks(const hog_engine_t* eng, const Mat& img, int y0, int nby, vector<float>& blocks)
+{
+	int width = img.cols, height = img.rows;
+	int nbx = (width - HOG_BLOCK)/HOG_BLOCK_STRIDE + 1;
+	vector<float> fbuf(2*width + 2);
+	vector<float> mag(HOG_BLOCK*2*width);			//Ring of the gradient rows of one block row
+	vector<int> bin(HOG_BLOCK*2*width);
+
+	blocks.resize(nby*nbx*HOG_BLOCK_HIST);
+
+	for(int r=0; r<nby; r++)
+	{
+		int ybase = y0 + r*HOG_BLOCK_STRIDE;
+
+		//The first rows of a block row are the last ones of the previous block row
+		for(int i=((r == 0) ? 0 : HOG_BLOCK - HOG_BLOCK_STRIDE); i<HOG_BLOCK; i++)
+		{
+			int y = ybase + i;
+			int ring = (y % HOG_BLOCK)*2*width;
+
+			hog_gradient_row(eng, img.ptr<uchar>((y > 0) ? y - 1 : 1), img.ptr<uchar>(y), img.ptr<uchar>((y < height - 1) ? y + 1 : height - 2),
+				width, &fbuf[0], &mag[ring], &mag[ring + width], &bin[ring], &bin[ring + width]);
+		}
+
+		for(int bx=0; bx<nbx; bx++)
+		{
+			float* hist = &blocks[(r*nbx + bx)*HOG_BLOCK_HIST];
+
+			memset(hist, 0, HOG_BLOCK_HIST*sizeof(float));
+			for(int i=0; i<HOG_BLOCK; i++)
+			{
+				int ring = ((ybase + i) % HOG_BLOCK)*2*width + bx*HOG_BLOCK_STRIDE;
+				const float* m0 = &mag[ring];
+				const float* m1 = &mag[ring + width];
+				const int* b0 = &bin[ring];
+				const int* b1 = &bin[ring + width];
+
+				for(int j=0; j<HOG_BLOCK; j++)
+				{
+					const float* w = eng->weight[i][j];
+
+					for(int k=0; k<4; k++)
+					{
+						hist[k*HOG_NBINS + b0[j]] += w[k]*m0[j];
+						hist[k*HOG_NBINS + b1[j]] += w[k]*m1[j];
+					}
+				}
+			}
+			hog_normalize(hist, eng->l2hys);
+		}
+	}
+	return nbx;
+}
+
+
+/**
+ * @brief This function scores every window whose rows lie in [y0, y1) from a map of normalized blocks.
+ * @param eng The engine.
+ * @param blocks The block histograms, block row by block row.
+ * @param nbx The number of blocks per block row.
+ * @param block_y0 The first pixel row of the first block row.
+ * @param width The width of the image.
+ * @param y0 The first row searched, block_y0 plus a multiple of the window stride.
+ * @param y1 The row after the last row searched.
+ * @param hits The top left corner of the windows scoring at least hit_threshold are appended, in image coordinates.
+ * @param weights The scores of the hits are appended.
+ * @param hit_threshold The SVM score threshold.
+ * @param win_stride The window stride, a multiple of the block stride.
+ * @return void
+ */
+void hog_engine_score(const hog_engine_t* eng, const float* blocks, int nbx, int block_y0, int width, int y0, int y1,
+	vector<Point>& hits, vector<double>& weights, double hit_threshold, Size win_stride)
+{
+	int sx = win_stride.width/HOG_BLOCK_STRIDE;
+	int nwx = (width - HOG_WIN_W)/win_stride.width + 1;
+
+	if(width < HOG_WIN_W)
+		return;
+
+	for(int y=y0; y+HOG_WIN_H<=y1; y+=win_stride.height)
+	{
+		const float* row = blocks + ((y - block_y0)/HOG_BLOCK_STRIDE)*nbx*HOG_BLOCK_HIST;
+
+		for(int wx=0; wx<nwx; wx++)
+		{
+			const float* svm = eng->svm;
+			double s = eng->rho;
+
+			for(int bx=0; bx<HOG_WIN_BLOCKS_X; bx++)
+			{
+				for(int by=0; by<HOG_WIN_BLOCKS_Y; by++, svm+=HOG_BLOCK_HIST)
+				{
+					s += hog_dot(row + (by*nbx + wx*sx + bx)*HOG_BLOCK_HIST, svm);
+				}
+			}
+			if(s >= hit_threshold)
+			{
+				hits.push_back(Point(wx*win_stride.width, y));
+				weights.push_back(s);
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief This function scores every window whose rows lie in [y0, y1), as HOGDescriptor::detect() with no padding.
+ * @param eng The engine.
+ * @param img The 8-bit gray image.
+ * @param y0 The first row searched, a multiple of the window stride.
+ * @param y1 The row after the last row searched.
+ * @param hits Returns the top left corner of the windows scoring at least hit_threshold, in image coordinates.
+ * @param weights Returns the scores of the hits.
+ * @param hit_threshold The SVM score threshold.
+ * @param win_stride The window stride, a multiple of the block stride.
+ * @return void
+ */
+void hog_engine_detect(const hog_engine_t* eng, const Mat& img, int y0, int y1, vector<Point>& hits,
+	vector<double>& weights, double hit_threshold, Size win_stride)
+{
+	vector<float> blocks;
+	int nbx;
+
+	hits.clear();
+	weights.clear();
+	if((y1 - y0 < HOG_WIN_H) || (img.cols < HOG_WIN_W))
+		return;
+
+	nbx = hog_blocks(eng, img, y0, (y1 - y0 - HOG_BLOCK)/HOG_BLOCK_STRIDE + 1, blocks);
+	hog_engine_score(eng, &blocks[0], nbx, y0, img.cols, y0, y1, hits, weights, hit_threshold, win_stride);
+}
+
+
+/**
+ * @brief This function computes the orientation histograms of the sub-cells of an image.
+ * @param eng The engine.
+ * @param img The 8-bit gray image.
+ * @param sub Returns img.rows/HOG_SUBCELL rows of img.cols/HOG_SUBCELL histograms of HOG_NBINS floats. Pixels of
+ * an incomplete last sub-cell are left out.
+ * @return void
+ */
+void hog_engine_subcells(const hog_engine_t* eng, const Mat& img, Mat& sub)
+{
+	int width = img.cols, height = img.rows;
+	int nsx = width/HOG_SUBCELL, nsy = height/HOG_SUBCELL;
+	vector<float> fbuf(2*width + 2), mag(2*width);
+	vector<int> bin(2*width);
+
+	sub.create(nsy, nsx*HOG_NBINS, CV_32FC1);
+	sub = Scalar::all(0);
+
+	for(int y=0; y<nsy*HOG_SUBCELL; y++)
+	{
+		float* hist = sub.ptr<float>(y/HOG_SUBCELL);
+
+		hog_gradient_row(eng, img.ptr<uchar>((y > 0) ? y - 1 : 1), img.ptr<uchar>(y), img.ptr<uchar>((y < height - 1) ? y + 1 : height - 2),
+			width, &fbuf[0], &mag[0], &mag[width], &bin[0], &bin[width]);
+		for(int x=0; x<nsx*HOG_SUBCELL; x++)
+		{
+			float* h = hist + (x/HOG_SUBCELL)*HOG_NBINS;
+
+			h[bin[x]] += mag[x];
+			h[bin[width + x]] += mag[width + x];
+		}
+	}
+}
+
+
+/**
+ * @brief This function bilinearly resamples a sub-cell histogram map to another grid, as resize() with INTER_LINEAR.
+ * @param src The sub-cell map.
+ * @param cells The size of the new grid, in sub-cells.
+ * @param gain Factor applied to the resampled histograms.
+ * @param dst Returns the resampled map.
+ * @return void
+ */
+void hog_engine_resample(const Mat& src, Size cells, float gain, Mat& dst)
+{
+	int snx = src.cols/HOG_NBINS, sny = src.rows;
+	float fx = (float)snx/cells.width, fy = (float)sny/cells.height;
+	vector<int> x0(cells.width);
+	vector<float> ax(cells.width);
+
+	dst.create(cells.height, cells.width*HOG_NBINS, CV_32FC1);
+
+	for(int x=0; x<cells.width; x++)
+	{
+		float sx = min(max((x + 0.5f)*fx - 0.5f, 0.f), (float)(snx - 1));
+
+		x0[x] = min((int)sx, snx - 2 >= 0 ? snx - 2 : 0);
+		ax[x] = (snx > 1) ? sx - x0[x] : 0.f;
+	}
+
+	for(int y=0; y<cells.height; y++)
+	{
+		float sy = min(max((y + 0.5f)*fy - 0.5f, 0.f), (float)(sny - 1));
+		int y0 = min((int)sy, sny - 2 >= 0 ? sny - 2 : 0);
+		float ay = (sny > 1) ? sy - y0 : 0.f;
+		const float* r0 = src.ptr<float>(y0);
+		const float* r1 = src.ptr<float>((sny > 1) ? y0 + 1 : y0);
+		float* d = dst.ptr<float>(y);
+
+		for(int x=0; x<cells.width; x++)
+		{
+			const float* p00 = r0 + x0[x]*HOG_NBINS;
+			const float* p10 = r1 + x0[x]*HOG_NBINS;
+			int step = (snx > 1) ? HOG_NBINS : 0;
+			float w00 = gain*(1.f - ax[x])*(1.f - ay), w01 = gain*ax[x]*(1.f - ay);
+			float w10 = gain*(1.f - ax[x])*ay, w11 = gain*ax[x]*ay;
+
+			for(int b=0; b<HOG_NBINS; b++)
+			{
+				d[x*HOG_NBINS + b] = w00*p00[b] + w01*p00[step + b] + w10*p10[b] + w11*p10[step + b];
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief This function assembles and normalizes every block of a sub-cell histogram map.
+ * @param eng The engine.
+ * @param sub The sub-cell map.
+ * @param blocks Returns the block histograms, block row by block row, the first block row at pixel row 0.
+ * @return The number of blocks per block row.
+ */
+int hog_engine_subcell_blocks(const hog_engine_t* eng, const Mat& sub, vector<float>& blocks)
+{
+	const int step = HOG_BLOCK_STRIDE/HOG_SUBCELL;
+	int nsx = sub.cols/HOG_NBINS, nsy = sub.rows;
+	int nbx = (nsx - HOG_BLOCK_SUBCELLS)/step + 1, nby = (nsy - HOG_BLOCK_SUBCELLS)/step + 1;
+
+	if((nsx < HOG_BLOCK_SUBCELLS) || (nsy < HOG_BLOCK_SUBCELLS))
+	{
+		blocks.clear();
+		return 0;
+	}
+	blocks.resize(nby*nbx*HOG_BLOCK_HIST);
+
+	for(int by=0; by<nby; by++)
+	{
+		for(int bx=0; bx<nbx; bx++)
+		{
+			float* hist = &blocks[(by*nbx + bx)*HOG_BLOCK_HIST];
+
+			memset(hist, 0, HOG_BLOCK_HIST*sizeof(float));
+			for(int i=0; i<HOG_BLOCK_SUBCELLS; i++)
+			{
+				const float* h = sub.ptr<float>(by*step + i) + bx*step*HOG_NBINS;
+
+				for(int j=0; j<HOG_BLOCK_SUBCELLS; j++, h+=HOG_NBINS)
+				{
+					const float* w = eng->sub_weight[i][j];
+
+					for(int k=0; k<4; k++)
+					{
+						float* c = hist + k*HOG_NBINS;
+						int b = 0;
+
+						if(w[k] == 0)
+							continue;
+#if CV_SIMD128
+						v_float32x4 vw = v_setall_f32(w[k]);
+						for(; b<=HOG_NBINS-4; b+=4)
+						{
+							v_store(c + b, v_muladd(v_load(h + b), vw, v_load(c + b)));
+						}
+#endif
+						for(; b<HOG_NBINS; b++)
+						{
+							c[b] += w[k]*h[b];
+						}
+					}
+				}
+			}
+			hog_normalize(hist, eng->l2hys);
+		}
+	}
+	return nbx;
+}
+
+
+/**
+ * @brief This function computes the descriptor of one window, in HOGDescriptor::compute() order.
+ * @param eng The engine.
+ * @param img The 8-bit gray image.
+ * @param win The top left corner of the window, a multiple of the block stride.
+ * @param descriptor Returns HOG_DESCRIPTOR_SIZE values.
+ * @return void
+ */
+void hog_engine_compute(const hog_engine_t* eng, const Mat& img, Point win, float* descriptor)
+{
+	vector<float> blocks;
+	int nbx = hog_blocks(eng, img, win.y, HOG_WIN_BLOCKS_Y, blocks);
+
+	for(int bx=0; bx<HOG_WIN_BLOCKS_X; bx++)
+	{
+		for(int by=0; by<HOG_WIN_BLOCKS_Y; by++)
+		{
+			memcpy(descriptor + (bx*HOG_WIN_BLOCKS_Y + by)*HOG_BLOCK_HIST, &blocks[(by*nbx + win.x/HOG_BLOCK_STRIDE + bx)*HOG_BLOCK_HIST],
+				HOG_BLOCK_HIST*sizeof(float));
+		}
+	}
+}
+
+
+/**
+ * @brief This function checks the engine against HOGDescriptor on a set of frames and prints the differences.
+ * Descriptors are compared on a 16 pixel grid of windows, and the hits of a full search with an 8 pixel stride are
+ * compared. A hit found by only one side is tolerated when its score is within HOG_CHECK_TOL of the threshold.
+ * @param eng The engine.
+ * @param hog The descriptor the engine was initialized from.
+ * @param frames 8-bit gray frames.
+ * @return void
+ */
+void hog_engine_check(const hog_engine_t* eng, const HOGDescriptor* hog, const vector<Mat>& frames)
+{
+	vector<float> ref;
+	vector<float> desc(HOG_DESCRIPTOR_SIZE);
+	vector<Point> locations, ref_hits, hits;
+	vector<double> ref_weights, weights;
+	double desc_max = 0, desc_sum = 0, score_max = 0;
+	unsigned long desc_n = 0, common = 0, ref_only = 0, eng_only = 0, outside = 0;
+
+	for(size_t f=0; f<frames.size(); f++)
+	{
+		const Mat& img = frames[f];
+
+		locations.clear();
+		for(int y=0; y+HOG_WIN_H<=img.rows; y+=2*HOG_BLOCK_STRIDE)
+		{
+			for(int x=0; x+HOG_WIN_W<=img.cols; x+=2*HOG_BLOCK_STRIDE)
+			{
+				locations.push_back(Point(x, y));
+			}
+		}
+		hog->compute(img, ref, Size(), Size(), locations);
+		for(size_t k=0; k<locations.size(); k++)
+		{
+			hog_engine_compute(eng, img, locations[k], &desc[0]);
+			for(int i=0; i<HOG_DESCRIPTOR_SIZE; i++)
+			{
+				double d = fabs((double)desc[i] - ref[k*HOG_DESCRIPTOR_SIZE + i]);
+				desc_max = max(desc_max, d);
+				desc_sum += d;
+			}
+			desc_n += HOG_DESCRIPTOR_SIZE;
+		}
+
+		hog->detect(img, ref_hits, ref_weights, 0, Size(HOG_BLOCK_STRIDE, HOG_BLOCK_STRIDE), Size(0, 0));
+		hog_engine_detect(eng, img, 0, img.rows, hits, weights, 0, Size(HOG_BLOCK_STRIDE, HOG_BLOCK_STRIDE));
+		for(size_t i=0; i<ref_hits.size(); i++)
+		{
+			size_t j = find(hits.begin(), hits.end(), ref_hits[i]) - hits.begin();
+			if(j < hits.size())
+			{
+				common++;
+				score_max = max(score_max, fabs(weights[j] - ref_weights[i]));
+			}
+			else
+			{
+				ref_only++;
+				if(ref_weights[i] > HOG_CHECK_TOL)
+					outside++;
+			}
+		}
+		for(size_t j=0; j<hits.size(); j++)
+		{
+			if(find(ref_hits.begin(), ref_hits.end(), hits[j]) == ref_hits.end())
+			{
+				eng_only++;
+				if(weights[j] > HOG_CHECK_TOL)
+					outside++;
+			}
+		}
+	}
+
+	printf("\nHOG CHECK:\n");
+	printf("HOG CHECK Frames: %lu\n", (unsigned long)frames.size());
+	printf("HOG CHECK Descriptor abs diff max/mean: %g/%g over %lu values\n", desc_max, desc_n ? desc_sum/desc_n : 0.0, desc_n);
+	printf("HOG CHECK Hits: %lu common (score diff max %g), %lu OpenCV only, %lu engine only\n", common, score_max, ref_only, eng_only);
+	printf("HOG CHECK %s (tolerance %g)\n", ((desc_max <= HOG_CHECK_TOL) && (score_max <= HOG_CHECK_TOL) && (outside == 0)) ? "PASS" : "FAIL", HOG_CHECK_TOL);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file hog_engine.h
+ * @brief In-project HOG feature engine and linear SVM scorer for the default 64x128 people detector layout.
+ *
+ */
+
+#ifndef HOG_ENGINE_H
+#define HOG_ENGINE_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include "opencv2/objdetect/objdetect.hpp"
+
+//Layout supported by the engine, that of HOGDescriptor's defaults
+#define HOG_NBINS						(9)
+#define HOG_CELL						(8)
+#define HOG_BLOCK						(16)
+#define HOG_BLOCK_STRIDE					(8)
+#define HOG_BLOCK_HIST						(36)
+#define HOG_WIN_W						(64)
+#define HOG_WIN_H						(128)
+#define HOG_WIN_BLOCKS_X					(7)
+#define HOG_WIN_BLOCKS_Y					(15)
+#define HOG_DESCRIPTOR_SIZE					(HOG_WIN_BLOCKS_X*HOG_WIN_BLOCKS_Y*HOG_BLOCK_HIST)
+
+//Side of the sub-cells whose histograms can be resampled across scales, 4x4 of them per block
+#define HOG_SUBCELL						(4)
+#define HOG_BLOCK_SUBCELLS					(HOG_BLOCK/HOG_SUBCELL)
+
+//Largest descriptor or score difference to HOGDescriptor accepted by hog_engine_check()
+#define HOG_CHECK_TOL						(1e-3)
+
+
+typedef struct
+{
+	float svm[HOG_DESCRIPTOR_SIZE];				//SVM weights in descriptor order: blocks column by column, cells column by column
+	float rho;						//SVM bias
+	float gamma_lut[256];					//Square root gamma correction
+	float weight[HOG_BLOCK][HOG_BLOCK][4];			//Gaussian times bilinear cell weight of every pixel of a block, per cell
+	float sub_weight[HOG_BLOCK_SUBCELLS][HOG_BLOCK_SUBCELLS][4];	//Mean of weight over every sub-cell of a block
+	float l2hys;						//Clipping threshold of the L2-Hys block normalization
+} hog_engine_t;
+
+
+bool hog_engine_init(hog_engine_t* eng, const cv::HOGDescriptor* hog);
+bool hog_engine_supports(const cv::Mat& img, cv::Size win_stride, cv::Size padding);
+void hog_engine_detect(const hog_engine_t* eng, const cv::Mat& img, int y0, int y1, std::vector<cv::Point>& hits,
+	std::vector<double>& weights, double hit_threshold, cv::Size win_stride);
+void hog_engine_score(const hog_engine_t* eng, const float* blocks, int nbx, int block_y0, int width, int y0, int y1,
+	std::vector<cv::Point>& hits, std::vector<double>& weights, double hit_threshold, cv::Size win_stride);
+void hog_engine_subcells(const hog_engine_t* eng, const cv::Mat& img, cv::Mat& sub);
+void hog_engine_resample(const cv::Mat& src, cv::Size cells, float gain, cv::Mat& dst);
+int hog_engine_subcell_blocks(const hog_engine_t* eng, const cv::Mat& sub, std::vector<float>& blocks);
+void hog_engine_compute(const hog_engine_t* eng, const cv::Mat& img, cv::Point win, float* descriptor);
+void hog_engine_check(const hog_engine_t* eng, const cv::HOGDescriptor* hog, const std::vector<cv::Mat>& frames);
+
+#endif
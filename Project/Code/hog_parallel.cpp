@@ -0,0 +1,305 @@
+/**
+ * @file hog_parallel.cpp
+ * @brief This file consists of the functions running a multi-scale HOG search as parallel jobs.
+ *
+ * HOGDescriptor::detectMultiScale() searches every level of the image pyramid (dozens at a scale step of 1.05) in
+ * one call. Here every level becomes a job on the worker pool, and the large levels are further cut into horizontal
+ * tiles so that no single job dominates the frame. A tile covers whole rows of detection windows and overlaps the
+ * next one by a window height; it is a view into the scaled image, so the gradients at its edges are computed from
+ * the real neighbouring pixels and every window is scored exactly as in the whole image. The hits of all jobs are
+ * merged in level and tile order and grouped in a single pass, as detectMultiScale() does.
+ * When the in-project engine is given and supports the search, the tiles are scored with it instead of
+ * HOGDescriptor::detect(), the rest of the search being unchanged.
+ * The approximated feature pyramid only computes gradients on one real level per octave. The sub-cell histograms of
+ * a real level are resampled to the following levels of its octave and corrected by the power law relating gradient
+ * energy across scales, the approximated levels being submitted as soon as their real level has its histograms.
+ *
+ */
+
+
+#include <math.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "hog_parallel.h"
+
+using namespace cv;
+using namespace std;
+
+
+struct hog_tile;
+
+typedef struct hog_level
+{
+	const HOGDescriptor* hog;
+	const hog_engine_t* eng;				//NULL when HOGDescriptor scores the windows
+	const Mat* img;
+	wp_pool_t* pool;
+	int prio_level;
+	double scale;
+	Size size;						//Size of the image at this level
+	Mat scaled;
+	double hit_threshold;
+	Size win_stride;
+	int n_tiles;
+	struct hog_tile* tiles;
+
+	//Approximated feature pyramid
+	struct hog_level* src;					//Real level the features are resampled from, NULL for a real level
+	float gain;						//Power law correction of the resampled features
+	int n_deps;						//Approximated levels following a real level
+	wp_group_t* group;					//Group of the whole search, the approximated levels are submitted to
+	Mat sub;						//Sub-cell histograms
+	vector<float> blocks;					//Normalized blocks of an approximated level
+	int nbx;
+} hog_level_t;
+
+
+typedef struct hog_tile
+{
+	hog_level_t* lvl;
+	int y0, y1;						//Rows of the scaled image covered by the tile
+	vector<Point> hits;					//In scaled image coordinates
+	vector<double> weights;
+} hog_tile_t;
+
+
+/**
+ * @brief Job searching one tile of a level.
+ * @param arg The hog_tile_t.
+ * @return void
+ */
+static void hog_tile_run(void* arg)
+{
+	hog_tile_t* tile = (hog_tile_t*)arg;
+	hog_level_t* lvl = tile->lvl;
+	Mat roi;
+
+	if(lvl->src)
+	{
+		tile->hits.clear();
+		tile->weights.clear();
+		if(lvl->nbx > 0)
+			hog_engine_score(lvl->eng, &lvl->blocks[0], lvl->nbx, 0, lvl->size.width, tile->y0, tile->y1, tile->hits, tile->weights, lvl->hit_threshold, lvl->win_stride);
+		return;
+	}
+
+	if(lvl->eng && hog_engine_supports(lvl->scaled, lvl->win_stride, Size(0, 0)))
+	{
+		hog_engine_detect(lvl->eng, lvl->scaled, tile->y0, tile->y1, tile->hits, tile->weights, lvl->hit_threshold, lvl->win_stride);
+		return;
+	}
+
+	roi = lvl->scaled(Rect(0, tile->y0, lvl->scaled.cols, tile->y1 - tile->y0));
+	lvl->hog->detect(roi, tile->hits, tile->weights, lvl->hit_threshold, lvl->win_stride, Size(0, 0));
+	for(size_t j=0; j<tile->hits.size(); j++)
+	{
+		tile->hits[j].y += tile->y0;
+	}
+}
+
+
+/**
+ * @brief Job scaling the image to one level, or resampling the features of an approximated level, and searching its
+ * tiles. The tiles but the first are sub-tasks.
+ * @param arg The hog_level_t.
+ * @return void
+ */
+static void hog_level_run(void* arg)
+{
+	hog_level_t* lvl = (hog_level_t*)arg;
+	wp_group_t group;
+
+	if(lvl->src)
+	{
+		hog_engine_resample(lvl->src->sub, Size(lvl->size.width/HOG_SUBCELL, lvl->size.height/HOG_SUBCELL), lvl->gain, lvl->sub);
+		lvl->nbx = hog_engine_subcell_blocks(lvl->eng, lvl->sub, lvl->blocks);
+	}
+	else
+	{
+		if(lvl->size == lvl->img->size())
+			lvl->scaled = *lvl->img;
+		else
+			resize(*lvl->img, lvl->scaled, lvl->size, 0, 0, INTER_LINEAR);
+
+		//The approximated levels of the octave follow the real level in the plan
+		if(lvl->n_deps > 0)
+		{
+			hog_engine_subcells(lvl->eng, lvl->scaled, lvl->sub);
+			//A sub-task the pool refuses runs here, as the calling job has to wait for it anyway
+			for(int i=1; i<=lvl->n_deps; i++)
+			{
+				if(!wp_submit(lvl->pool, lvl->prio_level, hog_level_run, (void*)(lvl + i), lvl->group))
+					hog_level_run((void*)(lvl + i));
+			}
+		}
+	}
+
+	wp_group_init(&group);
+	for(int t=1; t<lvl->n_tiles; t++)
+	{
+		if(!wp_submit(lvl->pool, lvl->prio_level, hog_tile_run, (void*)&lvl->tiles[t], &group))
+			hog_tile_run((void*)&lvl->tiles[t]);
+	}
+	hog_tile_run((void*)&lvl->tiles[0]);
+	wp_wait(lvl->pool, &group);
+}
+
+
+/**
+ * @brief This function runs the equivalent of HOGDescriptor::detectMultiScale() with zero padding on the worker pool.
+ * Must be called from a job of the pool or from a thread outside of it. Returns once every level was searched.
+ * @param pool The worker pool.
+ * @param prio_level The pool level the jobs are queued at, the level of the calling service.
+ * @param hog The HOG detector, with its SVM set.
+ * @param eng The engine initialized from hog, or NULL to score the windows with HOGDescriptor.
+ * @param approx Approximates the levels between octaves from the features of the real levels. Requires the engine.
+ * @param img The image to search.
+ * @param found Returns the grouped detections.
+ * @param hit_threshold The SVM score threshold, as for detectMultiScale().
+ * @param win_stride The window stride, a multiple of the block stride.
+ * @param scale0 The scale step between pyramid levels.
+ * @param group_threshold The minimum number of overlapping hits kept by the grouping.
+ * @return void
+ */
+void hog_detect_parallel(wp_pool_t* pool, int prio_level, const HOGDescriptor* hog, const hog_engine_t* eng, bool approx,
+	const Mat& img, vector<Rect>& found, double hit_threshold, Size win_stride, double scale0, int group_threshold)
+{
+	vector<hog_level_t> levels;
+	vector<hog_tile_t> tiles;
+	vector<double> weights;
+	double scales[HOG_MAX_LEVELS];
+	int win_rows[HOG_MAX_LEVELS];
+	int windows[HOG_MAX_LEVELS];
+	int n_tiles[HOG_MAX_LEVELS];
+	int max_levels = (hog->nlevels < HOG_MAX_LEVELS) ? hog->nlevels : HOG_MAX_LEVELS;
+	int n_levels, total = 0, target, t, per_octave;
+	double scale = 1.;
+	wp_group_t group;
+
+	found.clear();
+	if(win_stride == Size())
+		win_stride = hog->blockStride;
+	if(!eng || !hog_engine_supports(img, win_stride, Size(0, 0)))
+		approx = false;
+	per_octave = (scale0 > 1) ? cvRound(log(2.)/log(scale0)) : 1;
+	if(per_octave < 1)
+		per_octave = 1;
+
+	//Same levels as detectMultiScale(): stops before the first level smaller than the window
+	for(n_levels=0; n_levels<max_levels; n_levels++)
+	{
+		scales[n_levels] = scale;
+		if((cvRound(img.cols/scale) < hog->winSize.width) || (cvRound(img.rows/scale) < hog->winSize.height) || (scale0 <= 1))
+			break;
+		scale *= scale0;
+	}
+	if(n_levels < 1)
+		n_levels = 1;
+
+	//Windows searched per level
+	for(int i=0; i<n_levels; i++)
+	{
+		Size sz(cvRound(img.cols/scales[i]), cvRound(img.rows/scales[i]));
+
+		win_rows[i] = windows[i] = 0;
+		if((sz.width >= hog->winSize.width) && (sz.height >= hog->winSize.height))
+		{
+			win_rows[i] = (sz.height - hog->winSize.height)/win_stride.height + 1;
+			windows[i] = win_rows[i]*((sz.width - hog->winSize.width)/win_stride.width + 1);
+		}
+		total += windows[i];
+	}
+
+	//Levels larger than a job's share of the windows are cut in tiles
+	target = total/(HOG_JOBS_PER_WORKER*pool->n_workers);
+	if(target < 1)
+		target = 1;
+	t = 0;
+	for(int i=0; i<n_levels; i++)
+	{
+		int max_tiles = win_rows[i]/HOG_TILE_MIN_WIN_ROWS;
+
+		n_tiles[i] = (windows[i] + target - 1)/target;
+		if(n_tiles[i] > max_tiles)
+			n_tiles[i] = max_tiles;
+		if(n_tiles[i] < 1)
+			n_tiles[i] = 1;
+		if(windows[i] > 0)
+			t += n_tiles[i];
+	}
+
+	//Planning every level and tile before any job runs, the jobs keep pointers into both
+	levels.resize(n_levels);
+	tiles.resize(t);
+	wp_group_init(&group);
+	t = 0;
+	for(int i=0; i<n_levels; i++)
+	{
+		hog_level_t* lvl = &levels[i];
+		int rows_per_tile;
+
+		if(windows[i] == 0)
+		{
+			lvl->n_tiles = 0;
+			continue;
+		}
+
+		lvl->hog = hog;
+		lvl->eng = eng;
+		lvl->img = &img;
+		lvl->pool = pool;
+		lvl->prio_level = prio_level;
+		lvl->scale = scales[i];
+		lvl->size = Size(cvRound(img.cols/scales[i]), cvRound(img.rows/scales[i]));
+		lvl->hit_threshold = hit_threshold;
+		lvl->win_stride = win_stride;
+		lvl->tiles = &tiles[t];
+		lvl->src = NULL;
+		lvl->gain = 1;
+		lvl->n_deps = 0;
+		lvl->group = &group;
+		lvl->nbx = 0;
+		if(approx && (i % per_octave))
+		{
+			lvl->src = &levels[i - i % per_octave];
+			lvl->gain = pow(scales[i - i % per_octave]/scales[i], -HOG_APPROX_LAMBDA);
+			lvl->src->n_deps++;
+		}
+
+		rows_per_tile = (win_rows[i] + n_tiles[i] - 1)/n_tiles[i];
+		lvl->n_tiles = (win_rows[i] + rows_per_tile - 1)/rows_per_tile;
+		for(int k=0; k<lvl->n_tiles; k++)
+		{
+			int last = ((k + 1)*rows_per_tile < win_rows[i]) ? (k + 1)*rows_per_tile : win_rows[i];
+
+			tiles[t + k].lvl = lvl;
+			tiles[t + k].y0 = k*rows_per_tile*win_stride.height;
+			tiles[t + k].y1 = (last - 1)*win_stride.height + hog->winSize.height;
+		}
+		t += lvl->n_tiles;
+	}
+
+	//Largest levels first, so that they are the first ones stolen. Approximated levels are submitted by their real level.
+	for(int i=0; i<n_levels; i++)
+	{
+		if((levels[i].n_tiles > 0) && !levels[i].src && !wp_submit(pool, prio_level, hog_level_run, (void*)&levels[i], &group))
+			hog_level_run((void*)&levels[i]);
+	}
+	wp_wait(pool, &group);
+
+	//Merging in level and tile order, then a single grouping pass
+	for(size_t k=0; k<tiles.size(); k++)
+	{
+		hog_level_t* lvl = tiles[k].lvl;
+		Size scaled_win(cvRound(hog->winSize.width*lvl->scale), cvRound(hog->winSize.height*lvl->scale));
+
+		for(size_t j=0; j<tiles[k].hits.size(); j++)
+		{
+			found.push_back(Rect(cvRound(tiles[k].hits[j].x*lvl->scale), cvRound(tiles[k].hits[j].y*lvl->scale),
+				scaled_win.width, scaled_win.height));
+			weights.push_back(tiles[k].weights[j]);
+		}
+	}
+	hog->groupRectangles(found, weights, group_threshold, 0.2);
+}
@@ -0,0 +1,33 @@
+/**
+ * @file hog_parallel.h
+ * @brief Multi-scale HOG detection split into per scale level and per tile jobs on the worker pool.
+ *
+ */
+
+#ifndef HOG_PARALLEL_H
+#define HOG_PARALLEL_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include "opencv2/objdetect/objdetect.hpp"
+
+#include "worker_pool.h"
+#include "hog_engine.h"
+
+//Largest number of pyramid levels searched, as HOGDescriptor::nlevels
+#define HOG_MAX_LEVELS						(64)
+
+//Jobs aimed at per worker, and the fewest window rows a tile may have. Tiles overlap by a window height less a stride.
+#define HOG_JOBS_PER_WORKER					(2)
+#define HOG_TILE_MIN_WIN_ROWS					(4)
+
+//Power law exponent of the HOG features between scales, for the approximated feature pyramid: downscaling by r
+//multiplies the sub-cell histograms by r^-lambda
+#define HOG_APPROX_LAMBDA					(0.1)
+
+
+void hog_detect_parallel(wp_pool_t* pool, int prio_level, const cv::HOGDescriptor* hog, const hog_engine_t* eng, bool approx,
+	const cv::Mat& img, std::vector<cv::Rect>& found, double hit_threshold, cv::Size win_stride, double scale0, int group_threshold);
+
+#endif
@@ -0,0 +1,421 @@
+/**
+ * @file lane_edges.cpp
+ * @brief This file consists of the streamed edge map of the lane service.
+ *
+ * The lane service masked the contrast image, blurred it, ran Canny() on it and masked the edges with the ROI: four
+ * passes over the half frame, each writing a new image. Here the image goes through once, row by row. Each stage
+ * keeps only the rows the next one reads: 5 masked rows for the 5x5 blur, 3 blurred rows for Sobel and 3 rows of
+ * gradients for the non maximum suppression. Only the map Canny() follows the weak edges over is kept whole, since an
+ * edge can be continued anywhere in the image. The blur uses the fixed point arithmetic of GaussianBlur() on 8 bit
+ * images, and the suppression and the hysteresis are those of Canny() with L2 gradients.
+ *
+ * Only the span of each row the ROI covers is kept, so the stages run on spans computed once per resolution by
+ * lane_edges_roi(), or narrower ones set by lane_edges_spans(): the suppression runs LANE_EDGES_SPAN_MARGIN pixels
+ * around the ROI, through which weak edges may still reach it, and each earlier stage on the pixels the next one
+ * reads. Inside the ROI the edges are those of the whole image, but for weak edges only connected to an edge through
+ * pixels further out.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "lane_edges.h"
+
+using namespace cv;
+using namespace std;
+
+//tan(22.5 degrees) in 15 bit fixed point, as Canny() uses it
+#define LANE_EDGES_TG22						((int)(0.4142135623730950488016887242097*(1 << 15) + 0.5))
+
+
+/**
+ * @brief This function returns the row a row outside of the image reads with BORDER_REFLECT_101.
+ */
+static inline int lane_edges_reflect(int y, int rows)
+{
+	if(y < 0)
+		return -y;
+	if(y >= rows)
+		return 2*(rows - 1) - y;
+	return y;
+}
+
+
+/**
+ * @brief This function masks a row of the contrast image into the masked row buffer and reflects its borders.
+ */
+static void lane_edges_detect(lane_edges_t* work, const Mat& gray, const Mat& mask, const uchar* lut, int y)
+{
+	int cols = work->cols;
+	lane_span_t span = work->span[LANE_SPAN_DETECT][y];
+	uchar* d = &work->detect[(y % LANE_EDGES_DETECT_ROWS)*(cols + 4)] + 2;
+	const uchar* g = gray.ptr<uchar>(y);
+	const uchar* m = mask.ptr<uchar>(y);
+
+	for(int x=span.x0; x<span.x1; x++)
+	{
+		d[x] = lut[g[x]] & m[x];
+	}
+	if(span.x0 == 0)
+	{
+		d[-1] = d[1];
+		d[-2] = d[2];
+	}
+	if(span.x1 == cols)
+	{
+		d[cols] = d[cols - 2];
+		d[cols + 1] = d[cols - 3];
+	}
+}
+
+
+/**
+ * @brief This function blurs a row with the 5x5 kernel of GaussianBlur(), from the masked rows around it, into the
+ * blurred row buffer and replicates its borders for Sobel.
+ */
+static void lane_edges_blur(lane_edges_t* work, int y, int rows)
+{
+	int cols = work->cols;
+	lane_span_t span = work->span[LANE_SPAN_BLUR][y];
+	const uchar* d[5];
+	int* v = &work->vsum[2];
+	uchar* b = &work->blur[(y % LANE_EDGES_BLUR_ROWS)*(cols + 2)] + 1;
+
+	for(int k=0; k<5; k++)
+	{
+		d[k] = &work->detect[(lane_edges_reflect(y + k - 2, rows) % LANE_EDGES_DETECT_ROWS)*(cols + 4)] + 2;
+	}
+	for(int x=span.x0 - 2; x<span.x1 + 2; x++)
+	{
+		v[x] = d[0][x] + 4*(d[1][x] + d[3][x]) + 6*d[2][x] + d[4][x];
+	}
+	//Both passes are summed before the single rounding, as GaussianBlur() does in fixed point
+	for(int x=span.x0; x<span.x1; x++)
+	{
+		b[x] = (v[x - 2] + 4*(v[x - 1] + v[x + 1]) + 6*v[x] + v[x + 2] + 128) >> 8;
+	}
+	if(span.x0 == 0)
+		b[-1] = b[0];
+	if(span.x1 == cols)
+		b[cols] = b[cols - 1];
+}
+
+
+/**
+ * @brief This function computes the Sobel derivatives and the squared magnitudes of a row from the blurred rows
+ * around it, with the replicated borders of Canny().
+ */
+static void lane_edges_gradient(lane_edges_t* work, int y, int rows)
+{
+	int cols = work->cols;
+	int slot = y % LANE_EDGES_GRAD_ROWS;
+	const uchar* a = &work->blur[(max(y - 1, 0) % LANE_EDGES_BLUR_ROWS)*(cols + 2)] + 1;
+	const uchar* c = &work->blur[(y % LANE_EDGES_BLUR_ROWS)*(cols + 2)] + 1;
+	const uchar* e = &work->blur[(min(y + 1, rows - 1) % LANE_EDGES_BLUR_ROWS)*(cols + 2)] + 1;
+	int* dx = &work->dx[slot*cols];
+	int* dy = &work->dy[slot*cols];
+	int* m = &work->mag[slot*(cols + 2)] + 1;
+	lane_span_t span = work->span[LANE_SPAN_GRAD][y];
+
+	for(int x=span.x0; x<span.x1; x++)
+	{
+		dx[x] = (a[x + 1] - a[x - 1]) + 2*(c[x + 1] - c[x - 1]) + (e[x + 1] - e[x - 1]);
+		dy[x] = (e[x - 1] + 2*e[x] + e[x + 1]) - (a[x - 1] + 2*a[x] + a[x + 1]);
+		m[x] = dx[x]*dx[x] + dy[x]*dy[x];
+	}
+	m[-1] = 0;
+	m[cols] = 0;
+}
+
+
+/**
+ * @brief This function keeps the pixels of a row whose magnitude is a maximum along the gradient and above the low
+ * threshold, as Canny() does, and marks them in the edge map. Those above the high threshold are pushed on the stack.
+ */
+static void lane_edges_suppress(lane_edges_t* work, int y, int rows, int low, int high)
+{
+	int cols = work->cols;
+	int slot = y % LANE_EDGES_GRAD_ROWS;
+	const int* dx = &work->dx[slot*cols];
+	const int* dy = &work->dy[slot*cols];
+	const int* p = (y > 0 ? &work->mag[((y - 1) % LANE_EDGES_GRAD_ROWS)*(cols + 2)] : &work->zero[0]) + 1;
+	const int* c = &work->mag[slot*(cols + 2)] + 1;
+	const int* n = (y < rows - 1 ? &work->mag[((y + 1) % LANE_EDGES_GRAD_ROWS)*(cols + 2)] : &work->zero[0]) + 1;
+	uchar* map = &work->map[(size_t)(y + 1)*(cols + 2)] + 1;
+	lane_span_t span = work->span[LANE_SPAN_SUPPRESS][y];
+
+	memset(map - 1, 1, cols + 2);
+	for(int x=span.x0; x<span.x1; x++)
+	{
+		int m = c[x];
+		bool keep = false;
+
+		if(m > low)
+		{
+			int xs = abs(dx[x]);
+			int ys = abs(dy[x]) << 15;
+			int tg22x = xs*LANE_EDGES_TG22;
+
+			if(ys < tg22x)
+				keep = (m > c[x - 1]) && (m >= c[x + 1]);
+			else if(ys > tg22x + (xs << 16))
+				keep = (m > p[x]) && (m >= n[x]);
+			else
+			{
+				int s = ((dx[x] ^ dy[x]) < 0) ? -1 : 1;
+
+				keep = (m > p[x - s]) && (m > n[x + s]);
+			}
+		}
+		if(!keep)
+			map[x] = 1;
+		else if(m > high)
+		{
+			map[x] = 2;
+			work->stack.push_back(&map[x]);
+		}
+		else
+			map[x] = 0;
+	}
+}
+
+
+/**
+ * @brief This function widens a span by a margin, within the image.
+ */
+static inline lane_span_t lane_span_widen(lane_span_t span, int margin, int cols)
+{
+	lane_span_t wide = {0, 0};
+
+	if(span.x0 < span.x1)
+	{
+		wide.x0 = max(span.x0 - margin, 0);
+		wide.x1 = min(span.x1 + margin, cols);
+	}
+	return wide;
+}
+
+
+/**
+ * @brief This function gives each row the spans of the rows around it, widened by a margin: the pixels a stage must
+ * give for the next one to run on its spans.
+ */
+static void lane_span_grow(const vector<lane_span_t>& src, vector<lane_span_t>& dst, int reach, int margin, int cols)
+{
+	int rows = src.size();
+
+	dst.assign(rows, lane_span_t());
+	for(int y=0; y<rows; y++)
+	{
+		lane_span_t span = {cols, 0};
+
+		for(int k=max(y - reach, 0); k<=min(y + reach, rows - 1); k++)
+		{
+			if(src[k].x0 < src[k].x1)
+			{
+				span.x0 = min(span.x0, src[k].x0);
+				span.x1 = max(span.x1, src[k].x1);
+			}
+		}
+		if(span.x0 >= span.x1)
+			span.x0 = span.x1 = 0;
+		dst[y] = lane_span_widen(span, margin, cols);
+	}
+}
+
+
+/**
+ * @brief This function sets the region of interest of lane_edges() and the spans each of its stages runs on. Called
+ * once per resolution.
+ * @param work The line buffers and edge map of the job.
+ * @param roi The region of interest mask, kept by reference.
+ * @return void
+ */
+void lane_edges_roi(lane_edges_t* work, const Mat& roi)
+{
+	int rows = roi.rows, cols = roi.cols;
+
+	work->roi = roi;
+	work->cols = cols;
+	work->detect.assign(LANE_EDGES_DETECT_ROWS*(cols + 4), 0);
+	work->vsum.assign(cols + 4, 0);
+	work->blur.assign(LANE_EDGES_BLUR_ROWS*(cols + 2), 0);
+	work->dx.assign(LANE_EDGES_GRAD_ROWS*cols, 0);
+	work->dy.assign(LANE_EDGES_GRAD_ROWS*cols, 0);
+	work->mag.assign(LANE_EDGES_GRAD_ROWS*(cols + 2), 0);
+	work->zero.assign(cols + 2, 0);
+
+	//First and last pixel of each row in the ROI
+	work->roi_span.resize(rows);
+	for(int y=0; y<rows; y++)
+	{
+		const uchar* r = roi.ptr<uchar>(y);
+		int x0 = 0, x1 = cols;
+
+		while((x0 < cols) && !r[x0])
+		{
+			x0++;
+		}
+		while((x1 > x0) && !r[x1 - 1])
+		{
+			x1--;
+		}
+		work->roi_span[y].x0 = (x0 < x1) ? x0 : 0;
+		work->roi_span[y].x1 = (x0 < x1) ? x1 : 0;
+	}
+	lane_edges_spans(work, work->roi_span, LANE_EDGES_SPAN_MARGIN);
+	work->roi_area = lane_edges_area(work);
+}
+
+
+/**
+ * @brief This function sets the spans lane_edges() keeps edges in, within the ROI, and those each of its stages runs on.
+ * @param work The line buffers and edge map of the job, its ROI set.
+ * @param inside The span of every row, within those of the ROI.
+ * @param margin The pixels around the spans weak edges may reach them through.
+ * @return void
+ */
+void lane_edges_spans(lane_edges_t* work, const vector<lane_span_t>& inside, int margin)
+{
+	int cols = work->cols;
+
+	//Suppression around the spans, then the pixels each stage reads of the one before
+	lane_span_grow(inside, work->span[LANE_SPAN_SUPPRESS], margin, margin, cols);
+	lane_span_grow(work->span[LANE_SPAN_SUPPRESS], work->span[LANE_SPAN_GRAD], 1, 1, cols);
+	lane_span_grow(work->span[LANE_SPAN_GRAD], work->span[LANE_SPAN_BLUR], 1, 1, cols);
+	lane_span_grow(work->span[LANE_SPAN_BLUR], work->span[LANE_SPAN_DETECT], 2, 2, cols);
+	work->span[LANE_SPAN_ROI] = inside;
+}
+
+
+/**
+ * @brief This function counts the pixels lane_edges() reads with the spans set.
+ * @param work The line buffers and edge map of the job, its spans set.
+ * @return The number of pixels.
+ */
+long lane_edges_area(const lane_edges_t* work)
+{
+	const vector<lane_span_t>& span = work->span[LANE_SPAN_DETECT];
+	long area = 0;
+
+	for(size_t y=0; y<span.size(); y++)
+	{
+		area += span[y].x1 - span[y].x0;
+	}
+	return area;
+}
+
+
+/**
+ * @brief This function gives the edges of the lane service: the contrast image masked to the lane colours, blurred
+ * with GaussianBlur(Size(5,5), 0, 0, BORDER_DEFAULT), through Canny(low, high, 3, true) and masked with the ROI.
+ * @param work The line buffers and edge map of the job, its ROI set by lane_edges_roi() for the size of gray.
+ * @param gray The contrast image before its mapping.
+ * @param mask The lane colour mask.
+ * @param lut The mapping of gray to the contrast image.
+ * @param low The low threshold of Canny().
+ * @param high The high threshold of Canny().
+ * @param edges Returns the edge map.
+ * @return void
+ */
+void lane_edges(lane_edges_t* work, const Mat& gray, const Mat& mask, const uchar* lut, double low, double high, Mat& edges)
+{
+	int rows = gray.rows, cols = gray.cols;
+	int ilow, ihigh;
+	const int step = cols + 2;
+	const int ofs[8] = {-step - 1, -step, -step + 1, -1, 1, step - 1, step, step + 1};
+	int detected = 0, blurred = 0, graded = 0;
+
+	edges.create(gray.size(), CV_8U);
+	if((rows < LANE_EDGES_MIN_SIZE) || (cols < LANE_EDGES_MIN_SIZE))
+	{
+		Mat detect(gray.size(), CV_8U), blur, edge;
+
+		for(int y=0; y<rows; y++)
+		{
+			const uchar* g = gray.ptr<uchar>(y);
+			const uchar* m = mask.ptr<uchar>(y);
+			uchar* d = detect.ptr<uchar>(y);
+
+			for(int x=0; x<cols; x++)
+			{
+				d[x] = lut[g[x]] & m[x];
+			}
+		}
+		GaussianBlur(detect, blur, Size(5,5), 0, 0, BORDER_DEFAULT);
+		Canny(blur, edge, low, high, 3, true);
+		bitwise_and(edge, work->roi, edges);
+		return;
+	}
+
+	//Thresholds of Canny() with L2 gradients, compared to the squared magnitudes
+	if(low > high)
+		swap(low, high);
+	low = min(32767.0, low);
+	high = min(32767.0, high);
+	ilow = cvFloor(low > 0 ? low*low : low);
+	ihigh = cvFloor(high > 0 ? high*high : high);
+
+	work->map.resize((size_t)(rows + 2)*(cols + 2));
+	memset(&work->map[0], 1, cols + 2);
+	memset(&work->map[(size_t)(rows + 1)*(cols + 2)], 1, cols + 2);
+	work->stack.clear();
+
+	//Each stage runs as far as the rows the next one reads
+	for(int y=0; y<rows; y++)
+	{
+		int need = min(y + 1, rows - 1);
+
+		while(graded <= need)
+		{
+			int b = min(graded + 1, rows - 1);
+
+			while(blurred <= b)
+			{
+				int d = min(blurred + 2, rows - 1);
+
+				while(detected <= d)
+				{
+					lane_edges_detect(work, gray, mask, lut, detected++);
+				}
+				lane_edges_blur(work, blurred++, rows);
+			}
+			lane_edges_gradient(work, graded++, rows);
+		}
+		lane_edges_suppress(work, y, rows, ilow, ihigh);
+	}
+
+	//Weak edges connected to an edge become edges
+	while(!work->stack.empty())
+	{
+		uchar* m = work->stack.back();
+
+		work->stack.pop_back();
+		for(int k=0; k<8; k++)
+		{
+			if(!m[ofs[k]])
+			{
+				m[ofs[k]] = 2;
+				work->stack.push_back(m + ofs[k]);
+			}
+		}
+	}
+
+	for(int y=0; y<rows; y++)
+	{
+		const uchar* map = &work->map[(size_t)(y + 1)*(cols + 2)] + 1;
+		const uchar* r = work->roi.ptr<uchar>(y);
+		uchar* e = edges.ptr<uchar>(y);
+		lane_span_t span = work->span[LANE_SPAN_ROI][y];
+
+		memset(e, 0, cols);
+		for(int x=span.x0; x<span.x1; x++)
+		{
+			e[x] = (map[x] == 2 ? 255 : 0) & r[x];
+		}
+	}
+}
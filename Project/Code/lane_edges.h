@@ -0,0 +1,67 @@
+/**
+ * @file lane_edges.h
+ * @brief Streamed edge map of the lane service: masking, 5x5 Gaussian blur, Canny and the ROI mask over line buffers.
+ *
+ */
+
+#ifndef LANE_EDGES_H
+#define LANE_EDGES_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+//Rows kept by each line buffer: the 5x5 blur reads 5 masked rows, Sobel 3 blurred rows, the suppression 3 magnitude rows
+#define LANE_EDGES_DETECT_ROWS					(5)
+#define LANE_EDGES_BLUR_ROWS					(3)
+#define LANE_EDGES_GRAD_ROWS					(3)
+
+//Smaller images go through GaussianBlur() and Canny()
+#define LANE_EDGES_MIN_SIZE					(5)
+
+//Pixels around the ROI the suppression runs on, for weak edges to reach the ROI through them
+#define LANE_EDGES_SPAN_MARGIN					(8)
+
+//Spans of each row: those edges are kept in, and those each stage runs on
+#define LANE_SPAN_ROI						(0)
+#define LANE_SPAN_SUPPRESS					(1)
+#define LANE_SPAN_GRAD						(2)
+#define LANE_SPAN_BLUR						(3)
+#define LANE_SPAN_DETECT					(4)
+#define LANE_SPANS						(5)
+
+
+//Pixels [x0, x1) of a row, empty if x0 == x1
+typedef struct
+{
+	int x0, x1;
+} lane_span_t;
+
+
+//ROI spans, line buffers and edge map of one lane job, kept between frames
+typedef struct
+{
+	cv::Mat roi;						//Region of interest mask
+	std::vector<lane_span_t> roi_span;			//Spans of the whole ROI
+	long roi_area;						//Pixels read for the whole ROI
+	std::vector<lane_span_t> span[LANE_SPANS];		//Spans of every row, of the ROI or narrower
+	int cols;						//Width the line buffers are sized for
+	std::vector<uint8_t> detect;				//Masked contrast rows, 2 reflected columns on each side
+	std::vector<int> vsum;					//Vertical blur sums of a row, 2 reflected columns on each side
+	std::vector<uint8_t> blur;				//Blurred rows, 1 replicated column on each side
+	std::vector<int> dx, dy;				//Sobel derivatives
+	std::vector<int> mag;					//Squared gradient magnitudes, 1 zero column on each side
+	std::vector<int> zero;					//Magnitudes above the first and below the last row
+	std::vector<uint8_t> map;				//0 weak edge, 1 no edge, 2 edge, 1 pixel border
+	std::vector<uint8_t*> stack;				//Edges whose neighbours are not yet followed
+} lane_edges_t;
+
+
+void lane_edges_roi(lane_edges_t* work, const cv::Mat& roi);
+void lane_edges_spans(lane_edges_t* work, const std::vector<lane_span_t>& inside, int margin);
+long lane_edges_area(const lane_edges_t* work);
+void lane_edges(lane_edges_t* work, const cv::Mat& gray, const cv::Mat& mask, const uint8_t* lut, double low, double high,
+	cv::Mat& edges);
+
+#endif
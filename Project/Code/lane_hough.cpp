@@ -0,0 +1,261 @@
+/**
+ * @file lane_hough.cpp
+ * @brief This file consists of the probabilistic Hough transform of the lane service.
+ *
+ * HoughLinesP() votes every edge pixel in all 180 angles, and the lane service then keeps only the segments steeper
+ * than LANE_HOUGH_SLOPE. Here the pixels vote only in the angles of such segments, with LANE_HOUGH_SLACK bins to
+ * spare: 131 of 180 bins. Otherwise the transform is that of HoughLinesP(): pixels are taken in the same random order,
+ * a pixel whose bin reaches the threshold is followed along its line in both directions, and the pixels of a segment
+ * long enough take their votes back. The edge pixels are gathered once, within the ROI spans, skipping 8 empty pixels
+ * at a time, and the votes are 16 bit. Flat segments are no longer found, so they no longer remove the pixels they
+ * cross from the lanes found after them.
+ *
+ */
+
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "lane_hough.h"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * @brief This function sorts segments into left and right lanes by their slope, as lane_follower() did.
+ */
+static void lane_hough_add(const Vec4i& l, vector<Vec4i>& left, vector<Vec4i>& right)
+{
+	double slope = (double)((l[3] - l[1])/(double)(l[2] - l[0]));
+
+	if(slope > LANE_HOUGH_SLOPE)
+		right.push_back(l);
+	else if(slope < -LANE_HOUGH_SLOPE)
+		left.push_back(l);
+}
+
+
+/**
+ * @brief This function makes the tables of an image size: the bins of lane angles and the rho range of the image.
+ */
+static void lane_hough_tables(lane_hough_t* work, int rows, int cols)
+{
+	double theta = CV_PI/LANE_HOUGH_ANGLES;
+
+	work->rows = rows;
+	work->cols = cols;
+	work->trig.clear();
+	for(int n=0; n<LANE_HOUGH_ANGLES; n++)
+	{
+		bool lane = false;
+
+		//A line of normal angle a has the slope -cos(a)/sin(a)
+		for(int k=n-LANE_HOUGH_SLACK; k<=n+LANE_HOUGH_SLACK; k++)
+		{
+			lane |= fabs(cos(k*theta)) > LANE_HOUGH_SLOPE*fabs(sin(k*theta));
+		}
+		if(!lane)
+			continue;
+		work->trig.push_back((float)cos((double)n*theta));
+		work->trig.push_back((float)sin((double)n*theta));
+	}
+
+	//x*cos(a) + y*sin(a) lies within -cols and rows + cols
+	work->rho0 = cols;
+	work->nrho = rows + 2*cols + 1;
+	work->accum.resize(work->trig.size()/2*work->nrho);
+	work->mask.resize((size_t)rows*cols);
+}
+
+
+/**
+ * @brief This function gathers the edge pixels of the ROI spans in scan order and marks them in the mask.
+ */
+static void lane_hough_gather(lane_hough_t* work, const Mat& edges, const vector<lane_span_t>& spans)
+{
+	int cols = work->cols;
+
+	memset(&work->mask[0], 0, work->mask.size());
+	work->points.clear();
+	for(int y=0; y<work->rows; y++)
+	{
+		const uchar* e = edges.ptr<uchar>(y);
+		uchar* m = &work->mask[(size_t)y*cols];
+		int x = spans[y].x0, x1 = spans[y].x1;
+
+		while(x < x1)
+		{
+			uint64_t word;
+
+			if(x + 8 <= x1)
+			{
+				memcpy(&word, e + x, sizeof(word));
+				if(!word)
+				{
+					x += 8;
+					continue;
+				}
+			}
+			if(e[x])
+			{
+				m[x] = 1;
+				work->points.push_back(Point(x, y));
+			}
+			x++;
+		}
+	}
+}
+
+
+/**
+ * @brief This function adds or takes back the votes of a pixel.
+ * @return The bin of the most votes if it reaches max_val, after adding, else -1.
+ */
+static inline int lane_hough_vote(lane_hough_t* work, int x, int y, int vote, int max_val)
+{
+	const float* trig = &work->trig[0];
+	int16_t* accum = &work->accum[work->rho0];
+	int n = work->trig.size()/2, best = -1;
+
+	for(int k=0; k<n; k++, accum+=work->nrho)
+	{
+		int r = cvRound(x*trig[2*k] + y*trig[2*k + 1]);
+		int val = (accum[r] += vote);
+
+		if(max_val < val)
+		{
+			max_val = val;
+			best = k;
+		}
+	}
+	return best;
+}
+
+
+/**
+ * @brief This function finds the lane segments of an edge map: the segments HoughLinesP(edges, 1, CV_PI/180,
+ * threshold, min_length, max_gap) finds steeper than LANE_HOUGH_SLOPE, found by voting only in their angles.
+ * @param work The tables, accumulator and edge pixels of the job, remade when the image size changes.
+ * @param edges The edge map, empty outside of spans.
+ * @param spans The span of every row holding edges.
+ * @param threshold The votes of a line.
+ * @param min_length The length of a segment.
+ * @param max_gap The gap between the pixels of a segment.
+ * @param left Returns the segments of negative slope.
+ * @param right Returns the segments of positive slope.
+ * @return void
+ */
+void lane_hough(lane_hough_t* work, const Mat& edges, const vector<lane_span_t>& spans, int threshold,
+	int min_length, int max_gap, vector<Vec4i>& left, vector<Vec4i>& right)
+{
+	int rows = edges.rows, cols = edges.cols;
+	const int shift = LANE_HOUGH_SHIFT;
+	RNG rng((uint64_t)-1);
+
+	if(rows + cols > LANE_HOUGH_MAX_VOTES)
+	{
+		vector<Vec4i> lines;
+
+		HoughLinesP(edges, lines, 1, CV_PI/LANE_HOUGH_ANGLES, threshold, min_length, max_gap);
+		for(size_t i=0; i<lines.size(); i++)
+		{
+			lane_hough_add(lines[i], left, right);
+		}
+		return;
+	}
+
+	if((work->rows != rows) || (work->cols != cols))
+		lane_hough_tables(work, rows, cols);
+	memset(&work->accum[0], 0, work->accum.size()*sizeof(int16_t));
+	lane_hough_gather(work, edges, spans);
+
+	//Pixels in random order, as HoughLinesP() takes them
+	for(int count=work->points.size(); count>0; count--)
+	{
+		int idx = rng.uniform(0, count);
+		Point point = work->points[idx];
+		Point line_end[2];
+		int best, x0, y0, dx0, dy0;
+		bool xflag, good_line;
+		float a, b;
+
+		work->points[idx] = work->points[count - 1];
+		if(!work->mask[(size_t)point.y*cols + point.x])
+			continue;
+		best = lane_hough_vote(work, point.x, point.y, 1, threshold - 1);
+		if(best < 0)
+			continue;
+
+		//Walk from the pixel in both directions along the line of the bin
+		a = -work->trig[2*best + 1];
+		b = work->trig[2*best];
+		x0 = point.x;
+		y0 = point.y;
+		if(fabs(a) > fabs(b))
+		{
+			xflag = true;
+			dx0 = a > 0 ? 1 : -1;
+			dy0 = cvRound(b*(1 << shift)/fabs(a));
+			y0 = (y0 << shift) + (1 << (shift - 1));
+		}
+		else
+		{
+			xflag = false;
+			dy0 = b > 0 ? 1 : -1;
+			dx0 = cvRound(a*(1 << shift)/fabs(b));
+			x0 = (x0 << shift) + (1 << (shift - 1));
+		}
+
+		for(int k=0; k<2; k++)
+		{
+			int gap = 0, x = x0, y = y0, dx = k ? -dx0 : dx0, dy = k ? -dy0 : dy0;
+
+			for(;; x+=dx, y+=dy)
+			{
+				int j1 = xflag ? x : (x >> shift);
+				int i1 = xflag ? (y >> shift) : y;
+
+				if((j1 < 0) || (j1 >= cols) || (i1 < 0) || (i1 >= rows))
+					break;
+				if(work->mask[(size_t)i1*cols + j1])
+				{
+					gap = 0;
+					line_end[k] = Point(j1, i1);
+				}
+				else if(++gap > max_gap)
+					break;
+			}
+		}
+		good_line = (abs(line_end[1].x - line_end[0].x) >= min_length) || (abs(line_end[1].y - line_end[0].y) >= min_length);
+
+		//The pixels of the segment leave the mask, and take their votes back if it is kept
+		for(int k=0; k<2; k++)
+		{
+			int x = x0, y = y0, dx = k ? -dx0 : dx0, dy = k ? -dy0 : dy0;
+
+			for(;; x+=dx, y+=dy)
+			{
+				int j1 = xflag ? x : (x >> shift);
+				int i1 = xflag ? (y >> shift) : y;
+				uchar* m = &work->mask[(size_t)i1*cols + j1];
+
+				if(*m)
+				{
+					if(good_line)
+						lane_hough_vote(work, j1, i1, -1, INT_MAX);
+					*m = 0;
+				}
+				if((i1 == line_end[k].y) && (j1 == line_end[k].x))
+					break;
+			}
+		}
+
+		if(good_line)
+			lane_hough_add(Vec4i(line_end[0].x, line_end[0].y, line_end[1].x, line_end[1].y), left, right);
+	}
+}
@@ -0,0 +1,48 @@
+/**
+ * @file lane_hough.h
+ * @brief Probabilistic Hough transform of the lane service, voting only in the angles of lane segments.
+ *
+ */
+
+#ifndef LANE_HOUGH_H
+#define LANE_HOUGH_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "lane_edges.h"
+
+//Angle bins of HoughLinesP(rho 1, theta CV_PI/180)
+#define LANE_HOUGH_ANGLES					(180)
+
+//Segments are lanes when their slope is steeper, left if it is negative, right if positive
+#define LANE_HOUGH_SLOPE					(0.5)
+
+//Bins voted beyond the lane slope, for segments whose end points are steeper than their bin
+#define LANE_HOUGH_SLACK					(2)
+
+//Fixed point fraction of the walk along a line
+#define LANE_HOUGH_SHIFT					(16)
+
+//The votes of a bin stay within rows + cols of the image, larger images go through HoughLinesP()
+#define LANE_HOUGH_MAX_VOTES					(32767)
+
+
+//Tables, accumulator and edge pixels of one lane job, kept between frames
+typedef struct
+{
+	int rows, cols;						//Size the tables are made for
+	int nrho, rho0;						//Rho bins, and the bin of rho 0
+	std::vector<float> trig;				//Cosine and sine of every voted bin, rounded as HoughLinesP() does
+	std::vector<int16_t> accum;				//Votes, nrho per voted angle
+	std::vector<uint8_t> mask;				//Edge pixels not yet on a segment
+	std::vector<cv::Point> points;				//Edge pixels in scan order
+} lane_hough_t;
+
+
+void lane_hough(lane_hough_t* work, const cv::Mat& edges, const std::vector<lane_span_t>& spans, int threshold,
+	int min_length, int max_gap, std::vector<cv::Vec4i>& left, std::vector<cv::Vec4i>& right);
+
+#endif
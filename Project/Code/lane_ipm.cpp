@@ -0,0 +1,274 @@
+/**
+ * @file lane_ipm.cpp
+ * @brief This file consists of the bird's-eye lane mode of the lane service.
+ *
+ * The ROI trapezoid of the half frame is mapped to a LANE_IPM_COLS x LANE_IPM_ROWS view where the lanes run up the
+ * view instead of converging. The half frame is the bottom half of pyrDown(), so the view is sampled from the frame
+ * itself: the remap tables hold the frame coordinates of every view pixel, made once per frame size, and a single
+ * remap() gives the view without pyrDown(), the crop or a warp of the half frame.
+ *
+ * The lanes are then found on the lane colour mask of the view. A column histogram of the bottom half of the view
+ * gives the bottom of the left and right lanes, or the previous fit does when the lane was found, and windows stacked
+ * up the view follow the lane pixels. A window without enough pixels keeps to the previous fit, which carries dashed
+ * lanes through their gaps. A parabola in the row is fitted to the pixels of the windows, so curved lanes are followed,
+ * and a found lane only moves LANE_IPM_SMOOTH of the way to each new fit.
+ *
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "lane_ipm.h"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * @brief This function maps a point through a homography.
+ */
+static inline void lane_ipm_map(const double* h, double u, double v, double* x, double* y)
+{
+	double w = h[6]*u + h[7]*v + h[8];
+
+	*x = (h[0]*u + h[1]*v + h[2])/w;
+	*y = (h[3]*u + h[4]*v + h[5])/w;
+}
+
+
+/**
+ * @brief This function gives the x of a lane at a row of the view.
+ */
+static inline double lane_ipm_x(const lane_ipm_line_t* l, double y)
+{
+	double t = y/LANE_IPM_ROWS;
+
+	return (l->a*t + l->b)*t + l->c;
+}
+
+
+/**
+ * @brief This function fits x = a*t*t + b*t + c to lane pixels by least squares.
+ * @return false if the pixels are too few or too close to a single row.
+ */
+static bool lane_ipm_fit(const vector<Point>& pts, double* a, double* b, double* c)
+{
+	double s[5] = {0}, r[3] = {0}, det;
+	int y0 = LANE_IPM_ROWS, y1 = 0;
+
+	if((int)pts.size() < LANE_IPM_MIN_FIT)
+		return false;
+	for(size_t i=0; i<pts.size(); i++)
+	{
+		double t = (double)pts[i].y/LANE_IPM_ROWS, tk = 1;
+
+		for(int k=0; k<5; k++, tk*=t)
+		{
+			s[k] += tk;
+			if(k < 3)
+				r[k] += pts[i].x*tk;
+		}
+		y0 = min(y0, pts[i].y);
+		y1 = max(y1, pts[i].y);
+	}
+	if(y1 - y0 < LANE_IPM_ROWS/4)
+		return false;
+
+	//Normal equations [s4 s3 s2; s3 s2 s1; s2 s1 s0] (a b c) = (r2 r1 r0), by Cramer's rule
+	det = s[4]*(s[2]*s[0] - s[1]*s[1]) - s[3]*(s[3]*s[0] - s[1]*s[2]) + s[2]*(s[3]*s[1] - s[2]*s[2]);
+	if(fabs(det) < 1e-9)
+		return false;
+	*a = (r[2]*(s[2]*s[0] - s[1]*s[1]) - s[3]*(r[1]*s[0] - s[1]*r[0]) + s[2]*(r[1]*s[1] - s[2]*r[0]))/det;
+	*b = (s[4]*(r[1]*s[0] - s[1]*r[0]) - r[2]*(s[3]*s[0] - s[1]*s[2]) + s[2]*(s[3]*r[0] - r[1]*s[2]))/det;
+	*c = (s[4]*(s[2]*r[0] - r[1]*s[1]) - s[3]*(s[3]*r[0] - r[1]*s[2]) + r[2]*(s[3]*s[1] - s[2]*s[2]))/det;
+	return true;
+}
+
+
+/**
+ * @brief This function makes the remap tables of a frame size, unless they are made already.
+ * @param ipm The tables.
+ * @param frame The size of the frames.
+ * @return void
+ */
+void lane_ipm_tables(lane_ipm_t* ipm, Size frame)
+{
+	int c = (frame.width + 1)/2, pyr_rows = (frame.height + 1)/2, r = pyr_rows/2;
+	Point2f view_pt[4], half_pt[4];
+	Mat h, map_x(LANE_IPM_ROWS, LANE_IPM_COLS, CV_32FC1), map_y(LANE_IPM_ROWS, LANE_IPM_COLS, CV_32FC1);
+
+	if((ipm->frame.width == frame.width) && (ipm->frame.height == frame.height) && !ipm->map1.empty())
+		return;
+	ipm->frame = frame;
+
+	//The corners of the view are those of the ROI trapezoid of lane_roi()
+	view_pt[0] = Point2f(0, 0);
+	view_pt[1] = Point2f(LANE_IPM_COLS - 1, 0);
+	view_pt[2] = Point2f(LANE_IPM_COLS - 1, LANE_IPM_ROWS - 1);
+	view_pt[3] = Point2f(0, LANE_IPM_ROWS - 1);
+	half_pt[0] = Point2f(2*c/5, r/5);
+	half_pt[1] = Point2f(3*c/5, r/5);
+	half_pt[2] = Point2f(4*c/5, r - 1);
+	half_pt[3] = Point2f(c/5, r - 1);
+	h = getPerspectiveTransform(view_pt, half_pt);
+	for(int i=0; i<9; i++)
+	{
+		ipm->to_half[i] = h.at<double>(i/3, i%3);
+	}
+
+	//pyrDown() centres half frame pixel (x, y) on frame pixel (2x, 2y + 2*(pyr_rows/2))
+	for(int v=0; v<LANE_IPM_ROWS; v++)
+	{
+		float* mx = map_x.ptr<float>(v);
+		float* my = map_y.ptr<float>(v);
+
+		for(int u=0; u<LANE_IPM_COLS; u++)
+		{
+			double x, y;
+
+			lane_ipm_map(ipm->to_half, u, v, &x, &y);
+			mx[u] = 2*x;
+			my[u] = 2*(y + r);
+		}
+	}
+	convertMaps(map_x, map_y, ipm->map1, ipm->map2, CV_16SC2);
+}
+
+
+/**
+ * @brief This function gives the bird's-eye view of the ROI of a frame.
+ * @param ipm The tables of the frame size.
+ * @param frame The BGR frame.
+ * @param view Returns the view.
+ * @return void
+ */
+void lane_ipm_warp(const lane_ipm_t* ipm, const Mat& frame, Mat& view)
+{
+	remap(frame, view, ipm->map1, ipm->map2, INTER_LINEAR, BORDER_CONSTANT);
+}
+
+
+/**
+ * @brief This function finds the left and right lanes of the view with sliding windows and moves them to the new fits.
+ * @param pixels The lane colour mask of the view.
+ * @param lines The left and right lanes, found or not on the previous frames.
+ * @return void
+ */
+void lane_ipm_find(const Mat& pixels, lane_ipm_line_t* lines)
+{
+	int rows = pixels.rows, cols = pixels.cols;
+	int hist[LANE_IPM_COLS];
+	vector<Point> pts;
+
+	//Lane pixels per column of the bottom half
+	memset(hist, 0, sizeof(hist));
+	for(int y=rows/2; y<rows; y++)
+	{
+		const uchar* p = pixels.ptr<uchar>(y);
+
+		for(int x=0; x<cols; x++)
+		{
+			hist[x] += (p[x] != 0);
+		}
+	}
+
+	for(int side=0; side<2; side++)
+	{
+		lane_ipm_line_t* l = &lines[side];
+		int lo = side ? cols/2 : 0, hi = side ? cols : cols/2;
+		int xc = lo;
+		double a, b, c;
+
+		if(l->found)
+			xc = min(max(cvRound(lane_ipm_x(l, rows - 1)), 0), cols - 1);
+		else
+		{
+			for(int x=lo; x<hi; x++)
+			{
+				if(hist[x] > hist[xc])
+					xc = x;
+			}
+		}
+
+		pts.clear();
+		if(l->found || hist[xc])
+		{
+			for(int w=0; w<LANE_IPM_WINDOWS; w++)
+			{
+				int y0 = rows - (w + 1)*rows/LANE_IPM_WINDOWS, y1 = rows - w*rows/LANE_IPM_WINDOWS;
+				int x0 = max(xc - LANE_IPM_MARGIN, 0), x1 = min(xc + LANE_IPM_MARGIN + 1, cols);
+				int count = 0;
+				long sum = 0;
+
+				for(int y=y0; y<y1; y++)
+				{
+					const uchar* p = pixels.ptr<uchar>(y);
+
+					for(int x=x0; x<x1; x++)
+					{
+						if(p[x])
+						{
+							pts.push_back(Point(x, y));
+							sum += x;
+							count++;
+						}
+					}
+				}
+				//The next window is centred on the pixels found, or on the previous fit
+				if(count >= LANE_IPM_MIN_PIXELS)
+					xc = sum/count;
+				else if(l->found)
+					xc = min(max(cvRound(lane_ipm_x(l, y0 - rows/(2*LANE_IPM_WINDOWS))), 0), cols - 1);
+			}
+		}
+
+		if(lane_ipm_fit(pts, &a, &b, &c))
+		{
+			if(l->found)
+			{
+				a = l->a + LANE_IPM_SMOOTH*(a - l->a);
+				b = l->b + LANE_IPM_SMOOTH*(b - l->b);
+				c = l->c + LANE_IPM_SMOOTH*(c - l->c);
+			}
+			l->a = a;
+			l->b = b;
+			l->c = c;
+			l->found = true;
+			l->misses = 0;
+		}
+		else if(l->found && (++l->misses > LANE_IPM_MISSES))
+		{
+			l->found = false;
+			l->misses = 0;
+		}
+	}
+}
+
+
+/**
+ * @brief This function gives a lane as the segment of the half frame from the top to the bottom of the view, as the
+ * lane service publishes it.
+ * @param ipm The tables the lane was found with.
+ * @param line The lane.
+ * @param seg Returns the top and bottom end points, zero if the lane is not found.
+ * @return void
+ */
+void lane_ipm_segment(const lane_ipm_t* ipm, const lane_ipm_line_t* line, Vec4i& seg)
+{
+	double x, y;
+
+	if(!line->found)
+	{
+		seg = Vec4i(0, 0, 0, 0);
+		return;
+	}
+	lane_ipm_map(ipm->to_half, lane_ipm_x(line, 0), 0, &x, &y);
+	seg[0] = cvRound(x);
+	seg[1] = cvRound(y);
+	lane_ipm_map(ipm->to_half, lane_ipm_x(line, LANE_IPM_ROWS - 1), LANE_IPM_ROWS - 1, &x, &y);
+	seg[2] = cvRound(x);
+	seg[3] = cvRound(y);
+}
@@ -0,0 +1,52 @@
+/**
+ * @file lane_ipm.h
+ * @brief Bird's-eye lane mode: the ROI warped straight from the frame, lanes found by sliding windows.
+ *
+ */
+
+#ifndef LANE_IPM_H
+#define LANE_IPM_H
+
+#include <opencv2/core/core.hpp>
+
+//Size of the bird's-eye view of the ROI
+#define LANE_IPM_COLS						(160)
+#define LANE_IPM_ROWS						(160)
+
+//Sliding windows stacked up the view, and the pixels on each side of their centre
+#define LANE_IPM_WINDOWS					(8)
+#define LANE_IPM_MARGIN						(12)
+
+//Lane pixels a window recentres on, and a lane is fitted to
+#define LANE_IPM_MIN_PIXELS					(20)
+#define LANE_IPM_MIN_FIT					(60)
+
+//Share of a new fit taken by a found lane, and frames a found lane may be missed before it is lost
+#define LANE_IPM_SMOOTH						(0.3)
+#define LANE_IPM_MISSES						(5)
+
+
+//Remap tables of one frame size
+typedef struct
+{
+	cv::Size frame;						//Frame size the tables are made for
+	cv::Mat map1, map2;					//Fixed point remap() tables from the frame to the view
+	double to_half[9];					//Homography from the view to the half frame of preprocess()
+} lane_ipm_t;
+
+
+//A lane of the view, x = a*t*t + b*t + c with t = y/LANE_IPM_ROWS
+typedef struct
+{
+	bool found;
+	double a, b, c;
+	int misses;						//Frames missed in a row
+} lane_ipm_line_t;
+
+
+void lane_ipm_tables(lane_ipm_t* ipm, cv::Size frame);
+void lane_ipm_warp(const lane_ipm_t* ipm, const cv::Mat& frame, cv::Mat& view);
+void lane_ipm_find(const cv::Mat& pixels, lane_ipm_line_t* lines);
+void lane_ipm_segment(const lane_ipm_t* ipm, const lane_ipm_line_t* line, cv::Vec4i& seg);
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * @file lane_mask.cpp
+ * @brief This file consists of the fused front end of the lane service.
+ *
+ * create_mask() converts the image to HLS and to HSV and thresholds both, and equalize() converts it to gray and
+ * equalizes it: five passes and two 3 channel temporaries. Here the lane colour test of create_mask() is done once
+ * per BGR value, at startup, by running create_mask()'s own conversions and thresholds over the whole BGR cube. The
+ * result is stored per cell of 8x8x8 colours: most cells hold no lane colour or only lane colours and take 2 bytes,
+ * the cells crossed by a threshold keep one bit per colour. A single pass over the image then gives the gray image,
+ * the mask and the gray histogram, from which equalizeHist()'s mapping is made, to be applied to the masked pixels only.
+ * Both are exact: the table is made by the conversions it replaces, and the gray weights are those of the OpenCV
+ * version that match cvtColor() on every colour while the table is built.
+ *
+ */
+
+
+#include <string.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "lane_mask.h"
+
+using namespace cv;
+using namespace std;
+
+//Blue, green and red weights and shift of cvtColor(COLOR_BGR2GRAY): OpenCV 3, OpenCV 4
+static const int lane_gray_weights[LANE_GRAY_WEIGHTS][4] = {{1868, 9617, 4899, 14}, {3735, 19235, 9798, 15}};
+
+
+/**
+ * @brief This function returns the index of the cell of a colour.
+ */
+static inline int lane_lut_cell(int b, int g, int r)
+{
+	return ((b >> LANE_LUT_SHIFT) << 10) | ((g >> LANE_LUT_SHIFT) << 5) | (r >> LANE_LUT_SHIFT);
+}
+
+
+/**
+ * @brief This function returns the index of a colour within its cell.
+ */
+static inline int lane_lut_sub(int b, int g, int r)
+{
+	return ((b & 7) << 6) | ((g & 7) << 3) | (r & 7);
+}
+
+
+/**
+ * @brief This function returns 255 for a lane colour, 0 otherwise.
+ */
+static inline uchar lane_lut_at(const lane_lut_t* lut, int b, int g, int r)
+{
+	int c = lut->cell[lane_lut_cell(b, g, r)];
+	int sub;
+
+	if(c < 2)
+		return c ? 255 : 0;
+	sub = lane_lut_sub(b, g, r);
+	return ((lut->block[(c - 2)*LANE_LUT_WORDS + (sub >> 6)] >> (sub & 63)) & 1) ? 255 : 0;
+}
+
+
+/**
+ * @brief This function allocates the table before the jobs build it.
+ * @param lut The table.
+ * @return void
+ */
+void lane_lut_start(lane_lut_t* lut)
+{
+	lut->ok = false;
+	lut->bits.assign((size_t)LANE_LUT_CELLS*LANE_LUT_WORDS, 0);
+}
+
+
+/**
+ * @brief Worker pool job building the table for a range of blue values: every green and red value of a blue value is
+ * one 256x256 image, thresholded as create_mask() does.
+ * @param arg The lane_lut_job_t. The ranges of the jobs are disjoint, so are the cells they write.
+ * @return void
+ */
+void lane_lut_job(void* arg)
+{
+	lane_lut_job_t* job = (lane_lut_job_t*)arg;
+	Mat bgr(256, 256, CV_8UC3), hls, hsv, white, yellow, mask, gray;
+
+	for(int k=0; k<LANE_GRAY_WEIGHTS; k++)
+	{
+		job->gray_ok[k] = true;
+	}
+	for(int b=job->b0; b<job->b1; b++)
+	{
+		for(int g=0; g<256; g++)
+		{
+			uchar* p = bgr.ptr<uchar>(g);
+
+			for(int r=0; r<256; r++)
+			{
+				p[3*r] = b;
+				p[3*r + 1] = g;
+				p[3*r + 2] = r;
+			}
+		}
+
+		//The thresholds of create_mask()
+		cvtColor(bgr, hls, COLOR_BGR2HLS);
+		inRange(hls, Scalar(20,115,10), Scalar(40,255,40), white);
+		cvtColor(bgr, hsv, COLOR_BGR2HSV);
+		inRange(hsv, Scalar(20,80,80), Scalar(40,255,255), yellow);
+		bitwise_or(white, yellow, mask);
+		cvtColor(bgr, gray, COLOR_BGR2GRAY);
+
+		for(int g=0; g<256; g++)
+		{
+			const uchar* m = mask.ptr<uchar>(g);
+			const uchar* y = gray.ptr<uchar>(g);
+
+			for(int r=0; r<256; r++)
+			{
+				int sub = lane_lut_sub(b, g, r);
+
+				if(m[r])
+					job->lut->bits[(size_t)lane_lut_cell(b, g, r)*LANE_LUT_WORDS + (sub >> 6)] |= (uint64_t)1 << (sub & 63);
+				for(int k=0; k<LANE_GRAY_WEIGHTS; k++)
+				{
+					const int* w = lane_gray_weights[k];
+
+					if(y[r] != ((b*w[0] + g*w[1] + r*w[2] + (1 << (w[3] - 1))) >> w[3]))
+						job->gray_ok[k] = false;
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief This function compacts the table once every job is done.
+ * @param lut The table.
+ * @param jobs The jobs that built it.
+ * @param n The number of jobs.
+ * @return true if the table can be used. false if no gray weights match cvtColor(), in which case create_mask()
+ * and equalize() must be used.
+ */
+bool lane_lut_finish(lane_lut_t* lut, const lane_lut_job_t* jobs, int n)
+{
+	lut->ok = false;
+	for(int k=0; (k<LANE_GRAY_WEIGHTS) && !lut->ok; k++)
+	{
+		lut->ok = true;
+		for(int i=0; i<n; i++)
+		{
+			lut->ok &= jobs[i].gray_ok[k];
+		}
+		lut->b2y = lane_gray_weights[k][0];
+		lut->g2y = lane_gray_weights[k][1];
+		lut->r2y = lane_gray_weights[k][2];
+		lut->shift = lane_gray_weights[k][3];
+	}
+
+	lut->cell.assign(LANE_LUT_CELLS, 0);
+	lut->block.clear();
+	for(int c=0; c<LANE_LUT_CELLS; c++)
+	{
+		const uint64_t* w = &lut->bits[(size_t)c*LANE_LUT_WORDS];
+		bool none = true, all = true;
+
+		for(int k=0; k<LANE_LUT_WORDS; k++)
+		{
+			none &= (w[k] == 0);
+			all &= (w[k] == ~(uint64_t)0);
+		}
+		if(none)
+			continue;
+		if(all)
+		{
+			lut->cell[c] = 1;
+			continue;
+		}
+		lut->cell[c] = 2 + lut->block.size()/LANE_LUT_WORDS;
+		lut->block.insert(lut->block.end(), w, w + LANE_LUT_WORDS);
+	}
+	vector<uint64_t>().swap(lut->bits);
+	return lut->ok;
+}
+
+
+/**
+ * @brief This function converts a BGR image to gray and to the lane colour mask in one pass, and counts the gray levels.
+ * @param lut The table, built and checked.
+ * @param bgr The image.
+ * @param gray Returns the image as cvtColor(COLOR_BGR2GRAY) gives it.
+ * @param mask Returns the mask create_mask() gives.
+ * @param hist Returns the 256 bin histogram of gray.
+ * @return void
+ */
+void lane_mask_front(const lane_lut_t* lut, const Mat& bgr, Mat& gray, Mat& mask, int* hist)
+{
+	int b2y = lut->b2y, g2y = lut->g2y, r2y = lut->r2y, shift = lut->shift, half = 1 << (shift - 1);
+
+	gray.create(bgr.size(), CV_8U);
+	mask.create(bgr.size(), CV_8U);
+	memset(hist, 0, 256*sizeof(int));
+
+	for(int y=0; y<bgr.rows; y++)
+	{
+		const uchar* p = bgr.ptr<uchar>(y);
+		uchar* g = gray.ptr<uchar>(y);
+		uchar* m = mask.ptr<uchar>(y);
+
+		for(int x=0; x<bgr.cols; x++, p+=3)
+		{
+			int v = (p[0]*b2y + p[1]*g2y + p[2]*r2y + half) >> shift;
+
+			g[x] = v;
+			hist[v]++;
+			m[x] = lane_lut_at(lut, p[0], p[1], p[2]);
+		}
+	}
+}
+
+
+/**
+ * @brief This function gives the mapping equalizeHist() makes of a histogram.
+ * @param hist The 256 bin histogram of the gray image.
+ * @param total The number of pixels of the image.
+ * @param lut Returns the mapping.
+ * @return void
+ */
+void lane_equalize_lut(const int* hist, int total, uchar* lut)
+{
+	int i = 0, sum = 0;
+	float scale;
+
+	//equalizeHist(): the lowest level maps to 0, and an image of a single level keeps it
+	while((i < 255) && !hist[i])
+	{
+		i++;
+	}
+	if(hist[i] == total)
+		memset(lut, i, 256);
+	else
+	{
+		scale = (256 - 1.f)/(total - hist[i]);
+		memset(lut, 0, 256);
+		for(i++; i<256; i++)
+		{
+			sum += hist[i];
+			lut[i] = saturate_cast<uchar>(sum*scale);
+		}
+	}
+}
+
+
+/**
+ * @brief This function maps the masked pixels of a gray image and clears the others. With the mapping of
+ * lane_equalize_lut(), equalize() followed by bitwise_and() with the mask.
+ * @param gray The gray image.
+ * @param mask The lane colour mask.
+ * @param lut The mapping.
+ * @param detect Returns the mapped masked image.
+ * @return void
+ */
+void lane_mask_apply(const Mat& gray, const Mat& mask, const uchar* lut, Mat& detect)
+{
+	detect.create(gray.size(), CV_8U);
+	for(int y=0; y<gray.rows; y++)
+	{
+		const uchar* g = gray.ptr<uchar>(y);
+		const uchar* m = mask.ptr<uchar>(y);
+		uchar* d = detect.ptr<uchar>(y);
+
+		for(int x=0; x<gray.cols; x++)
+		{
+			d[x] = lut[g[x]] & m[x];
+		}
+	}
+}
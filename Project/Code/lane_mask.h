@@ -0,0 +1,54 @@
+/**
+ * @file lane_mask.h
+ * @brief Single pass front end of the lane service: BGR to gray, lane colour mask and histogram at once.
+ *
+ */
+
+#ifndef LANE_MASK_H
+#define LANE_MASK_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+//The BGR cube is split into cells of 8x8x8 colours, 5 bits per channel
+#define LANE_LUT_SHIFT						(3)
+#define LANE_LUT_CELLS						(1 << 15)
+#define LANE_LUT_WORDS						(8)		//64 bit words of the colours of a cell
+
+//Jobs the table is built by, each over a range of blue values
+#define LANE_LUT_JOBS						(8)
+
+//Fixed point BGR to gray weights cvtColor() may use, those matching it are found while the table is built
+#define LANE_GRAY_WEIGHTS					(2)
+
+
+//Lane colours of every BGR value, as create_mask() finds them
+typedef struct
+{
+	std::vector<uint16_t> cell;				//0 if no colour of the cell is a lane colour, 1 if all are, else 2 + its block
+	std::vector<uint64_t> block;				//LANE_LUT_WORDS words per mixed cell, one bit per colour
+	std::vector<uint64_t> bits;				//Every colour while the table is built
+	int b2y, g2y, r2y, shift;				//Gray weights of cvtColor()
+	bool ok;						//Built and checked
+} lane_lut_t;
+
+
+//Part of the table built by one job
+typedef struct
+{
+	lane_lut_t* lut;
+	int b0, b1;						//Blue values, multiples of 8
+	bool gray_ok[LANE_GRAY_WEIGHTS];			//The weights match cvtColor() on every colour of the range
+} lane_lut_job_t;
+
+
+void lane_lut_start(lane_lut_t* lut);
+void lane_lut_job(void* arg);
+bool lane_lut_finish(lane_lut_t* lut, const lane_lut_job_t* jobs, int n);
+void lane_mask_front(const lane_lut_t* lut, const cv::Mat& bgr, cv::Mat& gray, cv::Mat& mask, int* hist);
+void lane_equalize_lut(const int* hist, int total, uint8_t* lut);
+void lane_mask_apply(const cv::Mat& gray, const cv::Mat& mask, const uint8_t* lut, cv::Mat& detect);
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * @file lane_track.cpp
+ * @brief This file consists of the tracking of the lane lines between the frames of a stream.
+ *
+ * Each lane line is kept as x = m*y + c, the form that stays finite for the steep lines lanes are, and follows an
+ * alpha-beta filter: the line is predicted from its change per frame, then moved by LANE_TRACK_ALPHA and its change by
+ * LANE_TRACK_BETA of the difference to the line measured from the segments found. Once a line has been found
+ * LANE_TRACK_LOCK frames in a row the next frame searches it only in a corridor of LANE_TRACK_CORRIDOR pixels on each
+ * side of its prediction. After LANE_TRACK_MISSES frames in a row without it the line is lost and searched in the
+ * whole ROI again.
+ *
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+
+#include "lane_track.h"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * @brief This function fits x = m*y + c to the end points of segments by least squares.
+ * @return false if the end points do not span more than one row.
+ */
+static bool lane_track_fit(const vector<Vec4i>& segments, double* m, double* c, double* y0, double* y1)
+{
+	double sx = 0, sy = 0, sxy = 0, syy = 0, n = 2*segments.size();
+
+	*y0 = INFINITY;
+	*y1 = -INFINITY;
+	for(size_t i=0; i<segments.size(); i++)
+	{
+		for(int k=0; k<4; k+=2)
+		{
+			double x = segments[i][k], y = segments[i][k + 1];
+
+			sx += x;
+			sy += y;
+			sxy += x*y;
+			syy += y*y;
+			*y0 = min(*y0, y);
+			*y1 = max(*y1, y);
+		}
+	}
+	if(segments.empty() || (*y1 - *y0 < 1))
+		return false;
+	*m = (n*sxy - sx*sy)/(n*syy - sy*sy);
+	*c = (sx - *m*sy)/n;
+	return true;
+}
+
+
+/**
+ * @brief This function resets the lane lines of a stream.
+ * @param t The lane lines.
+ * @return void
+ */
+void lane_track_init(lane_track_t* t)
+{
+	*t = lane_track_t();
+}
+
+
+/**
+ * @brief This function gives the corridor a lane line is searched in on the next frame.
+ * @param t The lane lines.
+ * @param side LANE_TRACK_LEFT or LANE_TRACK_RIGHT.
+ * @param roi The spans of the ROI.
+ * @param corridor Returns the span of every row within LANE_TRACK_CORRIDOR pixels of the predicted line and the ROI.
+ * @return false if the line is not locked, or its corridor leaves the ROI, in which case the whole ROI is searched.
+ */
+bool lane_track_corridor(const lane_track_t* t, int side, const vector<lane_span_t>& roi, vector<lane_span_t>& corridor)
+{
+	const lane_track_line_t* l = &t->line[side];
+	double m = l->m + l->dm, c = l->c + l->dc;
+	long area = 0;
+
+	if(l->hits < LANE_TRACK_LOCK)
+		return false;
+	corridor.resize(roi.size());
+	for(size_t y=0; y<roi.size(); y++)
+	{
+		double x = m*y + c;
+		lane_span_t span = {0, 0};
+
+		if((x > roi[y].x0 - LANE_TRACK_CORRIDOR - 1) && (x < roi[y].x1 + LANE_TRACK_CORRIDOR))
+		{
+			span.x0 = max((int)floor(x) - LANE_TRACK_CORRIDOR, roi[y].x0);
+			span.x1 = min((int)floor(x) + LANE_TRACK_CORRIDOR + 1, roi[y].x1);
+			if(span.x0 >= span.x1)
+				span.x0 = span.x1 = 0;
+		}
+		corridor[y] = span;
+		area += span.x1 - span.x0;
+	}
+	return area > 0;
+}
+
+
+/**
+ * @brief This function moves a lane line to the line measured from the segments found on a frame.
+ * @param t The lane lines.
+ * @param side LANE_TRACK_LEFT or LANE_TRACK_RIGHT.
+ * @param segments The segments of the line found on the frame, none if it was missed.
+ * @return void
+ */
+void lane_track_update(lane_track_t* t, int side, const vector<Vec4i>& segments)
+{
+	lane_track_line_t* l = &t->line[side];
+	double pm = l->m + l->dm, pc = l->c + l->dc;
+	double m, c, y0, y1;
+
+	if(!lane_track_fit(segments, &m, &c, &y0, &y1))
+	{
+		if(!l->hits)
+			return;
+		//Coasting on the prediction until lost
+		l->m = pm;
+		l->c = pc;
+		if(++l->misses > LANE_TRACK_MISSES)
+		{
+			l->hits = 0;
+			l->misses = 0;
+		}
+		return;
+	}
+
+	//A line away from the prediction at either end starts a new track
+	if(!l->hits || (fabs((m - pm)*y0 + c - pc) > LANE_TRACK_GATE) || (fabs((m - pm)*y1 + c - pc) > LANE_TRACK_GATE))
+	{
+		l->m = m;
+		l->c = c;
+		l->dm = 0;
+		l->dc = 0;
+		l->hits = 1;
+		l->misses = 0;
+		return;
+	}
+	l->m = pm + LANE_TRACK_ALPHA*(m - pm);
+	l->c = pc + LANE_TRACK_ALPHA*(c - pc);
+	l->dm += LANE_TRACK_BETA*(m - pm);
+	l->dc += LANE_TRACK_BETA*(c - pc);
+	l->hits++;
+	l->misses = 0;
+}
+
+
+/**
+ * @brief This function prints how often the lanes of a stream were searched in their corridors only.
+ * @param t The lane lines.
+ * @param stream The index of the stream.
+ * @return void
+ */
+void lane_track_report(const lane_track_t* t, int stream)
+{
+	printf("LANE TRACK stream %d: %lu frames, %lu searched in the corridors only, %.1f%% of the ROI read on average\n", stream,
+		t->frames, t->corridor_frames, t->frames ? 100*t->coverage/t->frames : 0.0);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file lane_track.h
+ * @brief Alpha-beta tracking of the lane lines, predicting the corridors the next frame searches.
+ *
+ */
+
+#ifndef LANE_TRACK_H
+#define LANE_TRACK_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "lane_edges.h"
+
+//Lines tracked: the left lane of negative slope, the right lane of positive slope
+#define LANE_TRACK_LEFT						(0)
+#define LANE_TRACK_RIGHT					(1)
+#define LANE_TRACK_LINES					(2)
+
+//Gains of the position and of the rate of the line parameters
+#define LANE_TRACK_ALPHA					(0.5)
+#define LANE_TRACK_BETA						(0.1)
+
+//Frames found in a row before a line is searched in its corridor only, and missed in a row before it is lost
+#define LANE_TRACK_LOCK						(3)
+#define LANE_TRACK_MISSES					(3)
+
+//Pixels on each side of the predicted line searched, and from it a measured line may be to continue the track
+#define LANE_TRACK_CORRIDOR					(5)
+#define LANE_TRACK_GATE						(12)
+
+//Pixels around a corridor weak edges may reach it through
+#define LANE_TRACK_MARGIN					(2)
+
+
+//A lane line x = m*y + c of the half frame, with its change per frame
+typedef struct
+{
+	double m, c;
+	double dm, dc;
+	int hits;						//Frames found in a row
+	int misses;						//Frames missed in a row
+} lane_track_line_t;
+
+
+//Lane lines of one stream, and how much of the ROI was searched
+typedef struct
+{
+	lane_track_line_t line[LANE_TRACK_LINES];
+	unsigned long frames;					//Frames searched
+	unsigned long corridor_frames;				//Frames both lines were only searched in their corridors
+	double coverage;					//Sum over the frames of the share of the ROI read
+} lane_track_t;
+
+
+void lane_track_init(lane_track_t* t);
+bool lane_track_corridor(const lane_track_t* t, int side, const std::vector<lane_span_t>& roi,
+	std::vector<lane_span_t>& corridor);
+void lane_track_update(lane_track_t* t, int side, const std::vector<cv::Vec4i>& segments);
+void lane_track_report(const lane_track_t* t, int stream);
+
+#endif
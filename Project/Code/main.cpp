@@ -17,30 +17,31 @@
 
 int main(int argc, char** argv)
 {
-	XInitThreads();
-	int frame_cnt = 0;
 	struct timespec start_time;
 	exit_cond = false;
-	Mat detector;
+	vout_policy_t vout_policy = VOUT_DROP_OLDEST;
+	bool vout_policy_set = false;
+	int total_frames = 0;
 	int rc;
 	pid_t mainpid;
-	int flag = 1;
 	int opt;
 	bool options = false;
-	char output_frames[50];
-
-	int radius;
-	string text;
-	Point ped_rect[2];
-	Point vehicle_rect[2];
-	Point sign_rect[2];
-
-	struct timespec temp_start, temp_stop, temp_diff;
-
+	char* replay_log = NULL;
+	pthread_attr_t stream_attr;
+	struct sched_param stream_param;
+	cpu_set_t stream_cpu;
+	int nprocs;
+	const uint8_t svc_fps[NUM_THREADS] = {FPS_PEDESTRIAN, FPS_LANE, FPS_SIGN, FPS_VEHICLE};
+	int bench_workers = 0;
+	long min_period_ns;
+	bool cascade_bench = false;
+	bool lane_bench = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &boot_time);
 	if(argc < 4)
 		help();
 
-	while((opt = getopt(argc, argv, "aplvs")) != -1)
+	while((opt = getopt(argc, argv, "aplvsbftmcCLir:w:j:P:")) != -1)
 	{
 		options = true;
 		switch(opt)
@@ -63,6 +64,56 @@ int main(int argc, char** argv)
 			case 'v':
 				enable[VEH_DETECT_TH] = 1;
 				break;
+			case 'b':
+				headless = true;
+				break;
+			case 'f':
+				hog_approx = true;
+				break;
+			case 't':
+				tracking = true;
+				break;
+			case 'm':
+				motion_gating = true;
+				break;
+			case 'c':
+				cascade_compiled = true;
+				break;
+			case 'C':
+				cascade_bench = true;
+				break;
+			case 'L':
+				lane_bench = true;
+				break;
+			case 'i':
+				lane_ipm = true;
+				break;
+			case 'r':
+				headless = true;
+				replay = true;
+				replay_log = optarg;
+				break;
+			case 'w':
+				vout_policy_set = true;
+				if(!strcmp(optarg, "block"))
+					vout_policy = VOUT_BLOCK;
+				else if(!strcmp(optarg, "oldest"))
+					vout_policy = VOUT_DROP_OLDEST;
+				else if(!strcmp(optarg, "annotated"))
+					vout_policy = VOUT_DROP_ANNOTATED_ONLY;
+				else
+					help();
+				break;
+			case 'j':
+				num_workers = atoi(optarg);
+				if(num_workers < 1)
+					help();
+				break;
+			case 'P':
+				bench_workers = atoi(optarg);
+				if(bench_workers < 1)
+					help();
+				break;
 			default:
 				help();
 				break;
@@ -75,20 +126,77 @@ int main(int argc, char** argv)
 	if(!options)
 		help();
 
-	//Declaring VideoCapture and VideoWriter objects to read and write videos
-	VideoCapture capture(argv[optind]);
-	VideoWriter output_v;
-	Size size = Size(COLS*2, ROWS*2);
-	output_v.open(argv[optind+1], CV_FOURCC('M','P','4','V'), capture.get(CV_CAP_PROP_FPS), size, true);
+	//Replay logs are only comparable when the frames every service processes are fixed by the frame count. The early
+	//releases of the trackers and the regions searched under motion gating depend on timing.
+	if(replay && (tracking || motion_gating))
+	{
+		cout << endl << "ERROR: -r cannot be combined with -t or -m";
+		help();
+	}
+
+	//Pedestrian benchmark on a single input, no services are started
+	if(bench_workers > 0)
+	{
+		ped_benchmark(argv[optind], bench_workers);
+		return 0;
+	}
+
+	//Cascade benchmark on a single input, no services are started
+	if(cascade_bench)
+	{
+		cascade_benchmark(argv[optind]);
+		return 0;
+	}
+
+	//Lane front end benchmark on a single input, no services are started
+	if(lane_bench)
+	{
+		lane_benchmark(argv[optind]);
+		return 0;
+	}
+
+	//The remaining arguments are input/output video pairs, one per stream
+	if(((argc - optind) % 2) != 0)
+		help();
+	num_streams = (argc - optind)/2;
+	if((num_streams < 1) || (num_streams > MAX_STREAMS))
+		help();
+
+	//Frames are only shown for a single stream. X is only needed when frames are displayed.
+	display = !headless && (num_streams == 1);
+	if(display)
+		XInitThreads();
 
-	//Load Vehicle xml
-	if( !vehicle_cascade.load(vehicle_cascade_name) )
-		handle_error("Error loading vehicle cascade")
+	//Headless runs write every frame unless told otherwise
+	if(headless && !vout_policy_set)
+		vout_policy = VOUT_BLOCK;
+
+	//A single sweep serves the vehicle and sign releases of the same frame. Replay keeps the sign job on every sign
+	//release, so the signs logged do not depend on which releases fall together.
+	cascade_shared = !replay && cascade_compiled && enable[VEH_DETECT_TH] && enable[SIGN_RECOG_TH];
+
+	//Opening the videos of every stream
+	for(int i=0; i<num_streams; i++)
+	{
+		stream_open(&streams[i], i, argv[optind + 2*i], argv[optind + 2*i + 1]);
+		streams[i].vout_policy = vout_policy;
+	}
 
+	//Replay mode logs every service result per frame
+	if(replay)
+	{
+		char* inputs[MAX_STREAMS];
+		for(int i=0; i<num_streams; i++)
+		{
+			inputs[i] = argv[optind + 2*i];
+		}
+		if(!results_log_open(replay_log, inputs, num_streams))
+			handle_error("Error creating replay log")
+	}
 
-	//Initializing Semaphores and Signal Handler.
+	//Initializing dispatch queues and Signal Handler.
 	set_signal_handler();
-	sem_create();	
+	dispatch_create_all();
 
 	//Main thread affinity
 	cout << " Main thread has PID = " << syscall(SYS_gettid) << endl;
@@ -104,6 +212,28 @@ int main(int argc, char** argv)
 	cout << "MAX priority= " << rt_max_prio << endl;
 	cout << "MIN priority= " << rt_min_prio << endl;
 
+	//Tracking carries the boxes between detections, so the detectors run less often
+	if(tracking)
+	{
+		for(int i=0; i<NUM_THREADS; i++)
+		{
+			if(i == LANE_FOLLOW_TH)
+				continue;
+			svc_table[i].period *= TRACK_PERIOD_FACTOR;
+			svc_table[i].deadline *= TRACK_PERIOD_FACTOR;
+		}
+	}
+
+	//Rate monotonic priorities for the services, below the sequencers. Deadlines are accounted at the frame rate of the
+	//stream of each job, the schedulability analysis is made at the fastest one.
+	min_period_ns = streams[0].frame_period_ns;
+	for(int i=1; i<num_streams; i++)
+	{
+		min_period_ns = min(min_period_ns, streams[i].frame_period_ns);
+	}
+	seq_init(svc_table, NUM_THREADS, NSEC_PER_SEC/(double)min_period_ns);
+	seq_assign_priorities(svc_table, NUM_THREADS, rt_max_prio);
+
 	//Setting highest priority to main which will act as the scheduler.
 	rc = sched_getparam(mainpid, &main_param);
 	main_param.sched_priority = rt_max_prio - 1;
@@ -118,90 +248,396 @@ int main(int argc, char** argv)
 	print_scheduler();
 	print_scope();
 
-	//Setting thread attributes
-	set_thread_attr();
-
-	//Setting up core affinity for different services
-	thread_core_set();
+	//One worker per core but the sequencers' one unless told otherwise. Workers run any service, below the sequencers and
+	//the decoders, which share the sequencers' core.
+	nprocs = get_nprocs();
+	cout << "This system has " << get_nprocs_conf() << " processors configured and " << nprocs << " processors available" << endl << endl;
+	if(num_workers == 0)
+		num_workers = (nprocs > 1) ? nprocs - 1 : 1;
+	for(int i=0; i<NUM_THREADS; i++)
+	{
+		if(enable[i])
+			cout << "Service " << svc_table[i].name << " period " << svc_table[i].period << " frames, priority " << svc_table[i].prio << ", pool level " << svc_table[i].level << endl;
+	}
+	cout << "Starting " << num_workers << " workers" << endl;
+	wp_start(&pool, num_workers, (nprocs > 1) ? 1 : 0, (nprocs > 1) ? nprocs - 1 : 1, rt_max_prio - 3);
 
-	//Creatintg 4 threads for individual services.
-	thread_create();
+	//Load the detectors on the workers. Returns once every one is ready.
+	services_init();
 	
 	//note Start time to calculate average FPS.	      
 	clock_gettime(CLOCK_REALTIME, &start_time);
 
-	// Create Sequencer thread, which like a cyclic executive, is highest prio
+	//One sequencer per stream, at the priority main had as the only sequencer, on the sequencer's core
 	cout << "STARTING SCHEDULER" << endl;
+	pthread_attr_init(&stream_attr);
+	pthread_attr_setinheritsched(&stream_attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&stream_attr, SCHED_FIFO);
+	stream_param.sched_priority = rt_max_prio - 1;
+	pthread_attr_setschedparam(&stream_attr, &stream_param);
+	CPU_ZERO(&stream_cpu);
+	CPU_SET(0, &stream_cpu);
+	pthread_attr_setaffinity_np(&stream_attr, sizeof(cpu_set_t), &stream_cpu);
+	for(int i=0; i<num_streams; i++)
+	{
+		if(pthread_create(&streams[i].thread, &stream_attr, stream_sequencer, (void*)&streams[i]) != 0)
+			handle_error("Error creating stream sequencer")
+	}
+	pthread_attr_destroy(&stream_attr);
+
+	//Waiting for every stream to reach its end or to be interrupted
+	for(int i=0; i<num_streams; i++)
+	{
+		pthread_join(streams[i].thread, NULL);
+		total_frames += streams[i].frame_cnt;
+	}
+	
+	//The workers run the jobs still queued, then exit
+	wp_stop(&pool);
+
+	//Calculating Average FPS
+	fps_calc(start_time, total_frames, FPS_SYSTEM);
+	for(int i=0; i<NUM_THREADS; i++)
+	{
+		if(enable[i])
+			fps_calc(start_time, svc_frame_cnt[i], svc_fps[i]);
+	}
+
+	if(headless)
+		throughput_report(start_time, total_frames);
+	stream_report(start_time);
+	
+	//Response times, deadline misses and schedulability of the service set
+	seq_report(svc_table, NUM_THREADS, enable);
+	wp_report(&pool);
+	for(int i=0; i<num_streams; i++)
+	{
+		cout << endl << "STREAM " << i << " " << streams[i].input << ":";
+		decoder_report(&streams[i].decoder);
+		video_out_report(&streams[i].vout);
+	}
+
+	//Writing the per-frame results once all services stopped
+	if(replay)
+		results_log_close();
+	
+	cout << "Exiting program" << endl;
+
+	//Destroying all dispatch queues
+	dispatch_destroy_all();
+	if(display)
+		destroyAllWindows();
+	
+	return 0;
+}
+
+
+/**
+ * @brief This function opens the videos of a stream and initializes its frame ring, result buffers and lane history.
+ * @param st The stream.
+ * @param id The index of the stream in streams[].
+ * @param input The input video file.
+ * @param output The output video file.
+ * @return void
+ */
+void stream_open(stream_t* st, int id, const char* input, const char* output)
+{
+	double input_fps;
+
+	st->id = id;
+	st->input = input;
+	st->output = output;
+	st->frame_cnt = 0;
+
+	//Declaring VideoCapture and VideoWriter objects to read and write videos
+	if(!st->capture.open(input))
+		handle_error("Error opening input video")
+	st->output_v.open(output, CV_FOURCC('M','P','4','V'), st->capture.get(CV_CAP_PROP_FPS), Size(COLS*2, ROWS*2), true);
+
+	//Preallocating the frame ring at the input video resolution
+	frame_ring_init(&st->ring, Size(st->capture.get(CV_CAP_PROP_FRAME_WIDTH), st->capture.get(CV_CAP_PROP_FRAME_HEIGHT)), CV_8UC3);
+
+	//Releases are paced at the frame rate of the input
+	input_fps = st->capture.get(CV_CAP_PROP_FPS);
+	if(input_fps <= 0)
+		input_fps = DEFAULT_FPS;
+	st->frame_period_ns = NSEC_PER_SEC/input_fps;
+
+	result_buffers_init(&st->img_char);
+	lane_state_init(&st->lane);
+	stream_trackers_init(st, Size(st->capture.get(CV_CAP_PROP_FRAME_WIDTH), st->capture.get(CV_CAP_PROP_FRAME_HEIGHT)));
+	motion_init(&st->motion);
+	for(int i=0; i<NUM_THREADS; i++)
+	{
+		tb_init(&st->motion_roi[i]);
+	}
+	st->lane_work.hough.rows = st->lane_work.hough.cols = 0;
+}
+
+
+/**
+ * @brief This function initializes the trackers of a stream with the mapping of every service's result coordinates
+ * to the COLS x ROWS tracking image.
+ * @param st The stream.
+ * @param frame The size of the input frames.
+ * @return void
+ */
+void stream_trackers_init(stream_t* st, Size frame)
+{
+	track_map_t full = {1, 1, 0, 0};
+	track_map_t top = {2.f*COLS/frame.width, 2.f*ROWS/frame.height, 0, 0};
+	track_map_t bottom = {2.f*COLS/frame.width, 2.f*ROWS/frame.height, 0, 2.f*(((frame.height + 1)/2)/2)*ROWS/frame.height};
+
+	track_frames_init(&st->track_frames);
+
+	//Pedestrians are found on the whole frame at COLS x ROWS, signs on its top half at half size, vehicles on the
+	//bottom half of the pyrDown() image
+	tracker_init(&st->tracker[PED_DETECT_TH], full);
+	tracker_init(&st->tracker[LANE_FOLLOW_TH], full);
+	tracker_init(&st->tracker[SIGN_RECOG_TH], top);
+	tracker_init(&st->tracker[VEH_DETECT_TH], bottom);
+}
+
+
+/**
+ * @brief This function publishes the regions of a stream that changed since the previous release of a service.
+ * Called by the stream sequencer before releasing the service.
+ * @param st The stream.
+ * @param svc The service.
+ * @param seq The frame the service is released on.
+ * @return void
+ */
+void stream_motion_release(stream_t* st, int svc, uint64_t seq)
+{
+	motion_roi_t roi;
+	uint64_t done_seq;
+
+	//The latest result tells whether the previous release was processed
+	if(svc == PED_DETECT_TH)
+		done_seq = tb_read(&st->img_char.found_loc)->seq;
+	else if(svc == VEH_DETECT_TH)
+		done_seq = tb_read(&st->img_char.vehicle_loc)->seq;
+	else if(svc == SIGN_RECOG_TH)
+		done_seq = tb_read(&st->img_char.traffic)->seq;
+	else
+		return;
+
+	motion_release(&st->motion, svc, seq, done_seq, &roi);
+	tb_write(&st->motion_roi[svc], roi);
+}
+
+
+/**
+ * @brief This function appends rectangles found in a region of an image to the rectangles of the whole image.
+ * @param dst The rectangles of the whole image.
+ * @param src The rectangles found in the region.
+ * @param ofs The top left corner of the region.
+ * @return void
+ */
+void rects_offset_append(vector<Rect>& dst, const vector<Rect>& src, Point ofs)
+{
+	for(size_t i=0; i<src.size(); i++)
+	{
+		dst.push_back(src[i] + ofs);
+	}
+}
+
+
+/**
+ * @brief This function moves the tracked boxes of a service to the current frame, and releases the service early
+ * on it when a track was lost.
+ * @param st The stream.
+ * @param svc The service.
+ * @param det The latest detections published by the service.
+ * @param slot The current frame.
+ * @param released The service was already released on the current frame.
+ * @return The boxes to draw.
+ */
+const det_result_t* stream_track(stream_t* st, int svc, const det_result_t* det, frame_slot_t* slot, bool released)
+{
+	const det_result_t* out;
+	bool redetect;
+
+	if(!enable[svc])
+		return det;
+
+	out = tracker_update(&st->tracker[svc], det, &st->track_frames, st->frame_cnt, &redetect);
+	if(redetect && !released)
+	{
+		seq_release_early(&svc_table[svc]);
+		//The vehicle job publishes the signs when the sweep is shared, so it stays their only writer. It gets a pass of
+		//its own on this frame unless it was released on it already.
+		if((svc == SIGN_RECOG_TH) && cascade_shared && (slot->frame.cols/2 <= CASCADE_MAX_WIDTH))
+		{
+			if(stream_sign_handoff(st, slot))
+				seq_release_early(&svc_table[VEH_DETECT_TH]);
+		}
+		else
+			service_release(&svc_table[svc], slot, st, 0);
+	}
+	return out;
+}
+
+
+/**
+ * @brief This function hands a sign release to the vehicle job. The vehicle job is released on the frame with
+ * RELEASE_SIGNS, or the flag is added to its release on the frame if there is one, so the signs are searched in the
+ * sweep of that frame and of no other.
+ * @param st The stream.
+ * @param slot The frame the signs were released on.
+ * @return true if the vehicle job was released for the signs, false if its release on the frame took them.
+ */
+bool stream_sign_handoff(stream_t* st, frame_slot_t* slot)
+{
+	if(motion_gating)
+		stream_motion_release(st, SIGN_RECOG_TH, slot->seq);
+	seq_release_shared(&svc_table[SIGN_RECOG_TH]);
+	return service_release(&svc_table[VEH_DETECT_TH], slot, st, RELEASE_SIGNS);
+}
+
+
+/**
+ * @brief Sequencer of one stream. Releases the services on the frames of the stream and annotates and writes its output.
+ * @param arg The stream.
+ * @return void
+ */
+void* stream_sequencer(void* arg)
+{
+	stream_t* st = (stream_t*)arg;
+	Mat detector;
+	frame_slot_t* slot;
+	vout_buf_t* obuf;
+	bool fresh, shared;
+	bool released[NUM_THREADS];
+	uint64_t drawn_seq[NUM_THREADS] = {0};
+	struct timespec next_release, first_out;
+	int flag = 1;
+
+	int radius;
+	string text;
+	Point ped_rect[2];
+	Point vehicle_rect[2];
+	Point sign_rect[2];
+
+	const det_result_t* ped_res;
+	const det_result_t* vehicle_res;
+	const det_result_t* sign_res;
+	const lane_result_t* lane_res;
+
+	struct timespec temp_start, temp_stop, temp_diff;
+
+	//Decoders run ahead on the sequencers' core, below the sequencers and above the workers, so no service load starves them
+	decoder_start(&st->decoder, &st->capture, &st->ring, PREFETCH_DEPTH, 0, rt_max_prio - 2);
+	
+	//Encoder runs at the lowest priority on whichever core is idle
+	video_out_start(&st->vout, &st->output_v, Size(COLS*2, ROWS*2), OUTPUT_DEPTH, st->vout_policy, rt_min_prio);
+	
+	clock_gettime(CLOCK_REALTIME, &st->start_time);
+	clock_gettime(CLOCK_MONOTONIC, &next_release);
 	
 	while(1)
 	{
-//		clock_gettime(CLOCK_REALTIME, &temp_start);			//uncomment during testing
-		capture >> g_frame;		
-		
-		//Counting number of frames
-		frame_cnt++;
-		
-		// Pedestrian Service = RT_MAX-20 @10Hz
-		if((frame_cnt % 3) == 0)
+		//Waiting for the next release time. Headless mode runs as fast as the pipeline allows.
+		if(!headless)
 		{
-			sem_post(&sem_pedestrian);
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_release, NULL);
+			next_release.tv_nsec += st->frame_period_ns;
+			while(next_release.tv_nsec >= NSEC_PER_SEC)
+			{
+				next_release.tv_nsec -= NSEC_PER_SEC;
+				next_release.tv_sec++;
+			}
 		}
 		
-		// Lane Detection Service = RT_MAX-20 @15Hz
-		if((frame_cnt % 2) == 0)
+//		clock_gettime(CLOCK_REALTIME, &temp_start);			//uncomment during testing
+		//Take the next prefetched frame and publish it to the services
+		slot = decoder_next(&st->decoder);
+		if(slot == NULL)
 		{
-			sem_post(&sem_lane);
+			break;
 		}
-	     
-		// Vehicle Service = RT_MAX-20 @15Hz
-		if((frame_cnt % 2) == 0)
+		
+		//Counting number of frames
+		st->frame_cnt++;
+		frame_ring_publish(&st->ring, slot, st->frame_cnt);
+		
+		//Changes since the previous frame, at low resolution
+		if(motion_gating)
+			motion_update(&st->motion, slot->frame);
+
+		//Releasing the services due on this frame, as given by the service table
+		for(int i=0; i<NUM_THREADS; i++)
 		{
-			sem_post(&sem_vehicle);
+			released[i] = enable[i] && seq_release_due(&svc_table[i], st->frame_cnt);
 		}
-		
-		// Sign Service = RT_MAX-20 @ 7.5Hz
-		if((frame_cnt % 4) == 0)
+
+		//A sign release on a vehicle release is handed to the vehicle job, which searches both in one sweep
+		shared = cascade_shared && released[SIGN_RECOG_TH] && released[VEH_DETECT_TH] && (slot->frame.cols/2 <= CASCADE_MAX_WIDTH);
+		if(shared)
+			stream_sign_handoff(st, slot);
+		for(int i=0; i<NUM_THREADS; i++)
 		{
-			sem_post(&sem_sign);
+			if(released[i] && !(shared && ((i == SIGN_RECOG_TH) || (i == VEH_DETECT_TH))))
+			{
+				service_release(&svc_table[i], slot, st, 0);
+			}
 		}
+
+		//Small gray copy of the frame the boxes are tracked on
+		if(tracking)
+			track_frames_push(&st->track_frames, slot->frame, Size(COLS, ROWS), st->frame_cnt);
         	
-		//Sleep initially once to give the other threads to process and store values in global values
-		if(flag)
+		//Drawing straight into a free output buffer. The published slot stays valid until the next publish, so no copy is needed.
+		obuf = video_out_acquire(&st->vout);
+		detector = obuf->frame;
+		resize(slot->frame, detector, Size(COLS*2, ROWS*2));
+	
+		//Fetching the latest published results. Never blocks the services.
+		ped_res = tb_read(&st->img_char.found_loc);
+		lane_res = tb_read(&st->img_char.lanes);
+		vehicle_res = tb_read(&st->img_char.vehicle_loc);
+		sign_res = tb_read(&st->img_char.traffic);
+		
+		//A frame is fresh if any service published since the previous frame
+		fresh = (ped_res->seq != drawn_seq[PED_DETECT_TH]) || (lane_res->seq != drawn_seq[LANE_FOLLOW_TH]) ||
+			(vehicle_res->seq != drawn_seq[VEH_DETECT_TH]) || (sign_res->seq != drawn_seq[SIGN_RECOG_TH]);
+		drawn_seq[PED_DETECT_TH] = ped_res->seq;
+		drawn_seq[LANE_FOLLOW_TH] = lane_res->seq;
+		drawn_seq[VEH_DETECT_TH] = vehicle_res->seq;
+		drawn_seq[SIGN_RECOG_TH] = sign_res->seq;
+
+		//Tracked boxes replace the detections, and are new on every frame
+		if(tracking)
 		{
-			sleep(1);
-			flag = 0;
+			ped_res = stream_track(st, PED_DETECT_TH, ped_res, slot, released[PED_DETECT_TH]);
+			vehicle_res = stream_track(st, VEH_DETECT_TH, vehicle_res, slot, released[VEH_DETECT_TH]);
+			sign_res = stream_track(st, SIGN_RECOG_TH, sign_res, slot, released[SIGN_RECOG_TH]);
+			if(ped_res->count || vehicle_res->count || sign_res->count)
+				fresh = true;
 		}
 		
-		detector = g_frame.clone();
-		resize(detector, detector, Size(COLS*2, ROWS*2));
-	
 		//Drawing function for pedestrian here
-		mute_ped.lock();
-		for(int i=0; i<img_char.found_loc.size(); i++)
+		for(int i=0; i<ped_res->count; i++)
 		{
-			ped_rect[0].x = (img_char.found_loc[i].x)*2;
-			ped_rect[0].y = (img_char.found_loc[i].y)*2;
-			ped_rect[1].x = (img_char.found_loc[i].x + img_char.found_loc[i].width)*2;
-			ped_rect[1].y = (img_char.found_loc[i].y + img_char.found_loc[i].height)*2;
+			ped_rect[0].x = (ped_res->loc[i].x)*2;
+			ped_rect[0].y = (ped_res->loc[i].y)*2;
+			ped_rect[1].x = (ped_res->loc[i].x + ped_res->loc[i].width)*2;
+			ped_rect[1].y = (ped_res->loc[i].y + ped_res->loc[i].height)*2;
 			rectangle(detector, ped_rect[0], ped_rect[1], CV_RGB(255, 255, 255), 4);
 		}
-		mute_ped.unlock();
 		
 		//Drawing frunction for lanes here
-		mute_lane.lock();
-		line(detector, Point(img_char.g_left[0], img_char.g_left[1] + 180), Point(img_char.g_left[2], img_char.g_left[3] + 180), CV_RGB(255,0,0), 3, CV_AA);	
-		line(detector, Point(img_char.g_right[0], img_char.g_right[1] + 180), Point(img_char.g_right[2], img_char.g_right[3] + 180), CV_RGB(255,0,0), 3, CV_AA);
-		mute_lane.unlock();
+		line(detector, Point(lane_res->g_left[0], lane_res->g_left[1] + 180), Point(lane_res->g_left[2], lane_res->g_left[3] + 180), CV_RGB(255,0,0), 3, CV_AA);	
+		line(detector, Point(lane_res->g_right[0], lane_res->g_right[1] + 180), Point(lane_res->g_right[2], lane_res->g_right[3] + 180), CV_RGB(255,0,0), 3, CV_AA);
 
 		//Drawing function for Vehicles here
-		mute_vehicle.lock();
-		for(int i=0; i<img_char.vehicle_loc.size(); i++)
+		for(int i=0; i<vehicle_res->count; i++)
 		{
-			vehicle_rect[0].x = img_char.vehicle_loc[i].x;
-			vehicle_rect[0].y = img_char.vehicle_loc[i].y + 180;
-			vehicle_rect[1].x = img_char.vehicle_loc[i].x + img_char.vehicle_loc[i].width;
-			vehicle_rect[1].y = img_char.vehicle_loc[i].y + img_char.vehicle_loc[i].height + 180;
-			radius = cvRound((img_char.vehicle_loc[i].width + img_char.vehicle_loc[i].height)*0.25*1.2);
+			vehicle_rect[0].x = vehicle_res->loc[i].x;
+			vehicle_rect[0].y = vehicle_res->loc[i].y + 180;
+			vehicle_rect[1].x = vehicle_res->loc[i].x + vehicle_res->loc[i].width;
+			vehicle_rect[1].y = vehicle_res->loc[i].y + vehicle_res->loc[i].height + 180;
+			radius = cvRound((vehicle_res->loc[i].width + vehicle_res->loc[i].height)*0.25*1.2);
 			if(radius < 20)
 				text = "Speed up";
 			else if((radius >= 20) && (radius < 28))
@@ -212,503 +648,1215 @@ int main(int argc, char** argv)
 			rectangle(detector, vehicle_rect[0], vehicle_rect[1], CV_RGB(0, 0, 255));
 		}
 		putText(detector, text, Point(0, 24), FONT_HERSHEY_SIMPLEX, 1, CV_RGB(0, 0, 255), 2, 8, false);
-		mute_vehicle.unlock();
 
 		//Drawing function for traffic sign here		
-		mute_sign.lock();
-		for(int i=0; i<img_char.traffic.size(); i++)
+		for(int i=0; i<sign_res->count; i++)
 		{
-			sign_rect[0].x = (img_char.traffic[i].x)*2;
-			sign_rect[0].y = (img_char.traffic[i].y)*2;
-			sign_rect[1].x = (img_char.traffic[i].x + img_char.traffic[i].width)*2;
-			sign_rect[1].y = (img_char.traffic[i].y + img_char.traffic[i].height)*2;
+			sign_rect[0].x = (sign_res->loc[i].x)*2;
+			sign_rect[0].y = (sign_res->loc[i].y)*2;
+			sign_rect[1].x = (sign_res->loc[i].x + sign_res->loc[i].width)*2;
+			sign_rect[1].y = (sign_res->loc[i].y + sign_res->loc[i].height)*2;
 			rectangle(detector, sign_rect[0], sign_rect[1], CV_RGB(0, 255, 0));
 		}
-		mute_sign.unlock();
 
 
-//		imshow("Video", g_frame);		//Uncomment to view original video
-		c = waitKey(1);
-		imshow("Detector", detector);
-//		sprintf(output_frames, "./frames_snapshot/frame%d.jpg", frame_cnt);
-//		imwrite(output_frames, detector);
-		output_v.write(detector);
+		if(display)
+		{
+//			imshow("Video", slot->frame);		//Uncomment to view original video
+			c = waitKey(1);
+			imshow("Detector", detector);
+		}
+		video_out_submit(&st->vout, obuf, fresh);
+
+		//Cold start: the detectors were ready before the sequencers started, so no frame waits for them
+		if(flag)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &first_out);
+			delta_t(&first_out, &boot_time, &temp_diff);
+			printf("Stream %d: first frame out %.1f ms after start\n", st->id, temp_diff.tv_sec*1000.0 + temp_diff.tv_nsec/1e6);
+			flag = 0;
+		}
 		
 //		clock_gettime(CLOCK_REALTIME, &temp_stop);			//uncomment during testing
 //		delta_t(&temp_stop, &temp_start, &temp_diff);
 //		printf("Time elapsed in waiting: %lu nsecs\n", temp_diff.tv_nsec);		//uncomment during testing
 		
+		//Escape or Ctrl+C stops every stream
 		if((c == 27) || (exit_cond))
 		{
 			break;
 		}
 
 	}
+	clock_gettime(CLOCK_REALTIME, &st->stop_time);
 	
-	//Calculating Average FPS
-	fps_calc(start_time, frame_cnt, FPS_SYSTEM);
+	//Stopping the decoder, prefetched frames go back to the ring. The encoder writes what is still queued.
+	decoder_stop(&st->decoder);
+	video_out_stop(&st->vout);
+
+	pthread_exit(NULL);
+}
+
+
+/**
+ * @brief Job of the pedestrian detection service, run on one frame.
+ * @param frame The handle of the frame this release was made for. Released by the job.
+ * @param ctx The stream the frame belongs to.
+ * @param flags Unused.
+ * @return void
+ */
+void pedestrian_detect(frame_slot_t* frame, void* ctx, unsigned flags)
+{
+	//Variable Declaration
+	stream_t* st = (stream_t*)ctx;
+	uint64_t seq;
+	struct timespec release_time, job_start;
+	vector<Rect> local_found_loc, roi_found, rois;
+	Mat mat;
+	static Mat resz_mat;
+
+	(void)flags;
+	//Read-only handle to the frame this release was made for. Released as soon as the resized grayscale copy exists.
+	release_time = frame->stamp;
+	clock_gettime(CLOCK_MONOTONIC, &job_start);
+	seq = frame->seq;
+	mat = frame_derived(frame, FRAME_DERIVED_GRAY);
+	resize(mat, resz_mat, Size(COLS, ROWS));			//resize to 320x240
+	frame_release(frame);
+
+	//Scale levels and tiles run as sub-tasks on the worker pool, grouped once. With motion gating only the regions
+	//that changed are searched, unless this release is a full scan.
+	if(motion_gating && motion_rois_map(tb_read(&st->motion_roi[PED_DETECT_TH]), seq, Rect(0, 0, MOTION_COLS, MOTION_ROWS), resz_mat.size(), hog.winSize, rois))
+	{
+		for(size_t i=0; i<rois.size(); i++)
+		{
+			hog_detect_parallel(&pool, svc_table[PED_DETECT_TH].level, &hog, hog_eng_ok ? &hog_eng : NULL, hog_approx, resz_mat(rois[i]), roi_found, 0, Size(8, 8), 1.05, 2);
+			rects_offset_append(local_found_loc, roi_found, rois[i].tl());
+		}
+	}
+	else
+		hog_detect_parallel(&pool, svc_table[PED_DETECT_TH].level, &hog, hog_eng_ok ? &hog_eng : NULL, hog_approx, resz_mat, local_found_loc, 0, Size(8, 8), 1.05, 2);
+	
+	publish_detections(st, PED_DETECT_TH, &st->img_char.found_loc, local_found_loc, seq);
+	seq_job_done(&svc_table[PED_DETECT_TH], &release_time, &job_start, st->frame_period_ns);
+	
+	__atomic_fetch_add(&svc_frame_cnt[PED_DETECT_TH], 1, __ATOMIC_RELAXED);
+}
+
 
-	//Joining threads
-	for(int i=0;i<NUM_THREADS;i++)
+/**
+ * @brief Job of the lane detection service, run on one frame.
+ * @param frame The handle of the frame this release was made for. Released by the job.
+ * @param ctx The stream the frame belongs to.
+ * @param flags Unused.
+ * @return void
+ */
+void lane_follower(frame_slot_t* frame, void* ctx, unsigned flags)
+{
+	//Variable Declaration
+	stream_t* st = (stream_t*)ctx;
+	uint64_t seq;
+	struct timespec release_time, job_start;
+	static Mat src_half;		
+	static Mat gray, mask;
+	static Mat canny_roi;
+	lane_work_t* work = &st->lane_work;
+	uchar lut[256];
+
+	(void)flags;
+	release_time = frame->stamp;
+	clock_gettime(CLOCK_MONOTONIC, &job_start);
+	seq = frame->seq;
+
+	//Bird's-eye view of the ROI sampled from the frame in place of pyrDown() and the crop, lanes fitted on its colour mask
+	if(lane_ipm)
 	{
-		pthread_join(threads[i], NULL);
+		lane_ipm_tables(&work->ipm, frame->frame.size());
+		lane_ipm_warp(&work->ipm, frame->frame, src_half);
+		frame_release(frame);
+		lane_front(src_half, gray, mask, lut, lane_lut.ok);
+		lane_ipm_find(mask, st->lane.ipm);
+		lane_ipm_segment(&work->ipm, &st->lane.ipm[LANE_TRACK_LEFT], st->lane.lane_out.g_left);
+		lane_ipm_segment(&work->ipm, &st->lane.ipm[LANE_TRACK_RIGHT], st->lane.lane_out.g_right);
+	}
+	else
+	{
+		//Bottom half of the pyrDown() frame, shared with the vehicle search
+		Mat half = frame_derived(frame, FRAME_DERIVED_HALF);
+
+		//Contrast image and lane colour mask
+		lane_front(half, gray, mask, lut, lane_lut.ok);
+		frame_release(frame);
+
+		//Polygon ROI and its spans, once per resolution
+		if(work->roi_mask.size() != half.size())
+		{
+			lane_roi(half.size(), work->roi_mask);
+			lane_edges_roi(&work->edges, work->roi_mask);
+		}
+
+		//Detect lanes
+		vector<Vec4i> left;
+		vector<Vec4i> right;
+
+		//Masking, gaussian filter to reduce noise, canny transform for edge detection and lane segments, in the corridors
+		//of the tracked lanes or in the ROI.
+		lane_search(&st->lane.track, &work->edges, &work->hough, gray, mask, lut, canny_roi, left, right);
+		//imshow("Canny Mask", canny_roi);
+
+		//Lane history is kept per stream
+		process_lanes(&st->lane, left, LEFT);
+		process_lanes(&st->lane, right, RIGHT);
 	}
 	
-	cout << "Exiting program" << endl;
+	//Publishing both lanes at once
+	st->lane.lane_out.seq = seq;
+	tb_write(&st->img_char.lanes, st->lane.lane_out);
+	if(replay)
+		results_log_lane(st->id, LANE_FOLLOW_TH, svc_table[LANE_FOLLOW_TH].name, &st->lane.lane_out);
+	seq_job_done(&svc_table[LANE_FOLLOW_TH], &release_time, &job_start, st->frame_period_ns);
+
+	__atomic_fetch_add(&svc_frame_cnt[LANE_FOLLOW_TH], 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Job of the traffic signal detection service, run on one frame.
+ * @param frame The handle of the frame this release was made for. Released by the job.
+ * @param ctx The stream the frame belongs to.
+ * @param flags Unused.
+ * @return void
+ */
+void sign_recog(frame_slot_t* frame, void* ctx, unsigned flags)
+{
+	//Variable Declaration
+	stream_t* st = (stream_t*)ctx;
+	uint64_t seq;
+	struct timespec release_time, job_start;
+	Mat mat, resz_mat;
+	static Mat top;
+	static cascade_work_t work;
+	vector<Rect> local_traffic, roi_found, rois;
+
+	(void)flags;
+	release_time = frame->stamp;
+	clock_gettime(CLOCK_MONOTONIC, &job_start);
+	seq = frame->seq;
+
+	//The top of the frame at half size is that of the half size frame shared with the vehicle search when the scale is
+	//exactly 2 in both
+	if(frame->frame.rows % 4 == 0)
+		resz_mat = frame_derived(frame, FRAME_DERIVED_RESIZED)(Rect(0, 0, frame->frame.cols/2, frame->frame.rows/4));
+	else
+	{
+		mat = frame->frame(Rect(0, 0, frame->frame.cols, frame->frame.rows/2));
+		resize(mat, top, Size(mat.cols/2, mat.rows/2));
+		resz_mat = top;
+	}
+//	cvtColor(mat, mat, CV_BGR2GRAY);
+
+	//The top half of the frame, at half size
+	if(cascade_compiled && cascade_supports(resz_mat))
+		cascade_sweep(st, &work, resz_mat, seq, NULL, &local_traffic);
+	else if(motion_gating && motion_rois_map(tb_read(&st->motion_roi[SIGN_RECOG_TH]), seq, Rect(0, 0, MOTION_COLS, MOTION_ROWS/2), resz_mat.size(), cascade_window(CASCADE_TRAFFIC), rois))
+	{
+		for(size_t i=0; i<rois.size(); i++)
+		{
+			sign_search(resz_mat(rois[i]), roi_found);
+			rects_offset_append(local_traffic, roi_found, rois[i].tl());
+		}
+	}
+	else
+		sign_search(resz_mat, local_traffic);
+//	traffic_cascade.detectMultiScale(resz_mat, local_traffic, 1.1, 3, CASCADE_DO_CANNY_PRUNING, Size(0, 0), resz_mat.size()/* Size(30, 30)*/);
+	frame_release(frame);
+						
+	publish_detections(st, SIGN_RECOG_TH, &st->img_char.traffic, local_traffic, seq);
+	seq_job_done(&svc_table[SIGN_RECOG_TH], &release_time, &job_start, st->frame_period_ns);
 
-	//Destroying all Semaphores
-	sem_destroy_all();
-	destroyAllWindows();
+	__atomic_fetch_add(&svc_frame_cnt[SIGN_RECOG_TH], 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Job of the vehicle detection service, run on one frame.
+ * @param frame The handle of the frame this release was made for. Released by the job.
+ * @param ctx The stream the frame belongs to.
+ * @param flags RELEASE_SIGNS if the signs of the frame are searched in the same sweep.
+ * @return void
+ */
+void vehicle_detect(frame_slot_t* frame, void* ctx, unsigned flags)
+{
+	//Variable Declaration
+	stream_t* st = (stream_t*)ctx;
+	uint64_t seq;
+	struct timespec release_time, job_start;
+	Mat src_half, gray;
+	static cascade_work_t work;
+	vector<Rect> local_vehicle_loc, local_traffic, roi_found, rois;
+
+	release_time = frame->stamp;
+	clock_gettime(CLOCK_MONOTONIC, &job_start);
+	seq = frame->seq;
+
+	//The compiled cascades search the whole frame at half size, with the signs handed off on this frame
+	if(cascade_compiled && (frame->frame.cols/2 <= CASCADE_MAX_WIDTH))
+	{
+		src_half = frame_derived(frame, FRAME_DERIVED_RESIZED);
+		if(flags & RELEASE_SIGNS)
+		{
+			cascade_sweep(st, &work, src_half, seq, &local_vehicle_loc, &local_traffic);
+			publish_detections(st, SIGN_RECOG_TH, &st->img_char.traffic, local_traffic, seq);
+			__atomic_fetch_add(&svc_frame_cnt[SIGN_RECOG_TH], 1, __ATOMIC_RELAXED);
+		}
+		else
+			cascade_sweep(st, &work, src_half, seq, &local_vehicle_loc, NULL);
+	}
+	else
+	{
+		gray = frame_derived(frame, FRAME_DERIVED_HALF_GRAY);
+
+		//The bottom half of the frame, at half size
+		if(motion_gating && motion_rois_map(tb_read(&st->motion_roi[VEH_DETECT_TH]), seq, Rect(0, MOTION_ROWS/2, MOTION_COLS, MOTION_ROWS/2), gray.size(), cascade_window(CASCADE_CARS), rois))
+		{
+			for(size_t i=0; i<rois.size(); i++)
+			{
+				vehicle_search(gray(rois[i]), roi_found);
+				rects_offset_append(local_vehicle_loc, roi_found, rois[i].tl());
+			}
+		}
+		else
+			vehicle_search(gray, local_vehicle_loc);
+	}
+	frame_release(frame);
+
+	publish_detections(st, VEH_DETECT_TH, &st->img_char.vehicle_loc, local_vehicle_loc, seq);
+	seq_job_done(&svc_table[VEH_DETECT_TH], &release_time, &job_start, st->frame_period_ns);
 	
-	return 0;
+	__atomic_fetch_add(&svc_frame_cnt[VEH_DETECT_TH], 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief This function tells which cascade searches an image for a service: the one compiled into the program when
+ * enabled, the one mapped from the binary cache otherwise, and the CascadeClassifier when the image is beyond the
+ * evaluators. Every cascade that may be picked is loaded by services_init().
+ * @param m The cascade of the service.
+ * @param compiled The index of the compiled cascade.
+ * @param img The image to search.
+ * @return The index of the cascade in cascade_eval, -1 if the classifier must be used.
+ */
+int service_model_pick(service_model_t* m, int compiled, const Mat& img)
+{
+	if(cascade_supports(img) && (cascade_compiled || (m->model >= 0)))
+		return cascade_compiled ? compiled : m->model;
+	return -1;
+}
+
+
+/**
+ * @brief This function detects the vehicles of an image, with the cascade picked by service_model_pick(). Used by one
+ * vehicle job at a time.
+ * @param img The gray image.
+ * @param found Returns the detections.
+ * @return void
+ */
+void vehicle_search(const Mat& img, vector<Rect>& found)
+{
+	static cascade_work_t work;
+	int model = service_model_pick(&service_models[MODEL_VEHICLE], CASCADE_CARS, img);
+
+	if(model >= 0)
+		cascade_detect(model, &work, img, found, 1.2, 4, Size(16, 16), img.size());
+	else
+		vehicle_cascade.detectMultiScale(img, found, 1.2, 4, 0, Size(16, 16), img.size());
+}
+
+
+/**
+ * @brief This function detects the traffic lights and stop signs of an image, with the cascades picked by
+ * service_model_pick(), in one sweep when both are evaluated in the program. Used by one sign job at a time.
+ * @param img The BGR image.
+ * @param found Returns the detections.
+ * @return void
+ */
+void sign_search(const Mat& img, vector<Rect>& found)
+{
+	static cascade_work_t work;
+	vector<Rect> stops;
+	int traffic = service_model_pick(&service_models[MODEL_TRAFFIC], CASCADE_TRAFFIC, img);
+	int stop = service_model_pick(&service_models[MODEL_STOP], CASCADE_STOP, img);
+	cascade_scan_t scans[2] = {
+		{traffic, Rect(0, 0, img.cols, img.rows), 1.1, 2, Size(4, 4), img.size(), &found},
+		{stop, Rect(0, 0, img.cols, img.rows), 1.1, 2, Size(4, 4), img.size(), &stops}};
+
+	if((traffic >= 0) && (stop >= 0))
+		cascade_scan(&work, img, 1.1, scans, 2);
+	else if(traffic >= 0)
+		cascade_scan(&work, img, 1.1, &scans[0], 1);
+	else if(stop >= 0)
+		cascade_scan(&work, img, 1.1, &scans[1], 1);
+	if(traffic < 0)
+		traffic_cascade.detectMultiScale(img, found, 1.1, 2, 0 | CASCADE_SCALE_IMAGE, Size(4, 4), img.size());
+	if(stop < 0)
+		stop_cascade.detectMultiScale(img, stops, 1.1, 2, 0 | CASCADE_SCALE_IMAGE, Size(4, 4), img.size());
+	found.insert(found.end(), stops.begin(), stops.end());
+}
+
+
+/**
+ * @brief This function adds the scans of a cascade over a part of the half size frame, in the regions that changed
+ * when motion gating is on, with one result vector per region.
+ */
+static void cascade_sweep_add(stream_t* st, int svc, uint64_t seq, Rect part, Rect motion_part, int model, double scale_factor,
+	int min_neighbors, Size min_size, vector<cascade_scan_t>& scans)
+{
+	vector<Rect> rois;
+
+	if(!(motion_gating && (st != NULL) && motion_rois_map(tb_read(&st->motion_roi[svc]), seq, motion_part, part.size(), cascade_window(model), rois)))
+		rois.assign(1, Rect(0, 0, part.width, part.height));
+	for(size_t i=0; i<rois.size(); i++)
+	{
+		cascade_scan_t scan = {model, rois[i] + part.tl(), scale_factor, min_neighbors, min_size, Size(), NULL};
+
+		scans.push_back(scan);
+	}
+}
+
+
+/**
+ * @brief This function searches the vehicles in the bottom half and the traffic lights and stop signs in the top half of
+ * a frame, in one sweep of the compiled cascades over a shared image pyramid. Used by one job at a time.
+ * @param st The stream the frame belongs to, NULL to search the whole halves.
+ * @param work The buffers of the calling job.
+ * @param half The frame at half size, or only its top half when vehicles are not searched, as accepted by cascade_supports().
+ * @param seq The sequence number of the frame.
+ * @param vehicle_loc Returns the vehicles in bottom half coordinates. NULL if not searched.
+ * @param sign_loc Returns the signs in top half coordinates. NULL if not searched.
+ * @return void
+ */
+void cascade_sweep(stream_t* st, cascade_work_t* work, const Mat& half, uint64_t seq, vector<Rect>* vehicle_loc, vector<Rect>* sign_loc)
+{
+	int top = vehicle_loc ? half.rows/2 : half.rows;
+	Rect bottom(0, top, half.cols, half.rows - top);
+	vector<cascade_scan_t> scans;
+	vector< vector<Rect> > found;
+	size_t first_sign;
+
+	//The vehicles use every other level of the sweep, a scale step of 1.21
+	if(vehicle_loc)
+		cascade_sweep_add(st, VEH_DETECT_TH, seq, bottom, Rect(0, MOTION_ROWS/2, MOTION_COLS, MOTION_ROWS/2), CASCADE_CARS, 1.2, 4, Size(16, 16), scans);
+	first_sign = scans.size();
+	if(sign_loc)
+	{
+		cascade_sweep_add(st, SIGN_RECOG_TH, seq, Rect(0, 0, half.cols, top), Rect(0, 0, MOTION_COLS, MOTION_ROWS/2), CASCADE_TRAFFIC, 1.1, 2, Size(4, 4), scans);
+		cascade_sweep_add(st, SIGN_RECOG_TH, seq, Rect(0, 0, half.cols, top), Rect(0, 0, MOTION_COLS, MOTION_ROWS/2), CASCADE_STOP, 1.1, 2, Size(4, 4), scans);
+	}
+
+	found.resize(scans.size());
+	for(size_t i=0; i<scans.size(); i++)
+	{
+		scans[i].found = &found[i];
+	}
+	if(!scans.empty())
+		cascade_scan(work, half, 1.1, &scans[0], scans.size());
+
+	//Back to the coordinates each service publishes in
+	if(vehicle_loc)
+	{
+		vehicle_loc->clear();
+		for(size_t i=0; i<first_sign; i++)
+		{
+			rects_offset_append(*vehicle_loc, found[i], Point(0, -top));
+		}
+	}
+	if(sign_loc)
+	{
+		sign_loc->clear();
+		for(size_t i=first_sign; i<scans.size(); i++)
+		{
+			rects_offset_append(*sign_loc, found[i], Point(0, 0));
+		}
+	}
+}
+
+
+/**
+ * @brief Worker pool job loading a cascade of a service: maps its binary cache unless the compiled cascades are used,
+ * and parses its XML when the cache is not mapped or the classifier may be picked for images beyond the evaluators.
+ * @param arg The service_model_t.
+ * @return void
+ */
+void service_model_load(void* arg)
+{
+	service_model_t* m = (service_model_t*)arg;
+	struct timespec start, stop, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	m->loaded = !cascade_compiled && model_cache_open(&m->mc, m->cache, m->xml);
+	if(!m->loaded || m->fallback)
+		m->loaded = m->classifier->load(m->xml);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	delta_t(&stop, &start, &diff);
+	m->load_ms = diff.tv_sec*1000.0 + diff.tv_nsec/1e6;
+}
+
+
+/**
+ * @brief Worker pool job loading the pedestrian detector. The people detector is compiled into OpenCV, so only the
+ * HOG engine's tables are built.
+ * @param arg Unused.
+ * @return void
+ */
+void hog_load(void* arg)
+{
+	struct timespec start, stop, diff;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+	hog_eng_ok = hog_engine_init(&hog_eng, &hog);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	delta_t(&stop, &start, &diff);
+	hog_load_ms = diff.tv_sec*1000.0 + diff.tv_nsec/1e6;
+}
+
+
+/**
+ * @brief This function loads the detectors of the enabled services in parallel on the worker pool, and returns once
+ * every one is ready. Called before the sequencers start. The cascades compiled into the program need no loading.
+ * @param void
+ * @return void
+ */
+void services_init(void)
+{
+	wp_group_t ready;
+	struct timespec start, stop, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	wp_group_init(&ready);
+	//The pool is idle, so no load is refused
+	if(enable[PED_DETECT_TH])
+		wp_submit(&pool, 0, hog_load, NULL, &ready);
+	if(enable[LANE_FOLLOW_TH])
+	{
+		lane_lut_start(&lane_lut);
+		for(int i=0; i<LANE_LUT_JOBS; i++)
+		{
+			lane_lut_jobs[i].lut = &lane_lut;
+			lane_lut_jobs[i].b0 = 256*i/LANE_LUT_JOBS;
+			lane_lut_jobs[i].b1 = 256*(i + 1)/LANE_LUT_JOBS;
+			wp_submit(&pool, 0, lane_lut_job, (void*)&lane_lut_jobs[i], &ready);
+		}
+	}
+	for(int i=0; i<NUM_MODELS; i++)
+	{
+		service_model_t* m = &service_models[i];
+
+		//The services search images of at most half the frame width, rounded up by pyrDown()
+		m->fallback = false;
+		for(int j=0; j<num_streams; j++)
+		{
+			m->fallback |= (streams[j].ring.slot[0].frame.cols + 1)/2 > CASCADE_MAX_WIDTH;
+		}
+		if(enable[m->svc] && (!cascade_compiled || m->fallback))
+			wp_submit(&pool, 0, service_model_load, (void*)m, &ready);
+	}
+	wp_wait(&pool, &ready);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	delta_t(&stop, &start, &diff);
+
+	if(enable[PED_DETECT_TH])
+	{
+		if(!hog_eng_ok)
+			cout << "HOG engine does not support the detector, using HOGDescriptor" << endl;
+		printf("MODEL people detector: %.1f ms\n", hog_load_ms);
+	}
+	if(enable[LANE_FOLLOW_TH])
+	{
+		if(lane_lut_finish(&lane_lut, lane_lut_jobs, LANE_LUT_JOBS))
+			printf("MODEL lane colours: %zu of %d cells mixed\n", lane_lut.block.size()/LANE_LUT_WORDS, LANE_LUT_CELLS);
+		else
+			cout << "Lane colour table does not match cvtColor, using create_mask" << endl;
+	}
+	for(int i=0; i<NUM_MODELS; i++)
+	{
+		service_model_t* m = &service_models[i];
+
+		if(!enable[m->svc] || (cascade_compiled && !m->fallback))
+			continue;
+		if(!m->loaded)
+			handle_error("Error loading cascade")
+		if(m->mc.map)
+		{
+			m->model = cascade_attach(m->xml, &m->mc);
+			if(m->model < 0)
+				handle_error("Too many cascade caches")
+		}
+		printf("MODEL %s: %s%s, %.1f ms\n", m->xml, m->mc.map ? m->cache : "XML", (m->mc.map && m->fallback) ? " and XML" : "", m->load_ms);
+	}
+	printf("MODELS ready in %.1f ms\n", diff.tv_sec*1000.0 + diff.tv_nsec/1e6);
+}
+
+/**
+ * @brief This function measures the pedestrian detection FPS on the first frames of a video, with OpenCV's serial
+ * detectMultiScale() and on the worker pool with 1 to max_workers workers, scoring the windows with HOGDescriptor
+ * and with the HOG engine, on the full and on the approximated feature pyramid. The recall of the approximated
+ * pyramid is measured against the full one, and the engine is checked against HOGDescriptor on the same frames.
+ * @param input The input video file.
+ * @param max_workers The largest number of workers measured.
+ * @return void
+ */
+void ped_benchmark(const char* input, int max_workers)
+{
+	VideoCapture capture(input);
+	ped_bench_t bench;
+	Mat frame, gray, resz_mat;
+	vector<Rect> found;
+	struct timespec start_time, stop_time, diff_time;
+	double duration, serial_fps = 0;
+	unsigned long serial_hits = 0, matched, exact_total, approx_total;
+	vector< vector<Rect> > exact_found;
+	int nprocs = get_nprocs();
+
+	//Frames are decoded and converted up front, only the detection is timed
+	while((bench.frames.size() < PED_BENCH_FRAMES) && capture.read(frame))
+	{
+		cvtColor(frame, gray, CV_BGR2GRAY);
+		resize(gray, resz_mat, Size(COLS, ROWS));
+		bench.frames.push_back(resz_mat.clone());
+	}
+	if(bench.frames.empty())
+		handle_error("Error reading benchmark video")
+
+	hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+	hog_eng_ok = hog_engine_init(&hog_eng, &hog);
+	rt_max_prio = sched_get_priority_max(SCHED_FIFO);
+
+	clock_gettime(CLOCK_REALTIME, &start_time);
+	for(size_t i=0; i<bench.frames.size(); i++)
+	{
+		hog.detectMultiScale(bench.frames[i], found, 0, Size(8, 8), Size(0, 0), 1.05, 2, false);
+		serial_hits += found.size();
+	}
+	clock_gettime(CLOCK_REALTIME, &stop_time);
+	delta_t(&stop_time, &start_time, &diff_time);
+	duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+	serial_fps = bench.frames.size()/duration;
+	cout << endl << "PEDESTRIAN BENCH Frames: " << bench.frames.size() << ", processors: " << nprocs << endl;
+	cout << "PEDESTRIAN BENCH detectMultiScale: " << serial_fps << " FPS, " << serial_hits << " detections" << endl;
+
+	//The benchmark runs as a job, so that the main thread does not add to the workers measured.
+	//Modes: windows scored by HOGDescriptor, by the HOG engine, and the engine on the approximated pyramid.
+	for(int w=1; w<=max_workers; w++)
+	{
+		for(int m=0; m<(hog_eng_ok ? 3 : 1); m++)
+		{
+			bench.eng = (m > 0) ? &hog_eng : NULL;
+			bench.approx = (m == 2);
+			bench.hits = 0;
+			bench.found.resize(bench.frames.size());
+			wp_start(&pool, w, 0, nprocs, rt_max_prio - 2);
+			clock_gettime(CLOCK_REALTIME, &start_time);
+			wp_submit(&pool, 0, ped_bench_job, (void*)&bench, NULL);
+			wp_stop(&pool);
+			clock_gettime(CLOCK_REALTIME, &stop_time);
+			delta_t(&stop_time, &start_time, &diff_time);
+			duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+			cout << "PEDESTRIAN BENCH " << w << " workers, " << ((m == 0) ? "HOGDescriptor" : ((m == 1) ? "HOG engine" : "approximated pyramid")) << ": "
+				<< bench.frames.size()/duration << " FPS, speedup " << (bench.frames.size()/duration)/serial_fps << ", " << bench.hits << " detections" << endl;
+			if(m == 1)
+				exact_found = bench.found;
+		}
+	}
+
+	if(hog_eng_ok)
+	{
+		//Detections of the full pyramid found again on the approximated one, overlapping by half or more
+		ped_bench_match(exact_found, bench.found, &matched, &exact_total, &approx_total);
+		cout << "PEDESTRIAN BENCH approximated pyramid recall: " << (exact_total ? (double)matched/exact_total : 1.0) << " (" << matched << " of "
+			<< exact_total << "), " << approx_total - matched << " other detections" << endl;
+		hog_engine_check(&hog_eng, &hog, bench.frames);
+	}
+	else
+		cout << "PEDESTRIAN BENCH HOG engine does not support the detector" << endl;
 }
 
 
 /**
- * @brief Callback function for pedestrian detection thread.
- * @param threadp 
+ * @brief This function gives the contrast image of the lane service and the mask of the lane colours. The contrast
+ * image is given as a gray image and a mapping, applied by lane_mask_apply() or lane_edges().
+ * @param src_half The BGR image.
+ * @param gray Returns the gray image.
+ * @param mask Returns the lane colour mask.
+ * @param lut Returns the 256 entry mapping of gray to the contrast image.
+ * @param fused Use the single pass front end with lane_lut instead of equalize() and create_mask().
  * @return void
  */
-void* pedestrian_detect(void* threadp)
+void lane_front(const Mat& src_half, Mat& gray, Mat& mask, uchar* lut, bool fused)
 {
-	
-	//Variable Declaration
-	threadParams_t* threadParams = (threadParams_t*)threadp;
-	struct timespec start_time;
-	int frame_cnt = 0;
-	vector<Rect> local_found_loc;
+	int hist[256];
 
-	Mat mat, resz_mat;
-	HOGDescriptor hog;
-	hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
-			
-	//Printing thread information 
-	threadcpu_info(threadParams);
-	
-	//Note Start time to calculate FPS
-   	clock_gettime(CLOCK_REALTIME, &start_time);
-	
-	while(1)
+	if(fused)
 	{
-
-		sem_wait(&sem_pedestrian);			//semaphore from main
-
-		mat = g_frame.clone();
-		cvtColor(mat, mat, CV_BGR2GRAY);
-		resize(mat, resz_mat, Size(COLS, ROWS));			//resize to 320x240
-
-		hog.detectMultiScale(resz_mat, local_found_loc, 0, Size(8, 8), Size(0, 0), 1.05, 2, false);
-		
-		mute_ped.lock();
-		img_char.found_loc.clear();
-		img_char.found_loc = local_found_loc;
-		mute_ped.unlock();
-		
-		frame_cnt++;
-	
-		
-		if((c == 27) || (exit_cond))
+		lane_mask_front(&lane_lut, src_half, gray, mask, hist);
+		lane_equalize_lut(hist, gray.rows*gray.cols, lut);
+	}
+	else
+	{
+		gray = equalize(src_half);
+		mask = create_mask(src_half);
+		for(int i=0; i<256; i++)
 		{
-			break;
+			lut[i] = i;
 		}
 	}
+}
 
-	//Calculating FPS for pedestrian detection
-	fps_calc(start_time, frame_cnt, FPS_PEDESTRIAN);
 
-	pthread_exit(NULL);
+/**
+ * @brief This function draws the region of interest of the lane service.
+ * @param size The size of the half frame.
+ * @param roi Returns the mask of the region.
+ * @return void
+ */
+void lane_roi(Size size, Mat& roi)
+{
+	Point roi_pt[1][4];
+	int num = 4;
+
+	roi = Mat::zeros(size, CV_8U);
+	//Points for ROI mask
+	roi_pt[0][0] = Point(2*size.width/5, size.height/5);			//Apex
+	roi_pt[0][1] = Point(3*size.width/5, size.height/5);
+	roi_pt[0][3] = Point(size.width/5, size.height);				//Bottom left vertice
+	roi_pt[0][2] = Point(4*size.width/5 , size.height);			//Bottomk right vertice
+	const Point* pts_list[1] = {roi_pt[0]};
+	fillPoly(roi, pts_list, &num, 1, 255, 8);				//Change to fillConvexPolly for faster results
 }
 
 
 /**
- * @brief Callback function for lane detection thread.
- * @param threadp 
+ * @brief This function finds the lane segments of a frame. A locked lane is searched in the corridor of its
+ * prediction, the others in the whole ROI, and the tracked lanes are moved to the segments found.
+ * @param track The lane lines of the stream.
+ * @param edges_work The line buffers and edge map of the job, its ROI set.
+ * @param hough_work The Hough tables and accumulator of the job.
+ * @param gray The gray image given by lane_front().
+ * @param mask The lane colour mask given by lane_front().
+ * @param lut The mapping given by lane_front().
+ * @param edges Returns the edge map of the last search.
+ * @param left Returns the left lane segments.
+ * @param right Returns the right lane segments.
  * @return void
  */
-void* lane_follower(void* threadp)
+void lane_search(lane_track_t* track, lane_edges_t* edges_work, lane_hough_t* hough_work, const Mat& gray, const Mat& mask,
+	const uchar* lut, Mat& edges, vector<Vec4i>& left, vector<Vec4i>& right)
 {
-	//Variable Declaration
-	threadParams_t* threadParams = (threadParams_t*)threadp;
-	struct timespec start_time;
-	int frame_cnt = 0;
-	Mat src;
-	Mat src_half, contrast, mask;		
-	Mat detect_lanes, blur, edge;
-	Mat canny_roi;
-
-	
-	double slope;
-	int x1, x2, y1, y2;
-		
-	//Printing thread information 
-	threadcpu_info(threadParams);
-	
-	//Note Start time to calculate FPS
-   	clock_gettime(CLOCK_REALTIME, &start_time);
+	vector<lane_span_t> corridor;
+	vector<Vec4i> found[LANE_TRACK_LINES], other;
+	vector<Vec4i>* lanes[LANE_TRACK_LINES] = {&left, &right};
+	bool locked[LANE_TRACK_LINES];
+	long area = 0;
 
-	while(1)
+	for(int i=0; i<LANE_TRACK_LINES; i++)
 	{
-		sem_wait(&sem_lane);
-	
-	
-		src = g_frame.clone();
-		//Preprocess frames
-		src_half = preprocess(src);		
-		
-		//Return a contrast image
-		contrast = equalize(src_half);
-		
-		//Returns a mask to detect lanes
-		mask = create_mask(src_half);
-		  
-		
-		//Creating Polygon ROI
-		Point roi_pt[1][4];
-		int num = 4;
-
-		Mat roi_mask = Mat::zeros(Size(src_half.cols, src_half.rows), CV_8U);
-		//Points for ROI mask
-		roi_pt[0][0] = Point(2*src_half.cols/5, src_half.rows/5);			//Apex
-		roi_pt[0][1] = Point(3*src_half.cols/5, src_half.rows/5);
-		roi_pt[0][3] = Point(src_half.cols/5, src_half.rows);				//Bottom left vertice
-		roi_pt[0][2] = Point(4*src_half.cols/5 , src_half.rows);			//Bottomk right vertice
-		const Point* pts_list[1] = {roi_pt[0]};
-		fillPoly(roi_mask, pts_list, &num, 1, 255, 8);				//Change to fillConvexPolly for faster results
-	
-
-		//Detect lanes
-		vector<Vec4i> lines;
-		vector<Vec4i> left;
-		vector<Vec4i> right;
-		
-		bitwise_and(contrast, mask, detect_lanes);
-		//imshow("lanes Detected", detect_lanes);
-		
-		//Applying gaussian filter to reduce noise followed by canny transform for edge detection.
-		GaussianBlur( detect_lanes, blur, Size(5,5), 0, 0, BORDER_DEFAULT );
-		Canny(blur, edge, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2, 3, true);		//Can change to false for faster results. tradeoff: Accuracy.
-
-		bitwise_and(edge, roi_mask, canny_roi);
-		//imshow("Canny Mask", canny_roi);
-		
-		//Detect and Draw Lines
-		HoughLinesP(canny_roi, lines, 1, CV_PI/180, HOUGH_THRESHOLD, HOUGH_MIN_LINE_LENGTH, HOUGH_MAX_LINE_GAP );
-		for( size_t i = 0; i < lines.size(); i++ )
-		{
-			Vec4i l = lines[i];
-			
-			slope = (double)((l[3] - l[1])/(double)(l[2] - l[0]));
-			if (slope > 0.5)
-			{
-				right.push_back(lines[i]);
-			}				
-			else if (slope < (-0.5))
-			{
-				left.push_back(lines[i]);
-			}
-		}
-				
-		process_lanes(left, LEFT);
-		process_lanes(right, RIGHT);
-
-
-		frame_cnt++;
-
-		if((c == 27) || (exit_cond))
+		locked[i] = lane_track_corridor(track, i, edges_work->roi_span, corridor);
+		if(!locked[i])
+			continue;
+		lane_edges_spans(edges_work, corridor, LANE_TRACK_MARGIN);
+		lane_edges(edges_work, gray, mask, lut, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2, edges);
+		lane_hough(hough_work, edges, corridor, HOUGH_THRESHOLD, HOUGH_MIN_LINE_LENGTH, HOUGH_MAX_LINE_GAP,
+			(i == LANE_TRACK_LEFT) ? *lanes[i] : other, (i == LANE_TRACK_RIGHT) ? *lanes[i] : other);
+		area += lane_edges_area(edges_work);
+		other.clear();
+	}
+	if(!locked[LANE_TRACK_LEFT] || !locked[LANE_TRACK_RIGHT])
+	{
+		lane_edges_spans(edges_work, edges_work->roi_span, LANE_EDGES_SPAN_MARGIN);
+		lane_edges(edges_work, gray, mask, lut, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2, edges);
+		lane_hough(hough_work, edges, edges_work->roi_span, HOUGH_THRESHOLD, HOUGH_MIN_LINE_LENGTH, HOUGH_MAX_LINE_GAP,
+			found[LANE_TRACK_LEFT], found[LANE_TRACK_RIGHT]);
+		area += edges_work->roi_area;
+		for(int i=0; i<LANE_TRACK_LINES; i++)
 		{
-			break;
+			if(!locked[i])
+				lanes[i]->swap(found[i]);
 		}
-
 	}
-	
-	//Calculating FPS for lane detection
-	fps_calc(start_time, frame_cnt, FPS_LANE);
-	
-	pthread_exit(NULL);
+	else
+		track->corridor_frames++;
 
+	for(int i=0; i<LANE_TRACK_LINES; i++)
+	{
+		lane_track_update(track, i, *lanes[i]);
+	}
+	track->frames++;
+	track->coverage += (double)area/edges_work->roi_area;
 }
 
 
 /**
- * @brief Callback function for traffic signal detection thread.
- * @param threadp 
+ * @brief This function measures the FPS of the lane front end on the first frames of a video, with equalize() and
+ * create_mask() and with the single pass front end, and counts the pixels where they differ. Then it measures the
+ * edge map of the lane service made by full image passes and by lane_edges() over the ROI spans, and counts the edges
+ * where they differ. Then it measures HoughLinesP() against lane_hough() on the edge maps, the search of whole ROIs
+ * against the search of the corridors of the tracked lanes, and last the lanes published from the frames on, by the
+ * slope averaging and by the bird's-eye sliding windows.
+ * @param input The input video file.
  * @return void
  */
-void* sign_recog(void* threadp)
+void lane_benchmark(const char* input)
 {
-	//Variable Declaration
-	threadParams_t* threadParams = (threadParams_t*)threadp;
-	struct timespec start_time;
-	int frame_cnt = 0;	
-	Mat mat, resz_mat;
-	vector<Rect> local_traffic;
-	
-	CascadeClassifier cascade_traffic;
-	if(!cascade_traffic.load("./traffic_light.xml"))
-		handle_error("Error loading traffic light cascade")
-	
-	//Printing thread information 
-	threadcpu_info(threadParams);
-	
-	//Note Start time to calculate FPS
-   	clock_gettime(CLOCK_REALTIME, &start_time);
-
+	VideoCapture capture(input);
+	Mat frame, diff, gray, mask, blur, edge, roi;
+	uchar lut[256];
+	vector<Mat> frames, full;
+	vector<Mat> detect[2], edges[2];
+	lane_edges_t work;
+	lane_hough_t hough;
+	lane_track_t track[2];
+	struct timespec start_time, stop_time, diff_time;
+	double duration, fps[2];
+	unsigned long differ = 0, total = 0, inside = 0, canny = 0;
+	unsigned long segments[2][2];
+
+	while((frames.size() < LANE_BENCH_FRAMES) && capture.read(frame))
+	{
+		frames.push_back(preprocess(frame).clone());
+		full.push_back(frame.clone());
+	}
+	if(frames.empty())
+		handle_error("Error reading benchmark video")
 
-	while(1)
+	clock_gettime(CLOCK_REALTIME, &start_time);
+	lane_lut_start(&lane_lut);
+	for(int i=0; i<LANE_LUT_JOBS; i++)
+	{
+		lane_lut_jobs[i].lut = &lane_lut;
+		lane_lut_jobs[i].b0 = 256*i/LANE_LUT_JOBS;
+		lane_lut_jobs[i].b1 = 256*(i + 1)/LANE_LUT_JOBS;
+		lane_lut_job(&lane_lut_jobs[i]);
+	}
+	if(!lane_lut_finish(&lane_lut, lane_lut_jobs, LANE_LUT_JOBS))
+		handle_error("Lane colour table does not match cvtColor")
+	clock_gettime(CLOCK_REALTIME, &stop_time);
+	delta_t(&stop_time, &start_time, &diff_time);
+	cout << endl << "LANE BENCH Frames: " << frames.size() << ", colour table built in " << diff_time.tv_sec*1000.0 + diff_time.tv_nsec/1e6
+		<< " ms on one core, " << lane_lut.block.size()/LANE_LUT_WORDS << " of " << LANE_LUT_CELLS << " cells mixed" << endl;
+
+	//Mode 0 runs equalize() and create_mask(), mode 1 the single pass front end
+	for(int m=0; m<2; m++)
+	{
+		detect[m].resize(frames.size());
+		clock_gettime(CLOCK_REALTIME, &start_time);
+		for(size_t i=0; i<frames.size(); i++)
+		{
+			lane_front(frames[i], gray, mask, lut, m == 1);
+			lane_mask_apply(gray, mask, lut, detect[m][i]);
+		}
+		clock_gettime(CLOCK_REALTIME, &stop_time);
+		delta_t(&stop_time, &start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		fps[m] = frames.size()/duration;
+	}
+	for(size_t i=0; i<frames.size(); i++)
+	{
+		absdiff(detect[0][i], detect[1][i], diff);
+		differ += countNonZero(diff);
+		total += detect[0][i].total();
+	}
+	cout << "LANE BENCH front end (" << frames[0].cols << "x" << frames[0].rows << "): separate " << fps[0] << " FPS, fused " << fps[1]
+		<< " FPS, speedup " << fps[1]/fps[0] << ", " << differ << " of " << total << " pixels differ" << endl;
+
+	//Mode 0 masks, blurs, runs Canny() and masks with the ROI over whole images, mode 1 streams them with lane_edges()
+	//over the spans of the ROI
+	lane_roi(frames[0].size(), roi);
+	lane_edges_roi(&work, roi);
+	hough.rows = hough.cols = 0;
+	for(int m=0; m<2; m++)
+	{
+		edges[m].resize(frames.size());
+		clock_gettime(CLOCK_REALTIME, &start_time);
+		for(size_t i=0; i<frames.size(); i++)
+		{
+			lane_front(frames[i], gray, mask, lut, true);
+			if(m == 0)
+			{
+				lane_mask_apply(gray, mask, lut, detect[0][i]);
+				GaussianBlur(detect[0][i], blur, Size(5,5), 0, 0, BORDER_DEFAULT);
+				Canny(blur, edge, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2, 3, true);
+				bitwise_and(edge, roi, edges[m][i]);
+			}
+			else
+				lane_edges(&work, gray, mask, lut, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2, edges[m][i]);
+		}
+		clock_gettime(CLOCK_REALTIME, &stop_time);
+		delta_t(&stop_time, &start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		fps[m] = frames.size()/duration;
+	}
+	differ = 0;
+	total = 0;
+	for(size_t i=0; i<frames.size(); i++)
+	{
+		absdiff(edges[0][i], edges[1][i], diff);
+		differ += countNonZero(diff);
+		total += countNonZero(edges[0][i]);
+	}
+	for(int y=0; y<roi.rows; y++)
 	{
-		sem_wait(&sem_sign);
-		mat = g_frame.clone();
-		mat = mat(Rect(0, 0, mat.cols, mat.rows/2));
-		resize(mat, resz_mat, Size(mat.cols/2, mat.rows/2));
-//		cvtColor(mat, mat, CV_BGR2GRAY);
+		inside += work.span[LANE_SPAN_ROI][y].x1 - work.span[LANE_SPAN_ROI][y].x0;
+		canny += work.span[LANE_SPAN_SUPPRESS][y].x1 - work.span[LANE_SPAN_SUPPRESS][y].x0;
+	}
+	cout << "LANE BENCH edge map: full images " << fps[0] << " FPS, streamed " << fps[1] << " FPS, speedup " << fps[1]/fps[0]
+		<< ", " << differ << " pixels differ, " << total << " edges" << endl;
+	cout << "LANE BENCH ROI spans: " << inside << " of " << roi.total() << " pixels in the ROI, Canny on " << canny << endl;
 
-		cascade_traffic.detectMultiScale(resz_mat, local_traffic, 1.1, 2, 0 | CASCADE_SCALE_IMAGE, Size(4, 4), resz_mat.size()/* Size(30, 30)*/);
-//		cascade_traffic.detectMultiScale(resz_mat, local_traffic, 1.1, 3, CASCADE_DO_CANNY_PRUNING, Size(0, 0), resz_mat.size()/* Size(30, 30)*/);
-						
-		mute_sign.lock();
-		img_char.traffic.clear();
-		img_char.traffic = local_traffic;
-		mute_sign.unlock();
+	//Mode 0 runs HoughLinesP() and keeps the lane slopes, mode 1 votes only in the lane angles with lane_hough()
+	for(int m=0; m<2; m++)
+	{
+		segments[m][0] = segments[m][1] = 0;
+		clock_gettime(CLOCK_REALTIME, &start_time);
+		for(size_t i=0; i<frames.size(); i++)
+		{
+			vector<Vec4i> lines, left, right;
 
-		frame_cnt++;
+			if(m == 0)
+			{
+				HoughLinesP(edges[1][i], lines, 1, CV_PI/180, HOUGH_THRESHOLD, HOUGH_MIN_LINE_LENGTH, HOUGH_MAX_LINE_GAP);
+				for(size_t j=0; j<lines.size(); j++)
+				{
+					double slope = (double)((lines[j][3] - lines[j][1])/(double)(lines[j][2] - lines[j][0]));
+
+					if(slope > 0.5)
+						right.push_back(lines[j]);
+					else if(slope < (-0.5))
+						left.push_back(lines[j]);
+				}
+			}
+			else
+				lane_hough(&hough, edges[1][i], work.span[LANE_SPAN_ROI], HOUGH_THRESHOLD, HOUGH_MIN_LINE_LENGTH, HOUGH_MAX_LINE_GAP,
+					left, right);
+			segments[m][0] += left.size();
+			segments[m][1] += right.size();
+		}
+		clock_gettime(CLOCK_REALTIME, &stop_time);
+		delta_t(&stop_time, &start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		fps[m] = frames.size()/duration;
+	}
+	cout << "LANE BENCH Hough: all angles " << fps[0] << " FPS (" << segments[0][0] << " left, " << segments[0][1] << " right segments), lane angles "
+		<< fps[1] << " FPS (" << segments[1][0] << " left, " << segments[1][1] << " right segments), speedup " << fps[1]/fps[0] << endl;
 
-		if((c == 27) || (exit_cond))
+	//Mode 0 searches every frame in the whole ROI, mode 1 tracks the lanes and searches their corridors
+	for(int m=0; m<2; m++)
+	{
+		segments[m][0] = segments[m][1] = 0;
+		lane_track_init(&track[m]);
+		clock_gettime(CLOCK_REALTIME, &start_time);
+		for(size_t i=0; i<frames.size(); i++)
 		{
-			break;
+			vector<Vec4i> left, right;
+
+			if(m == 0)
+				lane_track_init(&track[m]);
+			lane_front(frames[i], gray, mask, lut, true);
+			lane_search(&track[m], &work, &hough, gray, mask, lut, edge, left, right);
+			segments[m][0] += left.size();
+			segments[m][1] += right.size();
 		}
+		clock_gettime(CLOCK_REALTIME, &stop_time);
+		delta_t(&stop_time, &start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		fps[m] = frames.size()/duration;
 	}
-	
-	//Calculating FPS for sign detection
-	fps_calc(start_time, frame_cnt, FPS_SIGN);
+	cout << "LANE BENCH tracking: ROI " << fps[0] << " FPS (" << segments[0][0] << " left, " << segments[0][1] << " right segments), corridors "
+		<< fps[1] << " FPS (" << segments[1][0] << " left, " << segments[1][1] << " right segments), speedup " << fps[1]/fps[0] << endl;
+	lane_track_report(&track[1], 0);
+
+	//Mode 0 runs preprocess() and the tracked search with the slope averaging of process_lanes(), mode 1 warps the frame
+	//to the bird's-eye view and fits the lanes with sliding windows. Jitter is the mean move of a lane bottom between
+	//frames it is found on.
+	for(int m=0; m<2; m++)
+	{
+		lane_state_t ls;
+		lane_ipm_t ipm;
+		Vec4i prev[2];
+		unsigned long found = 0, moves = 0;
+		double jitter = 0;
+
+		lane_state_init(&ls);
+		lane_track_init(&track[0]);
+		clock_gettime(CLOCK_REALTIME, &start_time);
+		for(size_t i=0; i<full.size(); i++)
+		{
+			vector<Vec4i> left, right;
+			Vec4i* out[2] = {&ls.lane_out.g_left, &ls.lane_out.g_right};
 
-	pthread_exit(NULL);
+			if(m == 0)
+			{
+				Mat half = preprocess(full[i]);
 
+				lane_front(half, gray, mask, lut, true);
+				lane_search(&track[0], &work, &hough, gray, mask, lut, edge, left, right);
+				process_lanes(&ls, left, LEFT);
+				process_lanes(&ls, right, RIGHT);
+			}
+			else
+			{
+				lane_ipm_tables(&ipm, full[i].size());
+				lane_ipm_warp(&ipm, full[i], diff);
+				lane_front(diff, gray, mask, lut, true);
+				lane_ipm_find(mask, ls.ipm);
+				lane_ipm_segment(&ipm, &ls.ipm[LANE_TRACK_LEFT], ls.lane_out.g_left);
+				lane_ipm_segment(&ipm, &ls.ipm[LANE_TRACK_RIGHT], ls.lane_out.g_right);
+			}
+			for(int k=0; k<2; k++)
+			{
+				if(!(*out[k])[3])
+					continue;
+				found++;
+				if(prev[k][3])
+				{
+					jitter += abs((*out[k])[2] - prev[k][2]);
+					moves++;
+				}
+			}
+			prev[0] = *out[0];
+			prev[1] = *out[1];
+		}
+		clock_gettime(CLOCK_REALTIME, &stop_time);
+		delta_t(&stop_time, &start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		fps[m] = full.size()/duration;
+		cout << (m ? "LANE BENCH bird's-eye: " : "LANE BENCH slope averaging: ") << fps[m] << " FPS, " << found << " of " << 2*full.size()
+			<< " lanes published, jitter " << (moves ? jitter/moves : 0.0) << " px" << endl;
+	}
+	cout << "LANE BENCH bird's-eye speedup " << fps[1]/fps[0] << endl;
 }
 
 
 /**
- * @brief Callback function for vehicle detection thread.
- * @param threadp 
+ * @brief This function measures the FPS of the vehicle and sign searches on the first frames of a video, with
+ * CascadeClassifier and with the cascades compiled into the program, and the share of the CascadeClassifier
+ * detections found by the compiled cascades, then the FPS of the compiled cascades sweeping the vehicles and the
+ * signs of a frame separately and together. The frames are prepared as the services do.
+ * @param input The input video file.
  * @return void
  */
-void* vehicle_detect(void* threadp)
+void cascade_benchmark(const char* input)
 {
-	//Variable Declaration
-	threadParams_t* threadParams = (threadParams_t*)threadp;
-	struct timespec start_time;
-	int frame_cnt = 0;
-	Mat src, src_half, gray, blur;
-	vector<Rect> local_vehicle_loc;
-
-	
-	//Printing thread information 
-	threadcpu_info(threadParams);
-
-	//Note Start time to calculate FPS
-   	clock_gettime(CLOCK_REALTIME, &start_time);
-
-	while(1)
+	VideoCapture capture(input);
+	Mat frame, half;
+	vector<Mat> frames[2], halves;
+	vector< vector<Rect> > found[2][2];
+	vector<Rect> vehicles, signs;
+	cascade_work_t work;
+	struct timespec start_time, stop_time, diff_time;
+	double duration, fps[2];
+	unsigned long hits[2], matched, ref_total, test_total;
+	const char* names[2] = {"vehicle", "sign"};
+	const int models[2] = {CASCADE_CARS, CASCADE_TRAFFIC};
+
+	while((frames[0].size() < CASCADE_BENCH_FRAMES) && capture.read(frame))
 	{
-		sem_wait(&sem_vehicle);
-		
-		src = g_frame.clone();
-		
-		src_half = preprocess(src);
-		cvtColor(src_half, gray, CV_RGB2GRAY);
-
-		vehicle_cascade.detectMultiScale(gray, local_vehicle_loc, 1.2, 4, 0, Size(16, 16), gray.size());
-
-		mute_vehicle.lock();
-		img_char.vehicle_loc.clear();
-		img_char.vehicle_loc = local_vehicle_loc;
-		mute_vehicle.unlock();
-		
-		frame_cnt++;
-
-		
-		if((c == 27) || (exit_cond))
+		cvtColor(preprocess(frame), half, CV_RGB2GRAY);
+		frames[0].push_back(half.clone());
+		resize(frame(Rect(0, 0, frame.cols, frame.rows/2)), half, Size(frame.cols/2, frame.rows/4));
+		frames[1].push_back(half.clone());
+		resize(frame, half, Size(frame.cols/2, frame.rows/2));
+		halves.push_back(half.clone());
+	}
+	if(frames[0].empty())
+		handle_error("Error reading benchmark video")
+	if(!traffic_cascade.load(service_models[MODEL_TRAFFIC].xml) || !stop_cascade.load(service_models[MODEL_STOP].xml) ||
+		!vehicle_cascade.load(service_models[MODEL_VEHICLE].xml))
+		handle_error("Error loading cascades")
+
+	cout << endl << "CASCADE BENCH Frames: " << frames[0].size() << endl;
+	for(int c=0; c<2; c++)
+	{
+		//Mode 0 runs CascadeClassifier, mode 1 the compiled cascade
+		for(int m=0; m<2; m++)
 		{
-			break;
+			cascade_compiled = (m == 1);
+			hits[m] = 0;
+			found[c][m].resize(frames[c].size());
+			clock_gettime(CLOCK_REALTIME, &start_time);
+			for(size_t i=0; i<frames[c].size(); i++)
+			{
+				if(c == 0)
+					vehicle_search(frames[c][i], found[c][m][i]);
+				else
+					sign_search(frames[c][i], found[c][m][i]);
+				hits[m] += found[c][m][i].size();
+			}
+			clock_gettime(CLOCK_REALTIME, &stop_time);
+			delta_t(&stop_time, &start_time, &diff_time);
+			duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+			fps[m] = frames[c].size()/duration;
 		}
+		ped_bench_match(found[c][0], found[c][1], &matched, &ref_total, &test_total);
+		cout << "CASCADE BENCH " << names[c] << " (" << cascade_name(models[c]) << ", " << frames[c][0].cols << "x" << frames[c][0].rows << "): CascadeClassifier "
+			<< fps[0] << " FPS, " << hits[0] << " detections; compiled " << fps[1] << " FPS, " << hits[1] << " detections, speedup "
+			<< fps[1]/fps[0] << ", recall " << (ref_total ? (double)matched/ref_total : 1.0) << " (" << matched << " of " << ref_total << ")" << endl;
 	}
-	
-	//Calculating FPS for sign detection
-	fps_calc(start_time, frame_cnt, FPS_VEHICLE);
-
-	pthread_exit(NULL);
+	cascade_compiled = false;
 
+	//Mode 0 sweeps the vehicles and the signs separately, as their own jobs do, mode 1 together, as a vehicle job
+	//serving a handed off sign release does
+	if(!cascade_supports(halves[0]))
+		return;
+	for(int m=0; m<2; m++)
+	{
+		clock_gettime(CLOCK_REALTIME, &start_time);
+		for(size_t i=0; i<halves.size(); i++)
+		{
+			if(m == 0)
+			{
+				cascade_sweep(NULL, &work, halves[i], i + 1, &vehicles, NULL);
+				cascade_sweep(NULL, &work, halves[i].rowRange(0, halves[i].rows/2), i + 1, NULL, &signs);
+			}
+			else
+				cascade_sweep(NULL, &work, halves[i], i + 1, &vehicles, &signs);
+		}
+		clock_gettime(CLOCK_REALTIME, &stop_time);
+		delta_t(&stop_time, &start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		fps[m] = halves.size()/duration;
+	}
+	cout << "CASCADE BENCH sweep (" << halves[0].cols << "x" << halves[0].rows << "): separate " << fps[0] << " FPS, shared "
+		<< fps[1] << " FPS, speedup " << fps[1]/fps[0] << endl;
 }
 
 
-
-
 /**
- * @brief This function creates semaphores for the required threads.
- * @param void
+ * @brief Worker pool job of the pedestrian benchmark. Runs the parallel detector on every frame.
+ * @param arg The ped_bench_t.
  * @return void
  */
-void sem_create(void)
+void ped_bench_job(void* arg)
 {
-	//Initializing Semaphores
-	if(sem_init(&sem_main, 0, 0) == -1)
-		handle_error("ERROR: sem_init for sem_main");
-	if(sem_init(&sem_pedestrian, 0, 0) == -1)
-		handle_error("ERROR: sem_init for sem_pedestrian");
-	if(sem_init(&sem_lane, 0, 0) == -1)
-		handle_error("ERROR: sem_init for sem_lane");
-	if(sem_init(&sem_vehicle, 0, 0) == -1)
-		handle_error("ERROR: sem_init for sem_vehicle");
-	if(sem_init(&sem_sign, 0, 0) == -1)
-		handle_error("ERROR: sem_init for sem_sign");	
+	ped_bench_t* bench = (ped_bench_t*)arg;
+
+	for(size_t i=0; i<bench->frames.size(); i++)
+	{
+		hog_detect_parallel(&pool, 0, &hog, bench->eng, bench->approx, bench->frames[i], bench->found[i], 0, Size(8, 8), 1.05, 2);
+		bench->hits += bench->found[i].size();
+	}
 }
 
 
 /**
- * @brief This function sets core affinity to individual required services.
- * @param void
+ * @brief This function matches the detections of a benchmark run to those of a reference run, frame by frame. A
+ * detection matches the first unmatched reference detection it overlaps with an intersection over union of 0.5 or more.
+ * @param ref The reference detections of every frame.
+ * @param test The detections of every frame compared to the reference.
+ * @param matched Returns the number of matched reference detections.
+ * @param ref_total Returns the number of reference detections.
+ * @param test_total Returns the number of compared detections.
  * @return void
  */
-void thread_core_set(void)
+void ped_bench_match(const vector< vector<Rect> >& ref, const vector< vector<Rect> >& test, unsigned long* matched,
+	unsigned long* ref_total, unsigned long* test_total)
 {
-	int config_Processors = get_nprocs_conf();
-	cpu_set_t allcpuset;
-	cpu_set_t threadcpu;
-	
-	cout << "This system has " << config_Processors << " processors configured and " << get_nprocs() << " processors available" << endl << endl;
-	
-	
-	CPU_ZERO(&threadcpu);
-	CPU_SET(1, &threadcpu);
-	CPU_SET(2, &threadcpu);
-	CPU_SET(3, &threadcpu);
-	
-	for(int i=0; i < NUM_THREADS; i++)
+	*matched = *ref_total = *test_total = 0;
+	for(size_t i=0; (i<ref.size()) && (i<test.size()); i++)
 	{
-		int rc;
-		
-		cout << "Setting thread " << i << endl;
+		vector<bool> used(ref[i].size(), false);
 
-		for(int idx=0; idx<config_Processors; idx++)
+		*ref_total += ref[i].size();
+		*test_total += test[i].size();
+		for(size_t j=0; j<test[i].size(); j++)
 		{
-			if(CPU_ISSET(idx, &threadcpu))  
+			for(size_t k=0; k<ref[i].size(); k++)
 			{
-				cout << " CPU-" << idx << endl;
+				double inter = (ref[i][k] & test[i][j]).area();
+
+				if(!used[k] && (inter >= PED_BENCH_IOU*(ref[i][k].area() + test[i][j].area() - inter)))
+				{
+					used[k] = true;
+					(*matched)++;
+					break;
+				}
 			}
 		}
-
-		cout << "Launching thread " << i << endl << endl;
-
-		rc=pthread_attr_init(&rt_sched_attr[i]);
-		rc=pthread_attr_setaffinity_np(&rt_sched_attr[i], sizeof(cpu_set_t), &threadcpu);
-
-		threadParams[i].threadIdx=i;
 	}
 }
 
 
 /**
- * @brief This function creates threads for the required services.
- * @param void
- * @return void
+ * @brief This function releases a service on a frame of a stream and queues a job for it unless one is pending.
+ * Should the pool refuse the job, the frame stays in the queue of the service, under its policy, until a later release
+ * queues the job.
+ * @param svc The service.
+ * @param slot The published frame.
+ * @param st The stream the frame belongs to.
+ * @param flags The release flags given to the job, 0 for none.
+ * @return true if the frame was queued, false if the release was skipped or joined the service's release on the frame.
  */
-void thread_create(void)
+bool service_release(service_t* svc, frame_slot_t* slot, stream_t* st, unsigned flags)
 {
+	bool queued;
 
-	//Pedestrian Detection Thread
-	if(enable[PED_DETECT_TH])
-	{
-		rt_param[0].sched_priority=rt_max_prio-2;
-		pthread_attr_setschedparam(&rt_sched_attr[0], &rt_param[0]);
-		pthread_create(&threads[PED_DETECT_TH],   				// pointer to thread descriptor
-				(pthread_attr_t*)&(rt_sched_attr[PED_DETECT_TH]),     	// use default attributes
-				pedestrian_detect, 					// thread function entry point
-				(void *)&(threadParams[PED_DETECT_TH]) 			// parameters to pass in
-			      );
-	}
-
-	//Lane Detection Thread
-	if(enable[LANE_FOLLOW_TH])
-	{
-	rt_param[1].sched_priority=rt_max_prio-2;
-	pthread_attr_setschedparam(&rt_sched_attr[1], &rt_param[1]);
-	pthread_create(&threads[LANE_FOLLOW_TH],   					// pointer to thread descriptor
-			(pthread_attr_t*)&(rt_sched_attr[LANE_FOLLOW_TH]),     		// use default attributes
-			lane_follower, 							// thread function entry point
-			(void *)&(threadParams[LANE_FOLLOW_TH]) 			// parameters to pass in
-		      );
-	}
-
-	//Sign Detection Thread
-	if(enable[SIGN_RECOG_TH])
-	{
-	rt_param[2].sched_priority=rt_max_prio-2;
-	pthread_attr_setschedparam(&rt_sched_attr[2], &rt_param[2]);
-	pthread_create(&threads[SIGN_RECOG_TH],   					// pointer to thread descriptor
-			(pthread_attr_t*)&(rt_sched_attr[SIGN_RECOG_TH]),     		// use default attributes
-			sign_recog, 							// thread function entry point
-			(void *)&(threadParams[SIGN_RECOG_TH]) 				// parameters to pass in
-		      );
-	}
-
-	//Vehicle Detection Thread
-	if(enable[VEH_DETECT_TH])
+	if(motion_gating)
+		stream_motion_release(st, svc - svc_table, slot->seq);
+	queued = dispatch_release(svc->queue, slot, st, flags);
+	if((__atomic_exchange_n(&svc->active, 1, __ATOMIC_SEQ_CST) == 0) && !wp_submit(&pool, svc->level, service_run, (void*)svc, NULL))
 	{
-	rt_param[3].sched_priority=rt_max_prio-2;
-	pthread_attr_setschedparam(&rt_sched_attr[3], &rt_param[3]);
-	pthread_create(&threads[VEH_DETECT_TH],   					// pointer to thread descriptor
-			(pthread_attr_t*)&(rt_sched_attr[VEH_DETECT_TH]),     		// use default attributes
-			vehicle_detect, 						// thread function entry point
-			(void *)&(threadParams[VEH_DETECT_TH]) 				// parameters to pass in
-		      );
+		__atomic_store_n(&svc->active, 0, __ATOMIC_SEQ_CST);
 	}
+	return queued;
 }
 
 
 /**
- * @brief This function prints individual thread CPU information.
- * @param threadParams The parameter passed while creating pthread.
+ * @brief Worker pool job of a service. Runs the service on the oldest frame in its queue, then queues itself again
+ * if frames are left, so that higher priority jobs are picked in between frames. One job per service at most exists.
+ * @param arg The service.
  * @return void
  */
-void threadcpu_info(threadParams_t* threadParams)
+void service_run(void* arg)
 {
-	cpu_set_t cpuset;
-	CPU_ZERO(&cpuset);
-	pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-	cout << "Thread " << threadParams->threadIdx << " initialized" << endl;
-	cout << "Thread idx=" << threadParams->threadIdx << " running on core " << sched_getcpu() << ", affinity contained:";
-	for(int i=0; i<get_nprocs_conf(); i++)
-	{
-		if(CPU_ISSET(i, &cpuset))
-		{
-			cout << " CPU-" << i;
-		}
+	service_t* svc = (service_t*)arg;
+	frame_slot_t* frame;
+	void* ctx;
+	unsigned flags;
+
+	frame = dispatch_try_take(svc->queue, &ctx, &flags);
+	if(frame != NULL)
+	{
+		svc->job(frame, ctx, flags);
+	}
+
+	if((dispatch_count(svc->queue) > 0) && wp_submit(&pool, svc->level, service_run, arg, NULL))
+		return;
+
+	//A release may have queued a frame after the queue was found empty and before the flag is cleared. Frames left
+	//because the pool refused the job wait for the next release.
+	__atomic_store_n(&svc->active, 0, __ATOMIC_SEQ_CST);
+	if((dispatch_count(svc->queue) > 0) && (__atomic_exchange_n(&svc->active, 1, __ATOMIC_SEQ_CST) == 0) &&
+		!wp_submit(&pool, svc->level, service_run, arg, NULL))
+	{
+		__atomic_store_n(&svc->active, 0, __ATOMIC_SEQ_CST);
 	}
-	cout << " with PID = " << syscall(SYS_gettid) << endl;
 }
 
 
 /**
- * @brief This function sets the thread attributes and its priority.
- * @param void 
+ * @brief This function creates the dispatch queues of the services, as configured in the service table.
+ * @param void
  * @return void
  */
-void set_thread_attr(void)
+void dispatch_create_all(void)
 {
-	int i, rc;
-	
-	for(i=0; i < NUM_THREADS; i++)
+	for(int i=0; i<NUM_THREADS; i++)
 	{
-
-		rc=pthread_attr_init(&rt_sched_attr[i]);
-		rc=pthread_attr_setinheritsched(&rt_sched_attr[i], PTHREAD_EXPLICIT_SCHED);
-		rc=pthread_attr_setschedpolicy(&rt_sched_attr[i], SCHED_FIFO);
-		//rc=pthread_attr_setaffinity_np(&rt_sched_attr[i], sizeof(cpu_set_t), &threadcpu);
-		pthread_attr_setscope(&rt_sched_attr[i], PTHREAD_SCOPE_SYSTEM);
-
-		rt_param[i].sched_priority=rt_max_prio-2;
-		pthread_attr_setschedparam(&rt_sched_attr[i], &rt_param[i]);
-
-		threadParams[i].threadIdx=i;
+		//No assigned frame may be skipped in headless mode
+		if(headless)
+			svc_table[i].policy = DISPATCH_BLOCK;
+		dispatch_init(svc_table[i].queue, svc_table[i].depth, svc_table[i].policy);
 	}
 }
 
@@ -734,11 +1882,12 @@ void fps_calc(struct timespec start_time, int frame_cnt, uint8_t fps_thread)
 			cout << endl << "OVERALL FPS:" << endl;
 			cout << "OVERALL Number of frames: "<< frame_cnt << endl;
 			cout << "OVERALL Duration: "<< diff_time.tv_sec << endl;
-			cout << "OVERALL Average FPS: " << (frame_cnt/diff_time.tv_sec) << endl;
-			sem_post(&sem_pedestrian);
-			sem_post(&sem_lane);
-			sem_post(&sem_vehicle);
-			sem_post(&sem_sign);
+			cout << "OVERALL Average FPS: " << (frame_cnt/(diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC)) << endl;
+			//No release is accepted past this point
+			for(int i=0; i<NUM_THREADS; i++)
+			{
+				dispatch_close(&svc_queue[i]);
+			}
 
 			break;
 		}
@@ -750,7 +1899,7 @@ void fps_calc(struct timespec start_time, int frame_cnt, uint8_t fps_thread)
 			cout << endl << "PEDESTRIAN FPS:" << endl;
 			cout << "PEDESTRIAN Number of frames: "<< frame_cnt << endl;
 			cout << "PEDESTRIAN Duration: "<< diff_time.tv_sec << endl;
-			cout << "PEDESTRIAN Average FPS: " << (frame_cnt/diff_time.tv_sec) << endl;
+			cout << "PEDESTRIAN Average FPS: " << (frame_cnt/(diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC)) << endl;
 			break;
 		}
 		
@@ -761,7 +1910,7 @@ void fps_calc(struct timespec start_time, int frame_cnt, uint8_t fps_thread)
 			cout << endl << "LANE FPS:" << endl;
 			cout << "LANE Number of frames: "<< frame_cnt << endl;
 			cout << "LANE Duration: "<< diff_time.tv_sec << endl;
-			cout << "LANE Average FPS: " << (frame_cnt/diff_time.tv_sec) << endl;
+			cout << "LANE Average FPS: " << (frame_cnt/(diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC)) << endl;
 			break;
 		}
 		
@@ -772,7 +1921,7 @@ void fps_calc(struct timespec start_time, int frame_cnt, uint8_t fps_thread)
 			cout << endl << "VEHICLE FPS:" << endl;
 			cout << "VEHICLE Number of frames: "<< frame_cnt << endl;
 			cout << "VEHICLE Duration: "<< diff_time.tv_sec << endl;
-			cout << "VEHICLE Average FPS: " << (frame_cnt/diff_time.tv_sec) << endl;
+			cout << "VEHICLE Average FPS: " << (frame_cnt/(diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC)) << endl;
 			break;
 		}
 		
@@ -783,7 +1932,7 @@ void fps_calc(struct timespec start_time, int frame_cnt, uint8_t fps_thread)
 			cout << endl << "SIGN FPS:" << endl;
 			cout << "SIGN Number of frames: "<< frame_cnt << endl;
 			cout << "SIGN Duration: "<< diff_time.tv_sec << endl;
-			cout << "SIGN Average FPS: " << (frame_cnt/diff_time.tv_sec) << endl;
+			cout << "SIGN Average FPS: " << (frame_cnt/(diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC)) << endl;
 			break;
 		}
 	}
@@ -791,15 +1940,152 @@ void fps_calc(struct timespec start_time, int frame_cnt, uint8_t fps_thread)
 
 
 /**
- * @brief This function destroys the created semaphores.
+ * @brief This function initializes the triple buffers used by the services to publish the results of a stream.
+ * @param img_char The result buffers of the stream.
+ * @return void
+ */
+void result_buffers_init(struct img_cooordinates* img_char)
+{
+	tb_init(&img_char->found_loc);
+	tb_init(&img_char->vehicle_loc);
+	tb_init(&img_char->traffic);
+	tb_init(&img_char->lanes);
+}
+
+
+/**
+ * @brief This function resets the lane averaging history of a stream.
+ * @param ls The lane history.
+ * @return void
+ */
+void lane_state_init(lane_state_t* ls)
+{
+	*ls = lane_state_t();
+	lane_track_init(&ls->track);
+	ls->count_left = 1;
+	ls->ytop_left = 180;
+	ls->count_right = 1;
+	ls->ytop_right = 180;
+}
+
+
+/**
+ * @brief This function copies detections into a triple buffer and publishes them. Does not allocate outside replay mode.
+ * @param st The stream the frame belongs to.
+ * @param svc The service index, e.g. PED_DETECT_TH. Used for the replay log.
+ * @param tb The triple buffer of the service.
+ * @param loc The detections returned by the detector. Truncated to MAX_DETECTIONS.
+ * @param seq The sequence number of the frame the detections belong to.
+ * @return void
+ */
+void publish_detections(stream_t* st, int svc, triple_buffer_t<det_result_t>* tb, const vector<Rect>& loc, uint64_t seq)
+{
+	det_result_t res;
+	
+	res.seq = seq;
+	res.count = (loc.size() < MAX_DETECTIONS) ? loc.size() : MAX_DETECTIONS;
+	for(int i=0; i<res.count; i++)
+	{
+		res.loc[i] = loc[i];
+	}
+	tb_write(tb, res);
+	
+	if(replay)
+		results_log_det(st->id, svc, svc_table[svc].name, &res);
+}
+
+
+/**
+ * @brief This function prints the aggregate throughput of the pipeline, used as a benchmark in headless mode.
+ * @param start_time The time the sequencer started.
+ * @param frame_cnt The number of frames decoded.
+ * @return void
+ */
+void throughput_report(struct timespec start_time, int frame_cnt)
+{
+	struct timespec stop_time, diff_time;
+	double duration;
+	int svc_total = 0;
+	
+	clock_gettime(CLOCK_REALTIME, &stop_time);
+	delta_t(&stop_time, &start_time, &diff_time);
+	duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+	
+	for(int i=0; i<NUM_THREADS; i++)
+	{
+		svc_total += svc_frame_cnt[i];
+	}
+	
+	cout << endl << "THROUGHPUT:" << endl;
+	cout << "THROUGHPUT Frames decoded: " << frame_cnt << endl;
+	cout << "THROUGHPUT Service frames processed: " << svc_total << endl;
+	cout << "THROUGHPUT Duration: " << duration << endl;
+	cout << "THROUGHPUT Pipeline FPS: " << frame_cnt/duration << endl;
+	cout << "THROUGHPUT Service frames per second: " << svc_total/duration << endl;
+}
+
+
+/**
+ * @brief This function prints the FPS of every stream and the aggregate FPS over all streams.
+ * @param start_time The time the sequencers were started.
+ * @return void
+ */
+void stream_report(struct timespec start_time)
+{
+	struct timespec stop_time, diff_time;
+	double duration;
+	int total = 0;
+
+	stop_time = start_time;
+	for(int i=0; i<num_streams; i++)
+	{
+		delta_t(&streams[i].stop_time, &streams[i].start_time, &diff_time);
+		duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+		cout << endl << "STREAM " << i << " " << streams[i].input << " -> " << streams[i].output << endl;
+		cout << "STREAM " << i << " Number of frames: " << streams[i].frame_cnt << endl;
+		cout << "STREAM " << i << " Duration: " << duration << endl;
+		cout << "STREAM " << i << " Average FPS: " << streams[i].frame_cnt/duration << endl;
+		for(int j=0; (j<NUM_THREADS) && tracking; j++)
+		{
+			if(enable[j] && (j != LANE_FOLLOW_TH))
+				tracker_report(&streams[i].tracker[j], i, svc_table[j].name);
+		}
+		for(int j=0; (j<NUM_THREADS) && motion_gating; j++)
+		{
+			if(enable[j] && (j != LANE_FOLLOW_TH))
+				motion_report(&streams[i].motion, j, i, svc_table[j].name);
+		}
+		if(enable[LANE_FOLLOW_TH] && !lane_ipm)
+			lane_track_report(&streams[i].lane.track, i);
+		frame_ring_report(&streams[i].ring, i);
+
+		total += streams[i].frame_cnt;
+		if((streams[i].stop_time.tv_sec > stop_time.tv_sec) ||
+			((streams[i].stop_time.tv_sec == stop_time.tv_sec) && (streams[i].stop_time.tv_nsec > stop_time.tv_nsec)))
+			stop_time = streams[i].stop_time;
+	}
+
+	//Until the last stream finished
+	delta_t(&stop_time, &start_time, &diff_time);
+	duration = diff_time.tv_sec + (double)diff_time.tv_nsec/NSEC_PER_SEC;
+	cout << endl << "AGGREGATE Streams: " << num_streams << endl;
+	cout << "AGGREGATE Number of frames: " << total << endl;
+	cout << "AGGREGATE Duration: " << duration << endl;
+	cout << "AGGREGATE FPS: " << total/duration << endl;
+}
+
+
+/**
+ * @brief This function destroys the dispatch queues.
  * @param void
  * @return void
  */
-void sem_destroy_all(void)
+void dispatch_destroy_all(void)
 {
-	sem_destroy(&sem_main);
-	sem_destroy(&sem_pedestrian);
-	sem_destroy(&sem_lane);
+	for(int i=0; i<NUM_THREADS; i++)
+	{
+		dispatch_destroy(&svc_queue[i]);
+	}
 }
 
 
@@ -888,11 +2174,12 @@ Mat create_mask(Mat src_half)
 
 /**
  * @brief Function to process and get coordinates for left and right lane.
+ * @param ls The lane history of the stream the lanes were detected in.
  * @param lane The lane vector obtained from HoughlinesP.
  * @param side The macro LEFT or RIGHT which specifies the coordinates the lane vector belongs to. 
  * @return void
  */
-void process_lanes(vector<Vec4i> lane, int side)
+void process_lanes(lane_state_t* ls, vector<Vec4i> lane, int side)
 {
 
 	//Reset Coordinates
@@ -906,25 +2193,23 @@ void process_lanes(vector<Vec4i> lane, int side)
 	{
 		if(lane.size() == 0)
 		{
-			avg_slope_left = 0;
-			avg_intercept_left = 0;
-			count_left = 1;
-			nolane_count_left++;
-			if(nolane_count_left > 10)
+			ls->avg_slope_left = 0;
+			ls->avg_intercept_left = 0;
+			ls->count_left = 1;
+			ls->nolane_count_left++;
+			if(ls->nolane_count_left > 10)
 			{
-				mute_lane.lock();
-				img_char.g_left[0] = 0;
-				img_char.g_left[1] = 0;
-				img_char.g_left[2] = 0;
-				img_char.g_left[3] = 0;
-				nolane_count_left = 0;
-				mute_lane.unlock(); 
+				ls->lane_out.g_left[0] = 0;
+				ls->lane_out.g_left[1] = 0;
+				ls->lane_out.g_left[2] = 0;
+				ls->lane_out.g_left[3] = 0;
+				ls->nolane_count_left = 0;
 			}
 			return;
 		}
 		
 		//Resetting the count for no left lanes detected
-		nolane_count_left = 0;
+		ls->nolane_count_left = 0;
 		
 		for( size_t i = 0; i < lane.size(); i++ )
 		{
@@ -955,59 +2240,55 @@ void process_lanes(vector<Vec4i> lane, int side)
 		intercept = (double)y2 - (double)(slope*x2);		
 		
 		//Assigning the maximum and minimum values for left lane detected in y direction to draw lines.
-		if(ybottom_left < y1)
+		if(ls->ybottom_left < y1)
 		{
-			ybottom_left = y1;
+			ls->ybottom_left = y1;
 		}
-		if(ytop_left > y2)
+		if(ls->ytop_left > y2)
 		{
-			ytop_left = y2;
+			ls->ytop_left = y2;
 		}
 		
 		
 		if(slope < (-0.5))
 		{
 			//Averaging slope and intercept with history to get consistent results.
-			avg_slope_left = avg_slope_left + (double)(slope - avg_slope_left)/count_left;
-			avg_intercept_left = avg_intercept_left + (double)(intercept - avg_intercept_left)/count_left;
+			ls->avg_slope_left = ls->avg_slope_left + (double)(slope - ls->avg_slope_left)/ls->count_left;
+			ls->avg_intercept_left = ls->avg_intercept_left + (double)(intercept - ls->avg_intercept_left)/ls->count_left;
 			
 			//Finding corresponding x-coordinates
-			xtop = (ytop_left - avg_intercept_left)/avg_slope_left;
-			xbottom = (ybottom_left - avg_intercept_left)/avg_slope_left;
+			xtop = (ls->ytop_left - ls->avg_intercept_left)/ls->avg_slope_left;
+			xbottom = (ls->ybottom_left - ls->avg_intercept_left)/ls->avg_slope_left;
 						
-			count_left++;			
+			ls->count_left++;			
 		
-			mute_lane.lock();
-			img_char.g_left[0] = (int)xtop;
-			img_char.g_left[1] = (int)ytop_left;
-			img_char.g_left[2] = (int)xbottom;
-			img_char.g_left[3] = (int)ybottom_left;
-			mute_lane.unlock();
+			ls->lane_out.g_left[0] = (int)xtop;
+			ls->lane_out.g_left[1] = (int)ls->ytop_left;
+			ls->lane_out.g_left[2] = (int)xbottom;
+			ls->lane_out.g_left[3] = (int)ls->ybottom_left;
 		}
 	}
 	else if(side == RIGHT)
 	{
 		if(lane.size() == 0)
 		{
-			avg_slope_right = 0;
-			avg_intercept_right = 0;
-			count_right = 1;
-			nolane_count_right++;
-			if(nolane_count_right > 10)
+			ls->avg_slope_right = 0;
+			ls->avg_intercept_right = 0;
+			ls->count_right = 1;
+			ls->nolane_count_right++;
+			if(ls->nolane_count_right > 10)
 			{
-				mute_lane.lock();
-				img_char.g_right[0] = 0;
-				img_char.g_right[1] = 0;
-				img_char.g_right[2] = 0;
-				img_char.g_right[3] = 0;
-				nolane_count_right = 0;
-				mute_lane.unlock();
+				ls->lane_out.g_right[0] = 0;
+				ls->lane_out.g_right[1] = 0;
+				ls->lane_out.g_right[2] = 0;
+				ls->lane_out.g_right[3] = 0;
+				ls->nolane_count_right = 0;
 			}
 			return;
 		}
 
 		//Resetting the count for no right lanes detected
-		nolane_count_right = 0;		
+		ls->nolane_count_right = 0;		
 
 		for( size_t i = 0; i < lane.size(); i++ )
 		{
@@ -1037,34 +2318,32 @@ void process_lanes(vector<Vec4i> lane, int side)
 		intercept = (double)y2 - (double)(slope*x2);		
 		
 		//Assigning the maximum and minimum values for right lane detected in y direction to draw lines.
-		if(ybottom_right < y2)
+		if(ls->ybottom_right < y2)
 		{
-			ybottom_right = y2;
+			ls->ybottom_right = y2;
 		}
-		if(ytop_right > y1)
+		if(ls->ytop_right > y1)
 		{
-			ytop_right = y1;
+			ls->ytop_right = y1;
 		}
 		
 		
 		if(slope > (0.5))
 		{
 			//Averaging slope and intercept with history to get consistent results.
-			avg_slope_right = avg_slope_right + (double)(slope - avg_slope_right)/count_right;
-			avg_intercept_right = avg_intercept_right + (double)(intercept - avg_intercept_right)/count_right;
+			ls->avg_slope_right = ls->avg_slope_right + (double)(slope - ls->avg_slope_right)/ls->count_right;
+			ls->avg_intercept_right = ls->avg_intercept_right + (double)(intercept - ls->avg_intercept_right)/ls->count_right;
 
 			//Finding corresponding x-coordinates
-			xtop = (ytop_right - avg_intercept_right)/avg_slope_right;
-			xbottom = (ybottom_right - avg_intercept_right)/avg_slope_right;
+			xtop = (ls->ytop_right - ls->avg_intercept_right)/ls->avg_slope_right;
+			xbottom = (ls->ybottom_right - ls->avg_intercept_right)/ls->avg_slope_right;
 						
-			count_right++;			
+			ls->count_right++;			
 		
-			mute_lane.lock();
-			img_char.g_right[0] = (int)xtop;
-			img_char.g_right[1] = (int)ytop_right;
-			img_char.g_right[2] = (int)xbottom;
-			img_char.g_right[3] = (int)ybottom_right;
-			mute_lane.unlock();
+			ls->lane_out.g_right[0] = (int)xtop;
+			ls->lane_out.g_right[1] = (int)ls->ytop_right;
+			ls->lane_out.g_right[2] = (int)xbottom;
+			ls->lane_out.g_right[3] = (int)ls->ybottom_right;
 		}
 	}		
 }
@@ -1209,12 +2488,31 @@ int delta_t(struct timespec *stop, struct timespec *start, struct timespec *delt
  */
 void help(void)
 {
-	cout << endl << "Usage: sudo ./smart_car detection_type_1 detection_type_2 ....detection_type_4 input_video_file output_video_file.mp4";
+	cout << endl << "Usage: sudo ./smart_car detection_type_1 detection_type_2 ....detection_type_4 input_video_file output_video_file.mp4 [input_video_file_2 output_video_file_2.mp4 ...]";
+	cout << endl << "Up to " << MAX_STREAMS << " input/output pairs share the services, frames are only displayed for one stream";
 	cout << endl << "-a for all detection tasks";
 	cout << endl << "-p for pedestrian detection";
 	cout << endl << "-l for lane following";
 	cout << endl << "-v for vehicle detection";
 	cout << endl << "-s for road-sign recognition";
+	cout << endl << "-f for pedestrian detection on an approximated HOG feature pyramid (one real level per octave)";
+	cout << endl << "-t to track the detected boxes on every frame, the detectors running half as often";
+	cout << endl << "-m to search only the regions that changed since a detector's previous frame, with periodic full scans";
+	cout << endl << "-c to search vehicles and signs with the cascades compiled into the program instead of CascadeClassifier,";
+	cout << endl << "   in one sweep when both are released on a frame";
+	cout << endl << "-i to find the lanes with sliding windows on a bird's-eye view of the ROI, warped from the frame in one pass,";
+	cout << endl << "   instead of Canny and the Hough transform";
+	cout << endl << "-b for headless batch mode (no display, every assigned frame is processed, throughput is reported)";
+	cout << endl << "-r log_file for replay mode (headless, results of every processed frame are written to log_file).";
+	cout << endl << "   Two runs over the same input give identical logs: -t and -m are refused, and the signs are never searched";
+	cout << endl << "   in the vehicle sweep of -c";
+	cout << endl << "-w block|oldest|annotated for the output encoder backpressure policy (default: oldest, block when headless)";
+	cout << endl << "-j workers for the number of service worker threads (default: one per core but the first)";
+	cout << endl << "-P max_workers input_video_file to benchmark pedestrian detection FPS against the number of workers and check the HOG engine and approximated pyramid";
+	cout << endl << "-C input_video_file to benchmark the compiled vehicle and sign cascades against CascadeClassifier";
+	cout << endl << "-L input_video_file to benchmark and cross-check the single pass lane front end against equalize() and create_mask(),";
+	cout << endl << "   the streamed edge map against full image blur and Canny, the lane angle Hough transform against HoughLinesP()";
+	cout << endl << "   the search of the tracked lane corridors against the whole ROI and the bird's-eye sliding windows against both";
 	cout << endl << "Exiting Program" << endl;
 	exit(EXIT_FAILURE);
 }
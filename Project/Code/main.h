@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <pthread.h>
 #include <sys/time.h>
@@ -10,13 +11,31 @@
 #include <semaphore.h>
 #include <sys/syscall.h>
 #include <X11/Xlib.h>
-#include <mutex>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "opencv2/objdetect/objdetect.hpp"
 
+#include "frame_ring.h"
+#include "triple_buffer.h"
+#include "results.h"
+#include "results_log.h"
+#include "sequencer.h"
+#include "decoder.h"
+#include "video_out.h"
+#include "worker_pool.h"
+#include "hog_engine.h"
+#include "hog_parallel.h"
+#include "tracker.h"
+#include "motion.h"
+#include "cascade_eval.h"
+#include "lane_mask.h"
+#include "lane_edges.h"
+#include "lane_hough.h"
+#include "lane_track.h"
+#include "lane_ipm.h"
+
 using namespace cv;
 using namespace std;
 
@@ -43,6 +62,38 @@ using namespace std;
 #define VEH_DETECT_TH						(3)
 #define NUM_THREADS						(4)
 
+//Release flags of the vehicle job: the signs of the frame are searched in the same sweep
+#define RELEASE_SIGNS						(1)
+
+//Cascades of the services
+#define MODEL_VEHICLE						(0)
+#define MODEL_TRAFFIC						(1)
+#define MODEL_STOP						(2)
+#define NUM_MODELS						(3)
+
+//Frames the decoder may run ahead of the sequencer, and the frame rate assumed when the input does not report one
+#define PREFETCH_DEPTH						(3)
+#define DEFAULT_FPS						(30)
+
+//Annotated frames that may wait for the encoder
+#define OUTPUT_DEPTH						(4)
+
+//Frames of the input decoded for the pedestrian benchmark
+#define PED_BENCH_FRAMES					(100)
+
+//Frames of the input decoded for the cascade benchmark
+#define CASCADE_BENCH_FRAMES					(100)
+#define LANE_BENCH_FRAMES					(100)
+
+//Factor applied to the periods of the detectors when their boxes are tracked between detections
+#define TRACK_PERIOD_FACTOR					(2)
+
+//Intersection over union at which a benchmark detection matches a reference one
+#define PED_BENCH_IOU						(0.5)
+
+//Input/output video pairs that can be processed at once. Every stream shares the same service threads.
+#define MAX_STREAMS						(DISPATCH_MAX_STREAMS)
+
 //FPS calculation Macros
 #define FPS_PEDESTRIAN						(1)
 #define FPS_LANE						(2)
@@ -70,27 +121,113 @@ using namespace std;
 		exit(EXIT_FAILURE); \
 	} \
 
+//Results published by each service, read by the sequencer for the overlay
+struct img_cooordinates
+{
+	triple_buffer_t<det_result_t> traffic;
+	triple_buffer_t<det_result_t> found_loc;		//Rectangle Coordinates for pedestrian
+	triple_buffer_t<det_result_t> vehicle_loc;		//Rectangle Coordinates for Vehicle
+	triple_buffer_t<lane_result_t> lanes;
+};
+
+
+//History of the lane averaging, kept by the lane thread between the frames of one stream
 typedef struct
 {
-    int threadIdx;
-} threadParams_t;
+	//Left lane
+	int count_left;
+	double avg_slope_left;
+	double avg_intercept_left;
+	int ybottom_left;
+	int ytop_left;
+	int nolane_flag_left;
+	int nolane_count_left;
 
+	//Right lane
+	int count_right;
+	double avg_slope_right;
+	double avg_intercept_right;
+	int ybottom_right;
+	int ytop_right;
+	int nolane_flag_right;
+	int nolane_count_right;
 
-struct img_cooordinates
+	//Lane lines predicted for the next frame's search
+	lane_track_t track;
+
+	//Lanes fitted on the bird's-eye view when lane_ipm is set
+	lane_ipm_line_t ipm[2];
+
+	//Lane coordinates published after every frame
+	lane_result_t lane_out;
+} lane_state_t;
+
+
+//Work of the lane job of one stream that depends on its frame size, made again only when the size changes
+typedef struct
+{
+	Mat roi_mask;
+	lane_edges_t edges;					//ROI spans and line buffers of the streamed edge map
+	lane_hough_t hough;					//Lane angle tables and accumulator of the Hough transform
+	lane_ipm_t ipm;						//Remap tables of the bird's-eye view
+} lane_work_t;
+
+
+//Frames and result count of the pedestrian benchmark
+typedef struct
 {
-	vector<Rect> traffic;
-	vector<Rect> found_loc;				//Rectangle Coordinates for pedestrian
-	vector<Rect> vehicle_loc;				//Rectangle Coordinates for Vehicle
-	Vec4i g_left;
-	Vec4i g_right;
-} img_char;
+	vector<Mat> frames;
+	const hog_engine_t* eng;				//NULL to measure HOGDescriptor's window scoring
+	bool approx;						//Approximated feature pyramid
+	unsigned long hits;
+	vector< vector<Rect> > found;				//Detections of every frame
+} ped_bench_t;
+
+
+//Everything owned by one input/output video pair. The services find the stream of a frame through its dispatch context.
+typedef struct
+{
+	int id;
+	const char* input;
+	const char* output;
+	VideoCapture capture;
+	VideoWriter output_v;
+	frame_ring_t ring;					//Decoded frames shared with the services
+	decoder_t decoder;
+	video_out_t vout;
+	vout_policy_t vout_policy;
+	struct img_cooordinates img_char;			//Results published by the services for this stream
+	lane_state_t lane;
+	lane_work_t lane_work;
+	track_frames_t track_frames;				//Tracking images of the latest frames
+	tracker_t tracker[NUM_THREADS];				//Tracks of every detection service, indexed by the *_TH macros
+	motion_t motion;					//Changes of the frames since every service's previous release
+	triple_buffer_t<motion_roi_t> motion_roi[NUM_THREADS];	//Regions searched by the latest release of every service
+	long frame_period_ns;
+	pthread_t thread;					//Sequencer of the stream
+	int frame_cnt;
+	struct timespec start_time, stop_time;
+} stream_t;
+
+
+//Cascade of a service: mapped from its binary cache when present and current, parsed from its XML otherwise
+typedef struct
+{
+	const char* xml;
+	const char* cache;
+	CascadeClassifier* classifier;				//Used when the cascade is not mapped, or for images beyond the evaluators
+	int svc;						//Service searching with the cascade, which is only loaded when enabled
+	int model;						//Index of the mapped cascade in cascade_eval, -1 when not mapped
+	model_cache_t mc;
+	bool fallback;						//Some stream's images are beyond the evaluators, so the classifier is loaded too
+	bool loaded;
+	double load_ms;
+} service_model_t;
 
 
 //Variable Declarations for thread related functions
-pthread_t threads[NUM_THREADS];
-threadParams_t threadParams[NUM_THREADS];
-pthread_attr_t rt_sched_attr[NUM_THREADS];
-struct sched_param rt_param[NUM_THREADS];
+wp_pool_t pool;						//Workers running the service jobs of every stream
+int num_workers = 0;					//0 for one worker per core but the sequencers' one
 int rt_max_prio, rt_min_prio;
 struct sched_param main_param;
 pthread_attr_t main_attr;
@@ -98,47 +235,83 @@ pthread_attr_t main_attr;
 //General Variable Declarations
 int enable[4] = {0};
 bool exit_cond;
+bool headless = false;					//Batch mode: no display, every assigned frame is processed
+bool replay = false;					//Replay mode: headless plus a per-frame results log
 char c, output_frame[40];
-Mat g_frame;
-sem_t sem_main, sem_pedestrian, sem_lane, sem_vehicle, sem_sign;
-mutex mute_ped, mute_lane, mute_vehicle, mute_sign;
-
-//Global variables for lane detection
-//Left lane global variables.
-int count_left = 1;
-double avg_slope_left = 0;
-double avg_intercept_left = 0;
-int ybottom_left = 0;
-int ytop_left = 180;
-int nolane_flag_left = 0;
-int nolane_count_left = 0;
-
-//Right lane global variables
-int count_right = 1;
-double avg_slope_right = 0;
-double avg_intercept_right = 0;
-int ybottom_right = 0;
-int ytop_right = 180;
-int nolane_flag_right = 0;
-int nolane_count_right = 0;
+stream_t streams[MAX_STREAMS];
+int num_streams = 0;
+bool display = false;					//Frames are shown when not headless and a single stream is processed
+dispatch_q_t svc_queue[NUM_THREADS];			//Frames released to each service, by every stream
+int svc_frame_cnt[NUM_THREADS] = {0};			//Jobs done by each service, counted atomically
+
+//Detectors, used by one job of their service at a time
+HOGDescriptor hog;
+hog_engine_t hog_eng;					//Scores the pedestrian windows when hog_eng_ok
+bool hog_eng_ok = false;
+bool hog_approx = false;				//Pedestrians searched on an approximated feature pyramid
+bool tracking = false;					//Detected boxes tracked on every frame between detections
+bool motion_gating = false;				//Detectors only search the regions that changed, with periodic full scans
+bool cascade_compiled = false;				//Vehicles and signs searched by the cascades specialized at build time
+bool lane_ipm = false;					//Lanes found with sliding windows on a bird's-eye view of the ROI
+bool cascade_shared = false;				//Sign releases on a vehicle release are served by the vehicle job's sweep
+CascadeClassifier traffic_cascade;
+CascadeClassifier stop_cascade;
 
 //For Vehicle Detection
 CascadeClassifier vehicle_cascade;
-const string vehicle_cascade_name("cars.xml");
+
+//By the MODEL_* macros
+service_model_t service_models[NUM_MODELS] =
+{
+	{"cars.xml", "cars.scm", &vehicle_cascade, VEH_DETECT_TH, -1, {NULL, NULL, NULL, NULL, NULL, 0}, false, false, 0},
+	{"./traffic_light.xml", "./traffic_light.scm", &traffic_cascade, SIGN_RECOG_TH, -1, {NULL, NULL, NULL, NULL, NULL, 0}, false, false, 0},
+	{"stop_sign.xml", "stop_sign.scm", &stop_cascade, SIGN_RECOG_TH, -1, {NULL, NULL, NULL, NULL, NULL, 0}, false, false, 0}
+};
+double hog_load_ms;
+lane_lut_t lane_lut;					//Lane colours of every BGR value, used by the lane job when lane_lut.ok
+lane_lut_job_t lane_lut_jobs[LANE_LUT_JOBS];
+struct timespec boot_time;				//Process start, for the cold start report
 
 //Function Declarations
-void sem_create(void);
-void sem_destroy_all(void);
-void thread_create(void);
-void threadcpu_info(threadParams_t* threadParams);
-void thread_core_set(void);
+void dispatch_create_all(void);
+void dispatch_destroy_all(void);
+void stream_open(stream_t* st, int id, const char* input, const char* output);
+void* stream_sequencer(void* arg);
+void stream_report(struct timespec start_time);
+void stream_trackers_init(stream_t* st, Size frame);
+const det_result_t* stream_track(stream_t* st, int svc, const det_result_t* det, frame_slot_t* slot, bool released);
+bool stream_sign_handoff(stream_t* st, frame_slot_t* slot);
+void stream_motion_release(stream_t* st, int svc, uint64_t seq);
+void rects_offset_append(vector<Rect>& dst, const vector<Rect>& src, Point ofs);
+void result_buffers_init(struct img_cooordinates* img_char);
+void lane_state_init(lane_state_t* ls);
+void publish_detections(stream_t* st, int svc, triple_buffer_t<det_result_t>* tb, const vector<Rect>& loc, uint64_t seq);
+void services_init(void);
+void service_model_load(void* arg);
+void hog_load(void* arg);
+int service_model_pick(service_model_t* m, int compiled, const Mat& img);
+void ped_benchmark(const char* input, int max_workers);
+void ped_bench_job(void* arg);
+void cascade_benchmark(const char* input);
+void lane_benchmark(const char* input);
+void lane_front(const Mat& src_half, Mat& gray, Mat& mask, uchar* lut, bool fused);
+void lane_roi(Size size, Mat& roi);
+void lane_search(lane_track_t* track, lane_edges_t* edges_work, lane_hough_t* hough_work, const Mat& gray, const Mat& mask,
+	const uchar* lut, Mat& edges, vector<Vec4i>& left, vector<Vec4i>& right);
+void vehicle_search(const Mat& img, vector<Rect>& found);
+void sign_search(const Mat& img, vector<Rect>& found);
+void cascade_sweep(stream_t* st, cascade_work_t* work, const Mat& half, uint64_t seq, vector<Rect>* vehicle_loc, vector<Rect>* sign_loc);
+void ped_bench_match(const vector< vector<Rect> >& ref, const vector< vector<Rect> >& test, unsigned long* matched,
+	unsigned long* ref_total, unsigned long* test_total);
+bool service_release(service_t* svc, frame_slot_t* slot, stream_t* st, unsigned flags);
+void service_run(void* arg);
 void fps_calc(struct timespec start, int frame_cnt, uint8_t fps_thread);
-void set_thread_attr(void);
+void throughput_report(struct timespec start_time, int frame_cnt);
 void print_scheduler(void);
-void* pedestrian_detect(void* threadp);
-void* lane_follower(void* threadp);
-void* sign_recog(void* threadp);
-void* vehicle_detect(void* threadp);
+void pedestrian_detect(frame_slot_t* frame, void* ctx, unsigned flags);
+void lane_follower(frame_slot_t* frame, void* ctx, unsigned flags);
+void sign_recog(frame_slot_t* frame, void* ctx, unsigned flags);
+void vehicle_detect(frame_slot_t* frame, void* ctx, unsigned flags);
 int delta_t(struct timespec *stop, struct timespec *start, struct timespec *delta_t);
 void signal_handler(int signo, siginfo_t *info, void *extra);
 void set_signal_handler(void);
@@ -151,4 +324,15 @@ Mat equalize(Mat src_half);
 Mat create_mask(Mat src_half);
 Mat detect_lanes(Mat contrast, Mat mask, Mat roi_mask);
 Mat roi_mask(Mat src_half);
-void process_lanes(vector<Vec4i> lane, int side);
+void process_lanes(lane_state_t* ls, vector<Vec4i> lane, int side);
+
+
+//Service table driving the sequencer, indexed by the *_TH macros. Periods and deadlines in frames, budgets in microseconds.
+//Headless mode overrides every policy with DISPATCH_BLOCK so that no release is dropped.
+service_t svc_table[NUM_THREADS] =
+{
+	{"pedestrian",	3,	3,	90000,	pedestrian_detect,	&svc_queue[PED_DETECT_TH],	1,	DISPATCH_LATEST_WINS,	SERVICE_STATE_INIT},	//10Hz
+	{"lane",	2,	2,	20000,	lane_follower,		&svc_queue[LANE_FOLLOW_TH],	1,	DISPATCH_LATEST_WINS,	SERVICE_STATE_INIT},	//15Hz
+	{"sign",	4,	4,	40000,	sign_recog,		&svc_queue[SIGN_RECOG_TH],	1,	DISPATCH_LATEST_WINS,	SERVICE_STATE_INIT},	//7.5Hz
+	{"vehicle",	2,	2,	30000,	vehicle_detect,		&svc_queue[VEH_DETECT_TH],	1,	DISPATCH_LATEST_WINS,	SERVICE_STATE_INIT},	//15Hz
+};
@@ -0,0 +1,134 @@
+/**
+ * @file model_cache.cpp
+ * @brief This file consists of the loader of the binary cascade caches written by cascade_gen -b.
+ *
+ * A cache file is mapped read only and used in place: the loader only checks that the file is complete, current and
+ * that every feature lies inside the detection window, so that the evaluator never reads outside the integral image
+ * of a window. A cache older than the XML it was made from is ignored, and the services parse the XML instead.
+ *
+ */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "model_cache.h"
+
+
+/**
+ * @brief This function checks that the features of a cache lie inside its window and that every index is in range.
+ */
+static bool model_cache_check(const model_cache_t* mc)
+{
+	const model_cache_header_t* hdr = mc->hdr;
+	int w = hdr->width, h = hdr->height;
+
+	if((w < 3) || (h < 3) || (w > MODEL_CACHE_MAX_WIN) || (h > MODEL_CACHE_MAX_WIN) || (hdr->n_stages == 0))
+		return false;
+	for(uint32_t i=0; i<hdr->n_stages; i++)
+	{
+		if((mc->stages[i].first > hdr->n_stumps) || (mc->stages[i].count > hdr->n_stumps - mc->stages[i].first))
+			return false;
+	}
+	for(uint32_t i=0; i<hdr->n_stumps; i++)
+	{
+		const model_cache_stump_t* s = &mc->stumps[i];
+
+		if((s->count == 0) || (s->count > MODEL_CACHE_MAX_RECTS) || (s->first > hdr->n_rects) || (s->count > hdr->n_rects - s->first))
+			return false;
+		if(s->tilted && !hdr->tilted)
+			return false;
+		for(uint32_t j=s->first; j<s->first+s->count; j++)
+		{
+			const model_cache_rect_t* r = &mc->rects[j];
+
+			if((r->x < 0) || (r->y < 0) || (r->w < 0) || (r->h < 0) || (r->w > w) || (r->h > h))
+				return false;
+			if(!s->tilted && ((r->x + r->w > w) || (r->y + r->h > h)))
+				return false;
+			if(s->tilted && ((r->x - r->h < 0) || (r->x + r->w > w) || (r->y + r->w + r->h > h)))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+ * @brief This function maps a cache file.
+ * @param mc Returns the mapped cache.
+ * @param path The cache file.
+ * @param source The XML file the cache was made from. The cache is refused if it is older. May be NULL.
+ * @return false if the file is missing, older than its source, or not a valid cache.
+ */
+bool model_cache_open(model_cache_t* mc, const char* path, const char* source)
+{
+	struct stat st, src;
+	const model_cache_header_t* hdr;
+	size_t need;
+	int fd;
+
+	mc->map = NULL;
+	mc->size = 0;
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return false;
+	if((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(model_cache_header_t)))
+	{
+		close(fd);
+		return false;
+	}
+	if(source && (stat(source, &src) == 0) && (src.st_mtime > st.st_mtime))
+	{
+		printf("Model cache %s is older than %s, ignored\n", path, source);
+		close(fd);
+		return false;
+	}
+
+	mc->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if(mc->map == MAP_FAILED)
+	{
+		mc->map = NULL;
+		return false;
+	}
+	mc->size = st.st_size;
+
+	hdr = (const model_cache_header_t*)mc->map;
+	need = sizeof(model_cache_header_t) + (size_t)hdr->n_stages*sizeof(model_cache_stage_t) +
+		(size_t)hdr->n_stumps*sizeof(model_cache_stump_t) + (size_t)hdr->n_rects*sizeof(model_cache_rect_t);
+	if((hdr->magic != MODEL_CACHE_MAGIC) || (hdr->version != MODEL_CACHE_VERSION) || (need != mc->size))
+	{
+		printf("Model cache %s is not a valid version %d cache, ignored\n", path, MODEL_CACHE_VERSION);
+		model_cache_close(mc);
+		return false;
+	}
+	mc->hdr = hdr;
+	mc->stages = (const model_cache_stage_t*)(hdr + 1);
+	mc->stumps = (const model_cache_stump_t*)(mc->stages + hdr->n_stages);
+	mc->rects = (const model_cache_rect_t*)(mc->stumps + hdr->n_stumps);
+	if(!model_cache_check(mc))
+	{
+		printf("Model cache %s has features outside of its window, ignored\n", path);
+		model_cache_close(mc);
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * @brief This function unmaps a cache file.
+ * @param mc The cache, mapped or not.
+ * @return void
+ */
+void model_cache_close(model_cache_t* mc)
+{
+	if(mc->map)
+		munmap(mc->map, mc->size);
+	mc->map = NULL;
+	mc->size = 0;
+}
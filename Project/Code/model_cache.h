@@ -0,0 +1,69 @@
+/**
+ * @file model_cache.h
+ * @brief Binary cache of the Haar cascades of the services, memory mapped at startup instead of parsing their XML.
+ *
+ */
+
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//"SCM1" in the first bytes of a cache file, and the layout version
+#define MODEL_CACHE_MAGIC					(0x314d4353)
+#define MODEL_CACHE_VERSION					(1)
+
+//Largest cascade a cache file may describe
+#define MODEL_CACHE_MAX_WIN					(256)
+#define MODEL_CACHE_MAX_RECTS					(3)
+
+
+//A cache file is the header followed by the stages, the stumps and the rectangles, all 4 byte fields in the byte
+//order of the machine, so that the mapped file is used in place
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width, height;					//Detection window
+	uint32_t tilted;					//Some features are rotated by 45 degrees
+	uint32_t n_stages, n_stumps, n_rects;
+} model_cache_header_t;
+
+typedef struct
+{
+	uint32_t first, count;					//Stumps of the stage
+	float threshold;					//Already lowered by CascadeClassifier's 1e-5 margin
+} model_cache_stage_t;
+
+typedef struct
+{
+	uint32_t first, count;					//Rectangles of the feature
+	uint32_t tilted;
+	float threshold;					//Applies to the feature divided by the window normalization
+	float left, right;
+} model_cache_stump_t;
+
+typedef struct
+{
+	int32_t x, y, w, h;
+	float weight;
+} model_cache_rect_t;
+
+
+//A mapped cache file
+typedef struct
+{
+	const model_cache_header_t* hdr;
+	const model_cache_stage_t* stages;
+	const model_cache_stump_t* stumps;
+	const model_cache_rect_t* rects;
+	void* map;
+	size_t size;
+} model_cache_t;
+
+
+bool model_cache_open(model_cache_t* mc, const char* path, const char* source);
+void model_cache_close(model_cache_t* mc);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ * @file motion.cpp
+ * @brief This file consists of the functions of the motion gating stage of the detection services.
+ *
+ * Every frame is reduced to a MOTION_COLS x MOTION_ROWS gray image and differenced with the previous one, as in the
+ * frame differencing exercise. The thresholded and dilated differences are accumulated per service between its
+ * releases, so that a detector running every few frames sees every change since its previous frame. At a release
+ * the accumulated map becomes a few merged bounding boxes, which the service maps to its own image, grows to its
+ * smallest detection window and searches instead of the whole image. Static objects are found again by the periodic
+ * full scans.
+ *
+ */
+
+
+#include <stdio.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "motion.h"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * @brief This function merges overlapping rectangles until none overlap.
+ */
+static void motion_merge(vector<Rect>& rects)
+{
+	bool merged = true;
+
+	while(merged)
+	{
+		merged = false;
+		for(size_t i=0; (i<rects.size()) && !merged; i++)
+		{
+			for(size_t j=i+1; j<rects.size(); j++)
+			{
+				if((rects[i] & rects[j]).area() > 0)
+				{
+					rects[i] |= rects[j];
+					rects.erase(rects.begin() + j);
+					merged = true;
+					break;
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief This function initializes the change maps of a stream.
+ * @param m The motion stage of the stream.
+ * @return void
+ */
+void motion_init(motion_t* m)
+{
+	m->have_prev = false;
+	for(int i=0; i<MOTION_MAX_SERVICES; i++)
+	{
+		m->acc[i] = Mat::zeros(MOTION_ROWS, MOTION_COLS, CV_8UC1);
+		m->last[i] = Mat::zeros(MOTION_ROWS, MOTION_COLS, CV_8UC1);
+		m->last_seq[i] = 0;
+		m->releases[i] = 0;
+		m->full_scans[i] = 0;
+		m->coverage[i] = 0;
+	}
+}
+
+
+/**
+ * @brief This function differences a frame with the previous one and adds the changes to the map of every service.
+ * Called by the stream sequencer on every frame.
+ * @param m The motion stage of the stream.
+ * @param frame The BGR frame.
+ * @return void
+ */
+void motion_update(motion_t* m, const Mat& frame)
+{
+	Mat small;
+
+	resize(frame, small, Size(MOTION_COLS, MOTION_ROWS), 0, 0, INTER_AREA);
+	cvtColor(small, m->cur, CV_BGR2GRAY);
+
+	if(m->have_prev)
+	{
+		absdiff(m->cur, m->prev, m->diff);
+		threshold(m->diff, m->diff, MOTION_THRESHOLD, 255, THRESH_BINARY);
+		dilate(m->diff, m->diff, Mat(), Point(-1, -1), MOTION_DILATE);
+		for(int i=0; i<MOTION_MAX_SERVICES; i++)
+		{
+			bitwise_or(m->acc[i], m->diff, m->acc[i]);
+		}
+	}
+	swap(m->prev, m->cur);
+	m->have_prev = true;
+}
+
+
+/**
+ * @brief This function turns the changes accumulated for a service into the regions its release searches.
+ * @param m The motion stage of the stream.
+ * @param svc The index of the service.
+ * @param seq The frame the service is released on.
+ * @param done_seq The frame of the latest result published by the service. The changes published at the previous
+ * release are kept when its frame was not processed yet, since the release may replace it in the queue.
+ * @param out Returns the regions.
+ * @return void
+ */
+void motion_release(motion_t* m, int svc, uint64_t seq, uint64_t done_seq, motion_roi_t* out)
+{
+	vector< vector<Point> > contours;
+	vector<Rect> rects;
+	int area = 0;
+
+	if(m->last_seq[svc] > done_seq)
+		bitwise_or(m->acc[svc], m->last[svc], m->acc[svc]);
+	m->acc[svc].copyTo(m->last[svc]);
+	m->last_seq[svc] = seq;
+
+	out->seq = seq;
+	out->count = 0;
+	out->full = !m->have_prev || ((m->releases[svc]++ % MOTION_FULL_PERIOD) == 0);
+	if(!out->full)
+	{
+		//findContours() modifies its input, the map is cleared below anyway
+		findContours(m->acc[svc], contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+		for(size_t i=0; i<contours.size(); i++)
+		{
+			rects.push_back(boundingRect(contours[i]));
+		}
+		motion_merge(rects);
+
+		for(size_t i=0; i<rects.size(); i++)
+		{
+			area += rects[i].area();
+		}
+		if((rects.size() > MOTION_MAX_ROIS) || (area > MOTION_MAX_COVERAGE*MOTION_COLS*MOTION_ROWS))
+		{
+			out->full = true;
+		}
+		else
+		{
+			for(size_t i=0; i<rects.size(); i++)
+			{
+				out->roi[out->count++] = rects[i];
+			}
+		}
+	}
+	m->acc[svc] = Scalar::all(0);
+
+	if(out->full)
+		m->full_scans[svc]++;
+	else
+		m->coverage[svc] += (double)area/(MOTION_COLS*MOTION_ROWS);
+}
+
+
+/**
+ * @brief This function maps the regions of a release to the image a detector searches.
+ * @param m The regions published at the release.
+ * @param seq The frame the detector processes.
+ * @param part The part of the frame the detector's image shows, in change map coordinates.
+ * @param img The size of the detector's image.
+ * @param min_size The smallest region the detector can search, its detection window.
+ * @param rois Returns the regions to search, in image coordinates. Empty when nothing changed.
+ * @return false if the whole image must be searched: full scan, regions of another frame, or regions covering
+ * too much of the image.
+ */
+bool motion_rois_map(const motion_roi_t* m, uint64_t seq, Rect part, Size img, Size min_size, vector<Rect>& rois)
+{
+	float sx = (float)img.width/part.width, sy = (float)img.height/part.height;
+	Rect bounds(0, 0, img.width, img.height);
+	int area = 0;
+
+	rois.clear();
+	if(m->full || (m->seq != seq) || (img.width < min_size.width) || (img.height < min_size.height))
+		return false;
+
+	for(int i=0; i<m->count; i++)
+	{
+		Rect r = m->roi[i] & part;
+		Rect s;
+
+		if(r.area() == 0)
+			continue;
+
+		//Scaled to the image, then grown around its centre to the detection window and kept inside the image
+		s = Rect(cvFloor((r.x - part.x)*sx), cvFloor((r.y - part.y)*sy), cvCeil(r.width*sx), cvCeil(r.height*sy));
+		if(s.width < min_size.width)
+		{
+			s.x -= (min_size.width - s.width)/2;
+			s.width = min_size.width;
+		}
+		if(s.height < min_size.height)
+		{
+			s.y -= (min_size.height - s.height)/2;
+			s.height = min_size.height;
+		}
+		s.x = min(max(s.x, 0), img.width - s.width);
+		s.y = min(max(s.y, 0), img.height - s.height);
+		rois.push_back(s & bounds);
+	}
+	motion_merge(rois);
+
+	for(size_t i=0; i<rois.size(); i++)
+	{
+		area += rois[i].area();
+	}
+	return area <= MOTION_MAX_COVERAGE*img.width*img.height;
+}
+
+
+/**
+ * @brief This function prints the gating statistics of a service on a stream.
+ * @param m The motion stage of the stream.
+ * @param svc The index of the service.
+ * @param stream The stream.
+ * @param name The name of the service.
+ * @return void
+ */
+void motion_report(const motion_t* m, int svc, int stream, const char* name)
+{
+	unsigned long gated = m->releases[svc] - m->full_scans[svc];
+
+	printf("MOTION stream %d %s: %lu releases, %lu full scans, %lu gated covering %.1f%% of the frame on average\n", stream, name,
+		m->releases[svc], m->full_scans[svc], gated, gated ? 100*m->coverage[svc]/gated : 0.0);
+}
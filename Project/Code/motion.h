@@ -0,0 +1,68 @@
+/**
+ * @file motion.h
+ * @brief Low resolution frame differencing giving the detection services the regions of a frame that changed.
+ *
+ */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+//Resolution of the change map, and the gray level difference counted as a change
+#define MOTION_COLS						(80)
+#define MOTION_ROWS						(60)
+#define MOTION_THRESHOLD					(20)
+
+//3x3 dilations of the change map, so that a region covers the whole moving object
+#define MOTION_DILATE						(2)
+
+//Services a change map is kept for, and the most regions published per release
+#define MOTION_MAX_SERVICES					(8)
+#define MOTION_MAX_ROIS						(16)
+
+//Every MOTION_FULL_PERIOD-th release of a service scans the whole frame, as does one whose regions cover more than
+//MOTION_MAX_COVERAGE of it
+#define MOTION_FULL_PERIOD					(8)
+#define MOTION_MAX_COVERAGE					(0.5)
+
+
+//Regions of the change map to search on one frame
+typedef struct
+{
+	uint64_t seq;						//Frame the release was made for
+	bool full;						//The whole frame is to be searched
+	int count;
+	cv::Rect roi[MOTION_MAX_ROIS];				//In change map coordinates
+} motion_roi_t;
+
+
+typedef struct
+{
+	cv::Mat prev;						//Gray change map resolution copy of the previous frame
+	cv::Mat cur;
+	cv::Mat diff;
+	bool have_prev;
+
+	//Per service: changes since the last release, and those published at the last release
+	cv::Mat acc[MOTION_MAX_SERVICES];
+	cv::Mat last[MOTION_MAX_SERVICES];
+	uint64_t last_seq[MOTION_MAX_SERVICES];
+
+	//Statistics
+	unsigned long releases[MOTION_MAX_SERVICES];
+	unsigned long full_scans[MOTION_MAX_SERVICES];
+	double coverage[MOTION_MAX_SERVICES];			//Sum of the changed fraction of the gated releases
+} motion_t;
+
+
+void motion_init(motion_t* m);
+void motion_update(motion_t* m, const cv::Mat& frame);
+void motion_release(motion_t* m, int svc, uint64_t seq, uint64_t done_seq, motion_roi_t* out);
+bool motion_rois_map(const motion_roi_t* m, uint64_t seq, cv::Rect part, cv::Size img, cv::Size min_size, std::vector<cv::Rect>& rois);
+void motion_report(const motion_t* m, int svc, int stream, const char* name);
+
+#endif
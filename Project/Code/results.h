@@ -0,0 +1,33 @@
+/**
+ * @file results.h
+ * @brief Fixed size result records published by the services.
+ *
+ */
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+//Maximum number of rectangles published per service and frame
+#define MAX_DETECTIONS						(32)
+
+
+typedef struct
+{
+	uint64_t seq;						//Frame sequence number the detections were computed on
+	int count;
+	cv::Rect loc[MAX_DETECTIONS];
+} det_result_t;
+
+
+typedef struct
+{
+	uint64_t seq;						//Frame sequence number the lanes were computed on
+	cv::Vec4i g_left;
+	cv::Vec4i g_right;
+} lane_result_t;
+
+#endif
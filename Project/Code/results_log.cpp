@@ -0,0 +1,198 @@
+/**
+ * @file results_log.cpp
+ * @brief This file consists of the functions recording service results and writing them out as a per-frame log.
+ *
+ * Every service appends to its own list. A list can have a second writer, as the vehicle job records the signs of
+ * the shared sweep, so each list has its own lock and services do not contend with each other. The lists are merged
+ * and sorted by stream, frame sequence number and service when the log is closed. Rectangles are sorted within a frame because the detectors
+ * do not guarantee an order. Two replay runs over the same video therefore produce identical logs, which can be
+ * diffed to check that a performance change did not change the detections.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "results_log.h"
+
+using namespace cv;
+using namespace std;
+
+
+typedef struct
+{
+	int stream;
+	uint64_t seq;
+	int svc;
+	string line;
+} log_entry_t;
+
+
+static FILE* log_fp = NULL;
+static vector<log_entry_t> log_entries[RESULTS_LOG_MAX_SVC];
+static pthread_mutex_t log_lock[RESULTS_LOG_MAX_SVC];
+
+
+/**
+ * @brief Ordering of rectangles within a frame: top to bottom, left to right, then by size.
+ */
+static bool rect_less(const Rect& a, const Rect& b)
+{
+	if(a.y != b.y)
+		return a.y < b.y;
+	if(a.x != b.x)
+		return a.x < b.x;
+	if(a.width != b.width)
+		return a.width < b.width;
+	return a.height < b.height;
+}
+
+
+/**
+ * @brief Ordering of log entries: by stream, then by frame, then by service.
+ */
+static bool entry_less(const log_entry_t& a, const log_entry_t& b)
+{
+	if(a.stream != b.stream)
+		return a.stream < b.stream;
+	if(a.seq != b.seq)
+		return a.seq < b.seq;
+	return a.svc < b.svc;
+}
+
+
+/**
+ * @brief This function opens the results log and enables recording.
+ * @param path The path of the log file.
+ * @param inputs The names of the input videos, written in the log header. The stream id is the index in this list.
+ * @param n_inputs The number of input videos.
+ * @return true on success, false if the file could not be created.
+ */
+bool results_log_open(const char* path, char* const* inputs, int n_inputs)
+{
+	pthread_mutexattr_t attr;
+
+	log_fp = fopen(path, "w");
+	if(log_fp == NULL)
+	{
+		return false;
+	}
+	//The services recording run at different priorities
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	for(int i=0; i<RESULTS_LOG_MAX_SVC; i++)
+	{
+		if(pthread_mutex_init(&log_lock[i], &attr) != 0)
+		{
+			perror("ERROR: pthread_mutex_init for results log");
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_mutexattr_destroy(&attr);
+	fprintf(log_fp, "# smart_car replay log\n");
+	for(int i=0; i<n_inputs; i++)
+	{
+		fprintf(log_fp, "# input %d %s\n", i, inputs[i]);
+	}
+	fprintf(log_fp, "# stream frame service count x,y,w,h ...\n");
+	return true;
+}
+
+
+/**
+ * @brief This function records the detections of a service for one frame.
+ * @param stream The stream the frame belongs to.
+ * @param svc The service index, below RESULTS_LOG_MAX_SVC.
+ * @param name The service name written in the log.
+ * @param res The published detections.
+ * @return void
+ */
+void results_log_det(int stream, int svc, const char* name, const det_result_t* res)
+{
+	log_entry_t entry;
+	vector<Rect> loc(res->loc, res->loc + res->count);
+	char buf[64];
+
+	if(log_fp == NULL)
+		return;
+
+	sort(loc.begin(), loc.end(), rect_less);
+
+	snprintf(buf, sizeof(buf), "%d %llu %s %d", stream, (unsigned long long)res->seq, name, res->count);
+	entry.line = buf;
+	for(size_t i=0; i<loc.size(); i++)
+	{
+		snprintf(buf, sizeof(buf), " %d,%d,%d,%d", loc[i].x, loc[i].y, loc[i].width, loc[i].height);
+		entry.line += buf;
+	}
+	entry.stream = stream;
+	entry.seq = res->seq;
+	entry.svc = svc;
+	pthread_mutex_lock(&log_lock[svc]);
+	log_entries[svc].push_back(entry);
+	pthread_mutex_unlock(&log_lock[svc]);
+}
+
+
+/**
+ * @brief This function records the lanes published for one frame.
+ * @param stream The stream the frame belongs to.
+ * @param svc The service index, below RESULTS_LOG_MAX_SVC.
+ * @param name The service name written in the log.
+ * @param res The published lanes.
+ * @return void
+ */
+void results_log_lane(int stream, int svc, const char* name, const lane_result_t* res)
+{
+	log_entry_t entry;
+	char buf[128];
+
+	if(log_fp == NULL)
+		return;
+
+	snprintf(buf, sizeof(buf), "%d %llu %s 2 %d,%d,%d,%d %d,%d,%d,%d", stream, (unsigned long long)res->seq, name,
+		res->g_left[0], res->g_left[1], res->g_left[2], res->g_left[3],
+		res->g_right[0], res->g_right[1], res->g_right[2], res->g_right[3]);
+	entry.line = buf;
+	entry.stream = stream;
+	entry.seq = res->seq;
+	entry.svc = svc;
+	pthread_mutex_lock(&log_lock[svc]);
+	log_entries[svc].push_back(entry);
+	pthread_mutex_unlock(&log_lock[svc]);
+}
+
+
+/**
+ * @brief This function merges the recorded results in frame order, writes them out and closes the log.
+ * Must only be called once all services have stopped recording.
+ * @param void
+ * @return void
+ */
+void results_log_close(void)
+{
+	vector<log_entry_t> all;
+
+	if(log_fp == NULL)
+		return;
+
+	for(int i=0; i<RESULTS_LOG_MAX_SVC; i++)
+	{
+		all.insert(all.end(), log_entries[i].begin(), log_entries[i].end());
+		log_entries[i].clear();
+		pthread_mutex_destroy(&log_lock[i]);
+	}
+	sort(all.begin(), all.end(), entry_less);
+
+	for(size_t i=0; i<all.size(); i++)
+	{
+		fprintf(log_fp, "%s\n", all[i].line.c_str());
+	}
+	fclose(log_fp);
+	log_fp = NULL;
+}
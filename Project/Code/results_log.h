@@ -0,0 +1,21 @@
+/**
+ * @file results_log.h
+ * @brief Deterministic per-frame log of the service results, written in replay mode.
+ *
+ */
+
+#ifndef RESULTS_LOG_H
+#define RESULTS_LOG_H
+
+#include "results.h"
+
+//Maximum number of services that can record into the log
+#define RESULTS_LOG_MAX_SVC					(8)
+
+
+bool results_log_open(const char* path, char* const* inputs, int n_inputs);
+void results_log_det(int stream, int svc, const char* name, const det_result_t* res);
+void results_log_lane(int stream, int svc, const char* name, const lane_result_t* res);
+void results_log_close(void);
+
+#endif
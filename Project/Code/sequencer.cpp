@@ -0,0 +1,253 @@
+/**
+ * @file sequencer.cpp
+ * @brief This file consists of the functions of the rate monotonic sequencer.
+ *
+ * Services are described by a table holding their period, relative deadline and WCET budget, all expressed against
+ * the frame rate of the input. Priorities follow the rate monotonic policy: the shorter the period, the higher the
+ * priority. Every job records its release (the time its frame was published), start and completion, from which the
+ * response time, deadline misses and budget overruns are derived, each job's deadline at the frame rate of its own
+ * stream. The report checks the service set against the
+ * Liu & Layland bound and by response time analysis, with both the WCET budget and the worst execution time observed.
+ *
+ */
+
+
+#include <stdio.h>
+#include <math.h>
+
+#include "sequencer.h"
+
+#define USEC_PER_SEC						(1000000)
+#define NSEC_PER_USEC						(1000)
+
+//Duration of one frame in microseconds, of the fastest input, that the schedulability analysis is made at
+static double frame_period_us = USEC_PER_SEC/30.0;
+
+
+/**
+ * @brief This function returns the difference between two timespec values in microseconds.
+ */
+static long elapsed_us(const struct timespec* stop, const struct timespec* start)
+{
+	return (stop->tv_sec - start->tv_sec)*USEC_PER_SEC + (stop->tv_nsec - start->tv_nsec)/NSEC_PER_USEC;
+}
+
+
+/**
+ * @brief This function resets the accounting of the service table and sets the frame period of the analysis.
+ * @param table The service table.
+ * @param n The number of services in the table.
+ * @param fps The highest frame rate of the inputs. The default of 30 FPS is kept if it is unknown (0).
+ * @return void
+ */
+void seq_init(service_t* table, int n, double fps)
+{
+	if(fps > 0)
+		frame_period_us = USEC_PER_SEC/fps;
+
+	for(int i=0; i<n; i++)
+	{
+		table[i].active = 0;
+		table[i].releases = 0;
+		table[i].early = 0;
+		table[i].shared = 0;
+		table[i].jobs = 0;
+		table[i].misses = 0;
+		table[i].overruns = 0;
+		table[i].resp_min_us = -1;
+		table[i].resp_max_us = 0;
+		table[i].resp_sum_us = 0;
+		table[i].exec_max_us = 0;
+		table[i].exec_sum_us = 0;
+	}
+}
+
+
+/**
+ * @brief This function assigns rate monotonic priorities, just below the sequencer's priority, and the matching
+ * worker pool levels. Services with equal periods are ordered by their position in the table.
+ * @param table The service table.
+ * @param n The number of services in the table.
+ * @param max_prio The maximum SCHED_FIFO priority. The sequencer runs at max_prio - 1.
+ * @return void
+ */
+void seq_assign_priorities(service_t* table, int n, int max_prio)
+{
+	for(int i=0; i<n; i++)
+	{
+		int rank = 0;
+
+		for(int j=0; j<n; j++)
+		{
+			if((table[j].period < table[i].period) || ((table[j].period == table[i].period) && (j < i)))
+				rank++;
+		}
+		table[i].prio = max_prio - 2 - rank;
+		table[i].level = rank;
+	}
+}
+
+
+/**
+ * @brief This function tells whether a service is released on a frame and counts the release.
+ * @param svc The service.
+ * @param frame_cnt The sequence number of the frame.
+ * @return true if the service is released.
+ */
+bool seq_release_due(service_t* svc, int frame_cnt)
+{
+	if((frame_cnt % svc->period) != 0)
+		return false;
+
+	//Every stream sequencer releases the same services
+	__atomic_fetch_add(&svc->releases, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+
+/**
+ * @brief This function counts a release made outside of the service's period.
+ * @param svc The service.
+ * @return void
+ */
+void seq_release_early(service_t* svc)
+{
+	__atomic_fetch_add(&svc->releases, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&svc->early, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief This function counts a release handed to the job of another service instead of being queued.
+ * @param svc The service.
+ * @return void
+ */
+void seq_release_shared(service_t* svc)
+{
+	__atomic_fetch_add(&svc->shared, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief This function records the timing of a completed job. Called by the job of the service.
+ * @param svc The service.
+ * @param release The release time of the job, i.e. the publish time of its frame (CLOCK_MONOTONIC).
+ * @param start The time the service started the job (CLOCK_MONOTONIC).
+ * @param frame_period_ns The frame period of the stream the job ran on, the deadline is counted in.
+ * @return void
+ */
+void seq_job_done(service_t* svc, const struct timespec* release, const struct timespec* start, long frame_period_ns)
+{
+	struct timespec completion;
+	long resp_us, exec_us;
+
+	clock_gettime(CLOCK_MONOTONIC, &completion);
+	resp_us = elapsed_us(&completion, release);
+	exec_us = elapsed_us(&completion, start);
+
+	svc->jobs++;
+	if(resp_us > svc->deadline*(double)frame_period_ns/NSEC_PER_USEC)
+		svc->misses++;
+	if(exec_us > svc->wcet_us)
+		svc->overruns++;
+
+	if((svc->resp_min_us < 0) || (resp_us < svc->resp_min_us))
+		svc->resp_min_us = resp_us;
+	if(resp_us > svc->resp_max_us)
+		svc->resp_max_us = resp_us;
+	if(exec_us > svc->exec_max_us)
+		svc->exec_max_us = exec_us;
+	svc->resp_sum_us += resp_us;
+	svc->exec_sum_us += exec_us;
+}
+
+
+/**
+ * @brief This function computes the worst case response time of a service by response time analysis.
+ * @param table The service table.
+ * @param n The number of services in the table.
+ * @param enable Which services are enabled.
+ * @param idx The service to analyse.
+ * @param observed Use the worst observed execution time instead of the WCET budget.
+ * @return The response time in microseconds, or -1 if it exceeds the deadline.
+ */
+static double response_time(service_t* table, int n, const int* enable, int idx, bool observed)
+{
+	double c_i = observed ? table[idx].exec_max_us : table[idx].wcet_us;
+	double d_i = table[idx].deadline*frame_period_us;
+	double r = c_i, r_next;
+
+	while(1)
+	{
+		r_next = c_i;
+		for(int j=0; j<n; j++)
+		{
+			if(!enable[j] || (j == idx) || (table[j].prio < table[idx].prio))
+				continue;
+			r_next += ceil(r/(table[j].period*frame_period_us))*(observed ? table[j].exec_max_us : table[j].wcet_us);
+		}
+		if(r_next > d_i)
+			return -1;
+		if(r_next == r)
+			return r;
+		r = r_next;
+	}
+}
+
+
+/**
+ * @brief This function prints the per-service timing accounting and the schedulability of the service set.
+ * The analysis treats the services as sharing one core, which is pessimistic for the multi-core worker pool used.
+ * @param table The service table.
+ * @param n The number of services in the table.
+ * @param enable Which services are enabled.
+ * @return void
+ */
+void seq_report(service_t* table, int n, const int* enable)
+{
+	double u_budget = 0, u_observed = 0, bound;
+	int m = 0;
+
+	printf("\nSEQUENCER (frame period %.1f us):\n", frame_period_us);
+	printf("%-12s %4s %6s %-12s %8s %6s %6s %8s %8s %8s %6s %8s %10s %10s %10s %10s\n", "service", "prio", "period", "policy",
+		"releases", "early", "shared", "skipped", "jobs", "misses", "overrun", "budget", "resp_min", "resp_avg", "resp_max", "exec_max");
+	for(int i=0; i<n; i++)
+	{
+		if(!enable[i])
+			continue;
+
+		printf("%-12s %4d %6d %-12s %8lu %6lu %6lu %8lu %8lu %8lu %6lu %8ld %10ld %10.0f %10ld %10ld\n", table[i].name, table[i].prio,
+			table[i].period, dispatch_policy_name(table[i].policy), table[i].releases, table[i].early, table[i].shared,
+			table[i].queue->skipped,
+			table[i].jobs, table[i].misses, table[i].overruns, table[i].wcet_us,
+			table[i].resp_min_us, table[i].jobs ? table[i].resp_sum_us/table[i].jobs : 0.0, table[i].resp_max_us,
+			table[i].exec_max_us);
+
+		u_budget += table[i].wcet_us/(table[i].period*frame_period_us);
+		u_observed += table[i].exec_max_us/(table[i].period*frame_period_us);
+		m++;
+	}
+	if(m == 0)
+		return;
+
+	bound = m*(pow(2.0, 1.0/m) - 1);
+	printf("Utilization: budget %.3f, observed worst %.3f, RM least upper bound %.3f\n", u_budget, u_observed, bound);
+
+	for(int i=0; i<n; i++)
+	{
+		double r_budget, r_observed;
+
+		if(!enable[i])
+			continue;
+
+		r_budget = response_time(table, n, enable, i, false);
+		r_observed = response_time(table, n, enable, i, true);
+		printf("%-12s worst response (budget) %s", table[i].name, (r_budget < 0) ? "MISSES DEADLINE" : "");
+		if(r_budget >= 0)
+			printf("%.0f us", r_budget);
+		printf(", (observed) %s", (r_observed < 0) ? "MISSES DEADLINE" : "");
+		if(r_observed >= 0)
+			printf("%.0f us", r_observed);
+		printf(", deadline %.0f us\n", table[i].deadline*frame_period_us);
+	}
+}
@@ -0,0 +1,55 @@
+/**
+ * @file sequencer.h
+ * @brief Table driven rate monotonic sequencer: service table, priority assignment and deadline accounting.
+ *
+ */
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <time.h>
+
+#include "dispatch.h"
+
+
+typedef struct
+{
+	const char* name;
+	int period;						//Release period in frames
+	int deadline;						//Relative deadline in frames
+	long wcet_us;						//WCET budget in microseconds
+	void (*job)(frame_slot_t* frame, void* ctx, unsigned flags);	//Service job, run by the worker pool on one frame of stream ctx
+	dispatch_q_t* queue;					//Queue the service takes its frames from
+	int depth;						//Maximum number of pending frames in the queue
+	dispatch_policy_t policy;				//What a release does when the queue is full
+	int prio;						//Rate monotonic priority, assigned by seq_assign_priorities()
+	int level;						//Worker pool level of the priority, 0 for the highest
+	int active;						//A job of the service is queued or running (atomic). Jobs never overlap.
+
+	//Accounting. releases is written by the stream sequencers (atomically), everything else by the running job only.
+	unsigned long releases;
+	unsigned long early;					//Releases asked for by a tracker between periodic ones
+	unsigned long shared;					//Releases served by the job of another service
+	unsigned long jobs;
+	unsigned long misses;					//Jobs completing after their deadline
+	unsigned long overruns;					//Jobs executing longer than wcet_us
+	long resp_min_us;
+	long resp_max_us;
+	double resp_sum_us;
+	long exec_max_us;
+	double exec_sum_us;
+} service_t;
+
+//Initial values of the fields of a service_t following its configuration, from prio to exec_sum_us
+#define SERVICE_STATE_INIT					0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+
+
+void seq_init(service_t* table, int n, double fps);
+void seq_assign_priorities(service_t* table, int n, int max_prio);
+bool seq_release_due(service_t* svc, int frame_cnt);
+void seq_release_early(service_t* svc);
+void seq_release_shared(service_t* svc);
+void seq_job_done(service_t* svc, const struct timespec* release, const struct timespec* start, long frame_period_ns);
+void seq_report(service_t* table, int n, const int* enable);
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * @file tracker.cpp
+ * @brief This file consists of the functions tracking detected boxes from frame to frame.
+ *
+ * The detection services only run every few frames and their results arrive a few frames late. Every published box
+ * becomes a track: its appearance is cut from a small gray copy of the frame the detection was computed on, and the
+ * track is then moved over every following frame by normalized cross-correlation template matching in a small area
+ * around its last position. Large boxes are matched on a downscaled template so that the cost per track stays bounded.
+ * A track whose best correlation falls below TRACK_MIN_NCC is dropped, and the tracker asks once for a new detection
+ * until one arrives.
+ *
+ */
+
+
+#include <stdio.h>
+#include <algorithm>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "tracker.h"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * @brief This function empties the history of tracking images.
+ * @param tf The history.
+ * @return void
+ */
+void track_frames_init(track_frames_t* tf)
+{
+	for(int i=0; i<TRACK_HISTORY; i++)
+	{
+		tf->seq[i] = 0;
+	}
+	tf->next = 0;
+}
+
+
+/**
+ * @brief This function adds the tracking image of a frame to the history, replacing the oldest one.
+ * @param tf The history.
+ * @param frame The BGR frame.
+ * @param size The size of the tracking image.
+ * @param seq The sequence number of the frame.
+ * @return void
+ */
+void track_frames_push(track_frames_t* tf, const Mat& frame, Size size, uint64_t seq)
+{
+	Mat small;
+
+	resize(frame, small, size, 0, 0, INTER_AREA);
+	cvtColor(small, tf->img[tf->next], CV_BGR2GRAY);
+	tf->seq[tf->next] = seq;
+	tf->next = (tf->next + 1) % TRACK_HISTORY;
+}
+
+
+/**
+ * @brief This function returns the tracking image of a frame.
+ * @param tf The history.
+ * @param seq The sequence number of the frame.
+ * @return The image, NULL if the frame is no longer in the history.
+ */
+const Mat* track_frames_find(const track_frames_t* tf, uint64_t seq)
+{
+	for(int i=0; i<TRACK_HISTORY; i++)
+	{
+		if((seq != 0) && (tf->seq[i] == seq))
+			return &tf->img[i];
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief This function starts a track on a box of a tracking image.
+ * @return false if too little of the box lies in the image.
+ */
+static bool track_start(track_t* t, const Mat& img, Rect box)
+{
+	box &= Rect(0, 0, img.cols, img.rows);
+	if((box.width < TRACK_TEMPLATE_MIN) || (box.height < TRACK_TEMPLATE_MIN))
+		return false;
+
+	t->scale = min(1.f, (float)TRACK_TEMPLATE_MAX/max(box.width, box.height));
+	if(t->scale < 1)
+		resize(img(box), t->templ, Size(max(TRACK_TEMPLATE_MIN, cvRound(box.width*t->scale)), max(TRACK_TEMPLATE_MIN, cvRound(box.height*t->scale))), 0, 0, INTER_AREA);
+	else
+		img(box).copyTo(t->templ);
+	t->box = box;
+	t->score = 1;
+	t->live = true;
+	return true;
+}
+
+
+/**
+ * @brief This function moves a track to the best match of its template around its last position.
+ * @return false if the track is lost.
+ */
+static bool track_match(track_t* t, const Mat& img)
+{
+	Mat patch, ncc;
+	double best;
+	Point loc;
+	int margin = cvCeil(TRACK_SEARCH/t->scale);
+	Rect search(t->box.x - margin, t->box.y - margin, t->box.width + 2*margin, t->box.height + 2*margin);
+
+	search &= Rect(0, 0, img.cols, img.rows);
+	if(t->scale < 1)
+		resize(img(search), patch, Size(cvRound(search.width*t->scale), cvRound(search.height*t->scale)), 0, 0, INTER_AREA);
+	else
+		patch = img(search);
+	if((patch.cols < t->templ.cols) || (patch.rows < t->templ.rows))
+		return false;
+
+	matchTemplate(patch, t->templ, ncc, TM_CCOEFF_NORMED);
+	minMaxLoc(ncc, NULL, &best, NULL, &loc);
+	t->score = (float)best;
+	if(best < TRACK_MIN_NCC)
+		return false;
+
+	t->box.x = search.x + cvRound(loc.x/t->scale);
+	t->box.y = search.y + cvRound(loc.y/t->scale);
+	return true;
+}
+
+
+/**
+ * @brief This function initializes the tracker of one service on one stream.
+ * @param trk The tracker.
+ * @param map The mapping of the service's result coordinates to the tracking image.
+ * @return void
+ */
+void tracker_init(tracker_t* trk, track_map_t map)
+{
+	trk->map = map;
+	trk->det_seq = 0;
+	trk->seq = 0;
+	trk->requested = 0;
+	trk->count = 0;
+	trk->out = det_result_t();
+	trk->frames = 0;
+	trk->matches = 0;
+	trk->lost = 0;
+	trk->requests = 0;
+}
+
+
+/**
+ * @brief This function restarts the tracks on new detections and moves them to the current frame.
+ * Called by the stream sequencer on every frame, after the tracking image of the frame was pushed.
+ * @param trk The tracker.
+ * @param det The latest detections published by the service.
+ * @param tf The tracking images of the stream.
+ * @param seq The sequence number of the current frame.
+ * @param redetect Returns true when a track was lost and no new detection was asked for since the last one.
+ * @return The tracked boxes, in result coordinates. Valid until the next update.
+ */
+const det_result_t* tracker_update(tracker_t* trk, const det_result_t* det, const track_frames_t* tf, uint64_t seq, bool* redetect)
+{
+	const Mat* img;
+	bool dead = false;
+
+	trk->frames++;
+
+	//New detections start from the frame they were computed on, or from this one if it is gone
+	if(det->seq != trk->det_seq)
+	{
+		img = track_frames_find(tf, det->seq);
+		trk->det_seq = det->seq;
+		trk->seq = img ? det->seq : seq;
+		if(!img)
+			img = track_frames_find(tf, seq);
+
+		trk->count = 0;
+		for(int i=0; (i<det->count) && img; i++)
+		{
+			Rect box(cvRound(det->loc[i].x*trk->map.sx + trk->map.ox), cvRound(det->loc[i].y*trk->map.sy + trk->map.oy),
+				cvRound(det->loc[i].width*trk->map.sx), cvRound(det->loc[i].height*trk->map.sy));
+
+			if(track_start(&trk->track[trk->count], *img, box))
+				trk->count++;
+		}
+	}
+
+	//Catching up with every frame since the tracks were last moved
+	for(uint64_t s=trk->seq+1; s<=seq; s++)
+	{
+		img = track_frames_find(tf, s);
+		if(!img)
+			continue;
+
+		for(int i=0; i<trk->count; i++)
+		{
+			if(!trk->track[i].live)
+				continue;
+			if(track_match(&trk->track[i], *img))
+			{
+				trk->matches++;
+			}
+			else
+			{
+				trk->track[i].live = false;
+				trk->lost++;
+			}
+		}
+	}
+	trk->seq = seq;
+
+	trk->out.seq = det->seq;
+	trk->out.count = 0;
+	for(int i=0; i<trk->count; i++)
+	{
+		const Rect& b = trk->track[i].box;
+
+		if(!trk->track[i].live)
+		{
+			dead = true;
+			continue;
+		}
+		trk->out.loc[trk->out.count++] = Rect(cvRound((b.x - trk->map.ox)/trk->map.sx), cvRound((b.y - trk->map.oy)/trk->map.sy),
+			cvRound(b.width/trk->map.sx), cvRound(b.height/trk->map.sy));
+	}
+
+	//A request is outstanding until detections of a later frame arrive
+	*redetect = dead && (trk->requested <= trk->det_seq);
+	if(*redetect)
+	{
+		trk->requested = seq;
+		trk->requests++;
+	}
+	return &trk->out;
+}
+
+
+/**
+ * @brief This function prints the statistics of a tracker.
+ * @param trk The tracker.
+ * @param stream The stream of the tracker.
+ * @param name The name of the service tracked.
+ * @return void
+ */
+void tracker_report(const tracker_t* trk, int stream, const char* name)
+{
+	printf("TRACKER stream %d %s: %lu frames, %lu matches, %lu tracks lost, %lu detections requested\n", stream, name,
+		trk->frames, trk->matches, trk->lost, trk->requests);
+}
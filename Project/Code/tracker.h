@@ -0,0 +1,83 @@
+/**
+ * @file tracker.h
+ * @brief Per frame template tracking of the boxes published by the detection services, between detector runs.
+ *
+ */
+
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "results.h"
+
+//Tracking frames kept per stream, so that new detections can be caught up from the frame they were computed on
+#define TRACK_HISTORY						(8)
+
+//Pixels of the tracking image searched around the last position of a box, at template scale
+#define TRACK_SEARCH						(6)
+
+//Longest template side. Larger boxes are matched on a downscaled template and search area.
+#define TRACK_TEMPLATE_MAX					(32)
+
+//Smallest template side, and the normalized cross-correlation below which a track is lost
+#define TRACK_TEMPLATE_MIN					(6)
+#define TRACK_MIN_NCC						(0.6)
+
+
+//Tracking images of the latest frames of a stream
+typedef struct
+{
+	cv::Mat img[TRACK_HISTORY];
+	uint64_t seq[TRACK_HISTORY];
+	int next;
+} track_frames_t;
+
+
+//Maps result coordinates of a service to the tracking image: x*sx + ox, y*sy + oy
+typedef struct
+{
+	float sx, sy;
+	float ox, oy;
+} track_map_t;
+
+
+typedef struct
+{
+	bool live;
+	cv::Rect box;						//In tracking image coordinates
+	cv::Mat templ;						//Appearance at detection, at template scale
+	float scale;						//Template scale, 1 or less
+	float score;						//Correlation of the last match
+} track_t;
+
+
+//Tracks of one service on one stream
+typedef struct
+{
+	track_map_t map;
+	uint64_t det_seq;					//Frame of the detections the tracks started from
+	uint64_t seq;						//Frame the tracks were last moved to
+	uint64_t requested;					//Frame a new detection was last asked for
+	int count;
+	track_t track[MAX_DETECTIONS];
+	det_result_t out;					//Tracked boxes, in result coordinates
+
+	//Statistics
+	unsigned long frames;
+	unsigned long matches;
+	unsigned long lost;
+	unsigned long requests;
+} tracker_t;
+
+
+void track_frames_init(track_frames_t* tf);
+void track_frames_push(track_frames_t* tf, const cv::Mat& frame, cv::Size size, uint64_t seq);
+const cv::Mat* track_frames_find(const track_frames_t* tf, uint64_t seq);
+void tracker_init(tracker_t* trk, track_map_t map);
+const det_result_t* tracker_update(tracker_t* trk, const det_result_t* det, const track_frames_t* tf, uint64_t seq, bool* redetect);
+void tracker_report(const tracker_t* trk, int stream, const char* name);
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file triple_buffer.h
+ * @brief Wait-free single producer / single consumer triple buffer used to publish service results to the sequencer.
+ *
+ * The producer always owns one buffer and the consumer another. The third one is exchanged atomically between them,
+ * with a flag telling the consumer whether it holds data it has not seen yet. Neither side ever blocks or allocates,
+ * and the consumer always reads the most recently published value.
+ *
+ */
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include <atomic>
+
+#define TB_INDEX_MASK						(0x03)
+#define TB_DIRTY						(0x04)
+
+
+template<typename T>
+struct triple_buffer_t
+{
+	T buf[3];
+	std::atomic<uint8_t> middle;				//Index of the exchange buffer | TB_DIRTY when it holds unread data
+	uint8_t back;						//Index owned by the producer
+	uint8_t front;						//Index owned by the consumer
+};
+
+
+/**
+ * @brief This function initializes the buffer indices. Must be called before the producer and consumer start.
+ * @param tb The triple buffer.
+ * @return void
+ */
+template<typename T>
+void tb_init(triple_buffer_t<T>* tb)
+{
+	tb->back = 0;
+	tb->middle.store(1);
+	tb->front = 2;
+	tb->buf[0] = tb->buf[1] = tb->buf[2] = T();
+}
+
+
+/**
+ * @brief This function copies a value into the producer's buffer and publishes it.
+ * @param tb The triple buffer.
+ * @param val The value to publish.
+ * @return void
+ */
+template<typename T>
+void tb_write(triple_buffer_t<T>* tb, const T& val)
+{
+	tb->buf[tb->back] = val;
+	tb->back = tb->middle.exchange(tb->back | TB_DIRTY, std::memory_order_acq_rel) & TB_INDEX_MASK;
+}
+
+
+/**
+ * @brief This function returns the most recently published value. Only valid until the next call from the consumer.
+ * @param tb The triple buffer.
+ * @return Pointer to the consumer's buffer.
+ */
+template<typename T>
+const T* tb_read(triple_buffer_t<T>* tb)
+{
+	if(tb->middle.load(std::memory_order_relaxed) & TB_DIRTY)
+	{
+		tb->front = tb->middle.exchange(tb->front, std::memory_order_acq_rel) & TB_INDEX_MASK;
+	}
+	return &tb->buf[tb->front];
+}
+
+#endif
@@ -0,0 +1,313 @@
+/**
+ * @file video_out.cpp
+ * @brief This file consists of the functions of the asynchronous output stage.
+ *
+ * The sequencer draws the overlay straight into a preallocated output buffer and submits it. The encoder thread
+ * writes the queued buffers in order and returns them to the free list. When the queue is full the configured
+ * policy decides whether the sequencer waits or which frame is dropped, so the real-time loop never waits on the
+ * encoder unless VOUT_BLOCK is chosen (headless runs, where every frame must be written).
+ * The lock uses priority inheritance, since the sequencer runs far above the encoder and the workers in between.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "video_out.h"
+
+using namespace cv;
+
+#define USEC_PER_SEC						(1000000)
+#define NSEC_PER_USEC						(1000)
+
+
+/**
+ * @brief This function drops a queued frame and returns its buffer to the free list. Called with the lock held.
+ */
+static void video_out_drop(video_out_t* vo, int victim)
+{
+	vo->dropped++;
+	vo->free_list[vo->nfree++] = vo->queue[(vo->head + victim) % VIDEO_OUT_MAX_DEPTH];
+	for(int i=victim; i>0; i--)
+	{
+		vo->queue[(vo->head + i) % VIDEO_OUT_MAX_DEPTH] = vo->queue[(vo->head + i - 1) % VIDEO_OUT_MAX_DEPTH];
+	}
+	vo->head = (vo->head + 1) % VIDEO_OUT_MAX_DEPTH;
+	vo->count--;
+}
+
+
+/**
+ * @brief This function tells which queued frame VOUT_DROP_ANNOTATED_ONLY drops: the oldest frame without fresh
+ * results, or the oldest frame if all of them have some. Called with the lock held.
+ */
+static int video_out_victim(video_out_t* vo)
+{
+	for(int i=0; i<vo->count; i++)
+	{
+		if(!vo->buf[vo->queue[(vo->head + i) % VIDEO_OUT_MAX_DEPTH]].fresh)
+			return i;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Thread function of the encoder. Writes queued frames until stopped and drained.
+ * @param arg The video_out_t.
+ * @return NULL
+ */
+static void* video_out_thread(void* arg)
+{
+	video_out_t* vo = (video_out_t*)arg;
+	struct timespec start, stop;
+	int idx;
+	long us;
+
+	while(1)
+	{
+		pthread_mutex_lock(&vo->lock);
+		while((vo->count == 0) && !vo->stop)
+		{
+			pthread_cond_wait(&vo->not_empty, &vo->lock);
+		}
+		if(vo->count == 0)
+		{
+			pthread_mutex_unlock(&vo->lock);
+			break;
+		}
+		idx = vo->queue[vo->head];
+		vo->head = (vo->head + 1) % VIDEO_OUT_MAX_DEPTH;
+		vo->count--;
+		pthread_cond_signal(&vo->not_full);
+		pthread_mutex_unlock(&vo->lock);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		vo->writer->write(vo->buf[idx].frame);
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		us = (stop.tv_sec - start.tv_sec)*USEC_PER_SEC + (stop.tv_nsec - start.tv_nsec)/NSEC_PER_USEC;
+
+		pthread_mutex_lock(&vo->lock);
+		vo->written++;
+		vo->encode_sum_us += us;
+		if(us > vo->encode_max_us)
+			vo->encode_max_us = us;
+		vo->free_list[vo->nfree++] = idx;
+		pthread_cond_signal(&vo->freed);
+		pthread_mutex_unlock(&vo->lock);
+	}
+
+	pthread_exit(NULL);
+}
+
+
+/**
+ * @brief This function preallocates the output buffers and starts the encoder thread.
+ * @param vo The output stage.
+ * @param writer The opened video writer. Only the encoder thread writes to it afterwards.
+ * @param size The size of the annotated frames.
+ * @param depth The number of frames that may wait for the encoder, from 1 to VIDEO_OUT_MAX_DEPTH.
+ * @param policy The policy applied when a frame is submitted to a full queue.
+ * @param prio The SCHED_FIFO priority of the encoder. Should be below every real-time thread.
+ * @return void
+ */
+void video_out_start(video_out_t* vo, VideoWriter* writer, Size size, int depth, vout_policy_t policy, int prio)
+{
+	pthread_attr_t attr;
+	pthread_mutexattr_t mattr;
+	struct sched_param param;
+
+	if(depth < 1)
+		depth = 1;
+	if(depth > VIDEO_OUT_MAX_DEPTH)
+		depth = VIDEO_OUT_MAX_DEPTH;
+
+	vo->writer = writer;
+	for(int i=0; i<VIDEO_OUT_BUFFERS; i++)
+	{
+		vo->buf[i].frame.create(size, CV_8UC3);
+		vo->buf[i].fresh = false;
+		vo->free_list[i] = i;
+	}
+	vo->nfree = VIDEO_OUT_BUFFERS;
+	vo->head = 0;
+	vo->count = 0;
+	vo->depth = depth;
+	vo->policy = policy;
+	vo->stop = false;
+	vo->submitted = 0;
+	vo->written = 0;
+	vo->dropped = 0;
+	vo->blocked = 0;
+	vo->encode_sum_us = 0;
+	vo->encode_max_us = 0;
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+	if(pthread_mutex_init(&vo->lock, &mattr) != 0)
+	{
+		perror("ERROR: pthread_mutex_init for video output");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutexattr_destroy(&mattr);
+	pthread_cond_init(&vo->not_empty, NULL);
+	pthread_cond_init(&vo->not_full, NULL);
+	pthread_cond_init(&vo->freed, NULL);
+
+	//No affinity, so the encoder soaks up idle time on any core
+	param.sched_priority = prio;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	if(pthread_create(&vo->thread, &attr, video_out_thread, (void*)vo) != 0)
+	{
+		perror("ERROR: pthread_create for video output");
+		exit(EXIT_FAILURE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+
+/**
+ * @brief This function returns a free output buffer to draw the next annotated frame into. There are more buffers
+ * than the queue can hold plus the one being encoded, so one is free unless a buffer was not handed back. Should none
+ * be free, the policy applies as to a full queue: VOUT_BLOCK waits for the encoder, the others drop a queued frame.
+ * @param vo The output stage.
+ * @return The buffer, to be handed back with video_out_submit().
+ */
+vout_buf_t* video_out_acquire(video_out_t* vo)
+{
+	vout_buf_t* buf;
+
+	pthread_mutex_lock(&vo->lock);
+	if(vo->nfree == 0)
+	{
+		if((vo->policy == VOUT_BLOCK) || (vo->count == 0))
+		{
+			vo->blocked++;
+			while(vo->nfree == 0)
+			{
+				pthread_cond_wait(&vo->freed, &vo->lock);
+			}
+		}
+		else if(vo->policy == VOUT_DROP_OLDEST)
+			video_out_drop(vo, 0);
+		else
+			video_out_drop(vo, video_out_victim(vo));
+	}
+	buf = &vo->buf[vo->free_list[--vo->nfree]];
+	pthread_mutex_unlock(&vo->lock);
+
+	return buf;
+}
+
+
+/**
+ * @brief This function queues an annotated frame for encoding, applying the backpressure policy if the queue is full.
+ * @param vo The output stage.
+ * @param buf The buffer obtained from video_out_acquire().
+ * @param fresh Whether the overlay carries results that were not in the previously submitted frame.
+ * @return void
+ */
+void video_out_submit(video_out_t* vo, vout_buf_t* buf, bool fresh)
+{
+	int idx = buf - vo->buf;
+
+	buf->fresh = fresh;
+
+	pthread_mutex_lock(&vo->lock);
+	vo->submitted++;
+
+	if(vo->count == vo->depth)
+	{
+		switch(vo->policy)
+		{
+			case VOUT_BLOCK:
+				vo->blocked++;
+				while(vo->count == vo->depth)
+				{
+					pthread_cond_wait(&vo->not_full, &vo->lock);
+				}
+				break;
+
+			case VOUT_DROP_OLDEST:
+				video_out_drop(vo, 0);
+				break;
+
+			case VOUT_DROP_ANNOTATED_ONLY:
+				if(!fresh)
+				{
+					//The new frame only repeats results already queued
+					vo->dropped++;
+					vo->free_list[vo->nfree++] = idx;
+					pthread_mutex_unlock(&vo->lock);
+					return;
+				}
+				video_out_drop(vo, video_out_victim(vo));
+				break;
+		}
+	}
+
+	vo->queue[(vo->head + vo->count) % VIDEO_OUT_MAX_DEPTH] = idx;
+	vo->count++;
+	pthread_cond_signal(&vo->not_empty);
+	pthread_mutex_unlock(&vo->lock);
+}
+
+
+/**
+ * @brief This function lets the encoder write the frames still queued, then stops it.
+ * @param vo The output stage.
+ * @return void
+ */
+void video_out_stop(video_out_t* vo)
+{
+	pthread_mutex_lock(&vo->lock);
+	vo->stop = true;
+	pthread_cond_broadcast(&vo->not_empty);
+	pthread_mutex_unlock(&vo->lock);
+
+	pthread_join(vo->thread, NULL);
+
+	pthread_mutex_destroy(&vo->lock);
+	pthread_cond_destroy(&vo->not_empty);
+	pthread_cond_destroy(&vo->not_full);
+	pthread_cond_destroy(&vo->freed);
+}
+
+
+/**
+ * @brief This function prints the encoder statistics.
+ * @param vo The output stage.
+ * @return void
+ */
+void video_out_report(video_out_t* vo)
+{
+	printf("\nVIDEO OUTPUT (%s, depth %d):\n", vout_policy_name(vo->policy), vo->depth);
+	printf("VIDEO OUTPUT Frames submitted/written/dropped: %lu/%lu/%lu\n", vo->submitted, vo->written, vo->dropped);
+	printf("VIDEO OUTPUT Submits blocked on the encoder: %lu\n", vo->blocked);
+	printf("VIDEO OUTPUT Encode time avg/max: %.0f/%ld us\n", vo->written ? vo->encode_sum_us/vo->written : 0.0, vo->encode_max_us);
+}
+
+
+/**
+ * @brief This function returns the printable name of an output policy.
+ * @param policy The policy.
+ * @return The name.
+ */
+const char* vout_policy_name(vout_policy_t policy)
+{
+	switch(policy)
+	{
+		case VOUT_BLOCK:
+			return "block";
+		case VOUT_DROP_OLDEST:
+			return "drop-oldest";
+		case VOUT_DROP_ANNOTATED_ONLY:
+			return "drop-annotated-only";
+	}
+	return "unknown";
+}
@@ -0,0 +1,73 @@
+/**
+ * @file video_out.h
+ * @brief Asynchronous output stage encoding the annotated frames on a low priority thread.
+ *
+ */
+
+#ifndef VIDEO_OUT_H
+#define VIDEO_OUT_H
+
+#include <pthread.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+//Largest number of annotated frames waiting for the encoder
+#define VIDEO_OUT_MAX_DEPTH					(8)
+
+//Buffers: the queued ones, the one being encoded and the one being drawn by the sequencer
+#define VIDEO_OUT_BUFFERS					(VIDEO_OUT_MAX_DEPTH + 2)
+
+
+//What a submitted frame does when the encoder queue is full
+typedef enum
+{
+	VOUT_BLOCK,						//Wait for the encoder. Every frame is written.
+	VOUT_DROP_OLDEST,					//Drop the oldest queued frame
+	VOUT_DROP_ANNOTATED_ONLY				//Drop a frame whose overlay only repeats results already written
+} vout_policy_t;
+
+
+typedef struct
+{
+	cv::Mat frame;
+	bool fresh;						//The overlay carries at least one result not written before
+} vout_buf_t;
+
+
+typedef struct
+{
+	cv::VideoWriter* writer;
+	pthread_t thread;
+	vout_buf_t buf[VIDEO_OUT_BUFFERS];
+	int free_list[VIDEO_OUT_BUFFERS];
+	int nfree;
+	int queue[VIDEO_OUT_MAX_DEPTH];
+	int head;
+	int count;
+	int depth;
+	vout_policy_t policy;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	pthread_cond_t freed;					//A buffer went back to the free list
+
+	//Statistics
+	unsigned long submitted;
+	unsigned long written;
+	unsigned long dropped;
+	unsigned long blocked;					//Submits that had to wait for the encoder
+	double encode_sum_us;
+	long encode_max_us;
+} video_out_t;
+
+
+void video_out_start(video_out_t* vo, cv::VideoWriter* writer, cv::Size size, int depth, vout_policy_t policy, int prio);
+vout_buf_t* video_out_acquire(video_out_t* vo);
+void video_out_submit(video_out_t* vo, vout_buf_t* buf, bool fresh);
+void video_out_stop(video_out_t* vo);
+void video_out_report(video_out_t* vo);
+const char* vout_policy_name(vout_policy_t policy);
+
+#endif
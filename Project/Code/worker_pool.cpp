@@ -0,0 +1,425 @@
+/**
+ * @file worker_pool.cpp
+ * @brief This file consists of the functions of the work-stealing worker pool.
+ *
+ * With one pinned thread per service, a core stays idle whenever its service is idle, however far behind the other
+ * services are. The pool runs one worker per core instead, and any worker runs any job. Every worker owns one deque
+ * per priority level: it pushes and pops its own jobs at the tail (most recent first, which keeps sub-tasks on the
+ * core that created them), and an idle worker steals from the head of another worker's deque.
+ * Priorities are respected at job granularity: a worker always looks for the highest level with queued work, in its
+ * own deques first and then in the others', before it looks at a lower level. Jobs are not preempted.
+ * A job waiting for its sub-tasks helps running them, and sleeps only once none is left to take.
+ * A submit never runs the job on the submitter, which may be a sequencer: when every deque is full it is refused.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+
+#include "worker_pool.h"
+
+#define USEC_PER_SEC						(1000000)
+#define NSEC_PER_USEC						(1000)
+
+//Worker running on the calling thread and level of the job it is running. NULL outside the pool.
+static __thread wp_worker_t* wp_self = NULL;
+static __thread int wp_level = WP_LEVELS - 1;
+
+
+/**
+ * @brief This function pushes a job at the tail of a deque.
+ * @return false if the deque is full.
+ */
+static bool wp_push(wp_worker_t* w, int level, const wp_job_t* job)
+{
+	bool pushed = false;
+
+	pthread_mutex_lock(&w->lock);
+	if(w->count[level] < WP_DEQUE_SIZE)
+	{
+		w->job[level][(w->head[level] + w->count[level]) % WP_DEQUE_SIZE] = *job;
+		w->count[level]++;
+		pushed = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return pushed;
+}
+
+
+/**
+ * @brief This function takes a job from a deque, at the tail for the owner or at the head for a thief.
+ * @return false if the deque is empty.
+ */
+static bool wp_pop(wp_worker_t* w, int level, wp_job_t* job, bool steal)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&w->lock);
+	if(w->count[level] > 0)
+	{
+		if(steal)
+		{
+			*job = w->job[level][w->head[level]];
+			w->head[level] = (w->head[level] + 1) % WP_DEQUE_SIZE;
+		}
+		else
+		{
+			*job = w->job[level][(w->head[level] + w->count[level] - 1) % WP_DEQUE_SIZE];
+		}
+		w->count[level]--;
+		found = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return found;
+}
+
+
+/**
+ * @brief This function finds the highest priority job queued anywhere in the pool, down to a given level.
+ * @param pool The pool.
+ * @param self The calling worker, NULL for a thread outside the pool.
+ * @param max_level The lowest priority level to look at.
+ * @param job Returns the job.
+ * @param level Returns the level of the job.
+ * @return false if no job was found.
+ */
+static bool wp_find(wp_pool_t* pool, wp_worker_t* self, int max_level, wp_job_t* job, int* level)
+{
+	int start = (self != NULL) ? self->idx + 1 : 0;
+
+	for(int l=0; l<=max_level; l++)
+	{
+		if(pool->queued[l].load(std::memory_order_acquire) <= 0)
+			continue;
+
+		if((self != NULL) && wp_pop(self, l, job, false))
+		{
+			*level = l;
+			return true;
+		}
+
+		for(int k=0; k<pool->n_workers; k++)
+		{
+			wp_worker_t* victim = &pool->worker[(start + k) % pool->n_workers];
+
+			if(victim == self)
+				continue;
+			if(wp_pop(victim, l, job, true))
+			{
+				if(self != NULL)
+					self->stolen++;
+				*level = l;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+/**
+ * @brief This function runs a job found by wp_find() and signals its group.
+ */
+static void wp_run(wp_pool_t* pool, wp_job_t* job, int level)
+{
+	int saved_level = wp_level;
+
+	pool->queued[level].fetch_sub(1, std::memory_order_relaxed);
+	pool->queued_total.fetch_sub(1, std::memory_order_relaxed);
+
+	wp_level = level;
+	job->fn(job->arg);
+	wp_level = saved_level;
+
+	if((job->group != NULL) && (job->group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1))
+	{
+		pthread_mutex_lock(&pool->done_lock);
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->done_lock);
+	}
+}
+
+
+/**
+ * @brief Thread function of a worker.
+ * @param arg The wp_worker_t.
+ * @return NULL
+ */
+static void* wp_worker_thread(void* arg)
+{
+	wp_worker_t* w = (wp_worker_t*)arg;
+	wp_pool_t* pool = w->pool;
+	wp_job_t job;
+	int level;
+	struct timespec start, stop;
+
+	wp_self = w;
+
+	while(1)
+	{
+		if(wp_find(pool, w, WP_LEVELS - 1, &job, &level))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			wp_run(pool, &job, level);
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			w->executed++;
+			w->busy_us += (stop.tv_sec - start.tv_sec)*USEC_PER_SEC + (stop.tv_nsec - start.tv_nsec)/NSEC_PER_USEC;
+			continue;
+		}
+
+		//Nothing queued: sleep until a submit. Once stopped, workers leave when everything queued has run.
+		pthread_mutex_lock(&pool->idle_lock);
+		if(pool->queued_total.load(std::memory_order_acquire) <= 0)
+		{
+			if(pool->stop)
+			{
+				pthread_mutex_unlock(&pool->idle_lock);
+				break;
+			}
+			pool->idle++;
+			w->sleeps++;
+			pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+			pool->idle--;
+		}
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+
+	pthread_exit(NULL);
+}
+
+
+/**
+ * @brief This function starts the workers of the pool, each pinned to one core.
+ * @param pool The pool.
+ * @param n_workers The number of workers, from 1 to WP_MAX_WORKERS.
+ * @param first_cpu The core of the first worker.
+ * @param n_cpus The number of cores from first_cpu the workers are spread over.
+ * @param prio The SCHED_FIFO priority of the workers.
+ * @return void
+ */
+void wp_start(wp_pool_t* pool, int n_workers, int first_cpu, int n_cpus, int prio)
+{
+	pthread_mutexattr_t mattr;
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpuset;
+
+	if(n_workers < 1)
+		n_workers = 1;
+	if(n_workers > WP_MAX_WORKERS)
+		n_workers = WP_MAX_WORKERS;
+	if(n_cpus < 1)
+		n_cpus = 1;
+
+	pool->n_workers = n_workers;
+	for(int l=0; l<WP_LEVELS; l++)
+	{
+		pool->queued[l].store(0);
+	}
+	pool->queued_total.store(0);
+	pool->next.store(0);
+	pool->idle = 0;
+	pool->stop = false;
+	pool->refused = 0;
+	pthread_mutex_init(&pool->idle_lock, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+
+	//The sequencers submit at a higher priority than the workers
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+	if(pthread_mutex_init(&pool->done_lock, &mattr) != 0)
+	{
+		perror("ERROR: pthread_mutex_init for worker pool");
+		exit(EXIT_FAILURE);
+	}
+	pthread_cond_init(&pool->done_cond, NULL);
+	for(int i=0; i<n_workers; i++)
+	{
+		wp_worker_t* w = &pool->worker[i];
+
+		for(int l=0; l<WP_LEVELS; l++)
+		{
+			w->head[l] = 0;
+			w->count[l] = 0;
+		}
+		if(pthread_mutex_init(&w->lock, &mattr) != 0)
+		{
+			perror("ERROR: pthread_mutex_init for worker deque");
+			exit(EXIT_FAILURE);
+		}
+		w->idx = i;
+		w->cpu = first_cpu + (i % n_cpus);
+		w->pool = pool;
+		w->executed = 0;
+		w->stolen = 0;
+		w->sleeps = 0;
+		w->busy_us = 0;
+	}
+	pthread_mutexattr_destroy(&mattr);
+
+	param.sched_priority = prio;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	for(int i=0; i<n_workers; i++)
+	{
+		CPU_ZERO(&cpuset);
+		CPU_SET(pool->worker[i].cpu, &cpuset);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+
+		if(pthread_create(&pool->worker[i].thread, &attr, wp_worker_thread, (void*)&pool->worker[i]) != 0)
+		{
+			perror("ERROR: pthread_create for worker");
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_attr_destroy(&attr);
+}
+
+
+/**
+ * @brief This function queues a job. A worker queues on its own deque, any other thread spreads jobs round robin.
+ * @param pool The pool.
+ * @param level The priority level of the job, 0 being the highest.
+ * @param fn The job function.
+ * @param arg The argument of the job function.
+ * @param group The group to signal once the job completed, or NULL.
+ * @return true if the job was queued, false if every deque was full. A refused job is not counted in its group.
+ */
+bool wp_submit(wp_pool_t* pool, int level, wp_fn_t fn, void* arg, wp_group_t* group)
+{
+	wp_job_t job;
+	int first, k;
+
+	if(level < 0)
+		level = 0;
+	if(level >= WP_LEVELS)
+		level = WP_LEVELS - 1;
+
+	job.fn = fn;
+	job.arg = arg;
+	job.group = group;
+	if(group != NULL)
+		group->pending.fetch_add(1, std::memory_order_relaxed);
+
+	if((wp_self != NULL) && (wp_self->pool == pool))
+		first = wp_self->idx;
+	else
+		first = pool->next.fetch_add(1, std::memory_order_relaxed) % pool->n_workers;
+
+	for(k=0; k<pool->n_workers; k++)
+	{
+		if(wp_push(&pool->worker[(first + k) % pool->n_workers], level, &job))
+			break;
+	}
+
+	//Every deque is full: the submitter decides what becomes of the job
+	if(k == pool->n_workers)
+	{
+		__atomic_fetch_add(&pool->refused, 1, __ATOMIC_RELAXED);
+		if(group != NULL)
+			group->pending.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	pool->queued[level].fetch_add(1, std::memory_order_release);
+	pool->queued_total.fetch_add(1, std::memory_order_release);
+
+	pthread_mutex_lock(&pool->idle_lock);
+	if(pool->idle > 0)
+		pthread_cond_signal(&pool->idle_cond);
+	pthread_mutex_unlock(&pool->idle_lock);
+	return true;
+}
+
+
+/**
+ * @brief This function initializes an empty group of sub-tasks.
+ * @param group The group.
+ * @return void
+ */
+void wp_group_init(wp_group_t* group)
+{
+	group->pending.store(0);
+}
+
+
+/**
+ * @brief This function waits until every job of a group completed. The caller runs queued jobs of the same or a
+ * higher priority meanwhile, so that a job waiting for its sub-tasks does not hold its core idle. Once there are none,
+ * it sleeps until a group completes rather than yielding, which under SCHED_FIFO would starve lower priority threads
+ * of its core.
+ * @param pool The pool.
+ * @param group The group.
+ * @return void
+ */
+void wp_wait(wp_pool_t* pool, wp_group_t* group)
+{
+	wp_worker_t* self = ((wp_self != NULL) && (wp_self->pool == pool)) ? wp_self : NULL;
+	wp_job_t job;
+	int level;
+
+	while(group->pending.load(std::memory_order_acquire) > 0)
+	{
+		if(wp_find(pool, self, wp_level, &job, &level))
+		{
+			wp_run(pool, &job, level);
+			if(self != NULL)
+				self->executed++;
+		}
+		else
+		{
+			pthread_mutex_lock(&pool->done_lock);
+			if(group->pending.load(std::memory_order_acquire) > 0)
+				pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+			pthread_mutex_unlock(&pool->done_lock);
+		}
+	}
+}
+
+
+/**
+ * @brief This function stops the pool once every queued job has run, and joins the workers.
+ * @param pool The pool.
+ * @return void
+ */
+void wp_stop(wp_pool_t* pool)
+{
+	pthread_mutex_lock(&pool->idle_lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->idle_cond);
+	pthread_mutex_unlock(&pool->idle_lock);
+
+	for(int i=0; i<pool->n_workers; i++)
+	{
+		pthread_join(pool->worker[i].thread, NULL);
+		pthread_mutex_destroy(&pool->worker[i].lock);
+	}
+	pthread_mutex_destroy(&pool->idle_lock);
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_mutex_destroy(&pool->done_lock);
+	pthread_cond_destroy(&pool->done_cond);
+}
+
+
+/**
+ * @brief This function prints the load of every worker.
+ * @param pool The pool.
+ * @return void
+ */
+void wp_report(wp_pool_t* pool)
+{
+	printf("\nWORKER POOL (%d workers):\n", pool->n_workers);
+	printf("%-6s %4s %10s %10s %10s %12s\n", "worker", "cpu", "jobs", "stolen", "sleeps", "busy_ms");
+	for(int i=0; i<pool->n_workers; i++)
+	{
+		wp_worker_t* w = &pool->worker[i];
+		printf("%-6d %4d %10lu %10lu %10lu %12.1f\n", i, w->cpu, w->executed, w->stolen, w->sleeps, w->busy_us/1000);
+	}
+	printf("WORKER POOL Submits refused on full deques: %lu\n", pool->refused);
+}
@@ -0,0 +1,81 @@
+/**
+ * @file worker_pool.h
+ * @brief Priority aware work-stealing pool running service jobs and their sub-tasks on any free core.
+ *
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <atomic>
+
+//Largest number of workers, priority levels (0 is the highest) and jobs queued per worker and level
+#define WP_MAX_WORKERS						(16)
+#define WP_LEVELS						(8)
+#define WP_DEQUE_SIZE						(64)
+
+
+typedef void (*wp_fn_t)(void* arg);
+
+
+//Join counter of a set of sub-tasks
+typedef struct
+{
+	std::atomic<int> pending;
+} wp_group_t;
+
+
+typedef struct
+{
+	wp_fn_t fn;
+	void* arg;
+	wp_group_t* group;					//Signalled when the job completes, may be NULL
+} wp_job_t;
+
+
+typedef struct
+{
+	//One deque per level. The owner pushes and pops at the tail, thieves take from the head.
+	wp_job_t job[WP_LEVELS][WP_DEQUE_SIZE];
+	int head[WP_LEVELS];
+	int count[WP_LEVELS];
+	pthread_mutex_t lock;
+	pthread_t thread;
+	int idx;
+	int cpu;
+	struct wp_pool* pool;
+
+	//Statistics, written by the worker only
+	unsigned long executed;
+	unsigned long stolen;					//Jobs taken from another worker's deque
+	unsigned long sleeps;					//Times the worker found no work and slept
+	double busy_us;
+} wp_worker_t;
+
+
+typedef struct wp_pool
+{
+	wp_worker_t worker[WP_MAX_WORKERS];
+	int n_workers;
+	std::atomic<int> queued[WP_LEVELS];			//Jobs queued per level over all workers
+	std::atomic<int> queued_total;
+	std::atomic<unsigned int> next;				//Round robin target for jobs submitted from outside the pool
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	int idle;						//Workers sleeping on idle_cond
+	pthread_mutex_t done_lock;
+	pthread_cond_t done_cond;				//Signalled when a group completes
+	bool stop;
+	unsigned long refused;					//Submits refused because every deque was full
+} wp_pool_t;
+
+
+void wp_start(wp_pool_t* pool, int n_workers, int first_cpu, int n_cpus, int prio);
+bool wp_submit(wp_pool_t* pool, int level, wp_fn_t fn, void* arg, wp_group_t* group);
+void wp_group_init(wp_group_t* group);
+void wp_wait(wp_pool_t* pool, wp_group_t* group);
+void wp_stop(wp_pool_t* pool);
+void wp_report(wp_pool_t* pool);
+
+#endif